@@ -0,0 +1,393 @@
+// Compares the node formats of shape::BVH (BvhBuildOptions::node_format) on the same trees. Every query kind is
+// timed for each format, on Linux the L1 data and last level cache misses of each run are counted as well. The full
+// precision tree is also traversed in the depth first order shape::BVH used before ReorderNodes and in the sibling
+// pair order it uses now.
+//
+//   cmake -S . -B build -DJETWAVE_BENCHMARKS=ON && cmake --build build --target bvh_node_bench
+//   bin/bvh_node_bench [repeats]
+//
+// bvh_node_bench_binary is the same benchmark built with DOOB_BVH_WIDTH=0, so the binary kernels (including the
+// binary quantized nodes) run on SIMD targets too.
+#include <src/Graphics/Shapes/BVH.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <format>
+#include <memory>
+#include <optional>
+#include <print>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(DOOB_PLATFORM_LINUX)
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace devs_out_of_bounds;
+
+namespace {
+// Hardware cache event of the calling thread, unavailable without perf support (e.g. in most VMs)
+class CacheCounter : NoCopy, NoMove {
+public:
+#if defined(DOOB_PLATFORM_LINUX)
+    explicit CacheCounter(uint64_t cache_id) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = cache_id | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        m_fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+    ~CacheCounter() {
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+    }
+    void Start() {
+        if (m_fd >= 0) {
+            ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    DOOB_NODISCARD std::optional<uint64_t> Stop() {
+        uint64_t count = 0;
+        if (m_fd < 0) {
+            return std::nullopt;
+        }
+        ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(m_fd, &count, sizeof(count)) != sizeof(count)) {
+            return std::nullopt;
+        }
+        return count;
+    }
+
+private:
+    int m_fd = -1;
+#else
+    explicit CacheCounter(uint64_t) {}
+    void Start() {}
+    DOOB_NODISCARD std::optional<uint64_t> Stop() { return std::nullopt; }
+#endif
+};
+
+struct Measurement {
+    double milliseconds = 0.0;
+    std::optional<uint64_t> l1_misses = {};
+    std::optional<uint64_t> llc_misses = {};
+    uint64_t checksum = 0; // keeps the queries from being optimized out, and shows the formats agree
+};
+
+// Best of repeats, the misses are taken from the fastest run
+template <typename TQuery>
+Measurement Measure(int repeats, TQuery&& query) {
+#if defined(DOOB_PLATFORM_LINUX)
+    CacheCounter l1(PERF_COUNT_HW_CACHE_L1D);
+    CacheCounter llc(PERF_COUNT_HW_CACHE_LL);
+#else
+    CacheCounter l1(0);
+    CacheCounter llc(0);
+#endif
+    Measurement best = { .milliseconds = INFINITY };
+    for (int i = 0; i < repeats; ++i) {
+        l1.Start();
+        llc.Start();
+        const auto start = std::chrono::high_resolution_clock::now();
+        const uint64_t checksum = query();
+        const std::chrono::duration<double, std::milli> duration = std::chrono::high_resolution_clock::now() - start;
+        const std::optional<uint64_t> l1_misses = l1.Stop();
+        const std::optional<uint64_t> llc_misses = llc.Stop();
+        if (duration.count() < best.milliseconds) {
+            best = { duration.count(), l1_misses, llc_misses, checksum };
+        }
+    }
+    return best;
+}
+
+std::string FormatMisses(const std::optional<uint64_t>& misses, size_t ray_count) {
+    return misses ? std::format("{:8.2f}", static_cast<double>(*misses) / static_cast<double>(ray_count)) : "     n/a";
+}
+
+// Rolling terrain, rays from above hit it coherently
+void MakeHeightfield(Mesh& mesh, int resolution) {
+    for (int y = 0; y <= resolution; ++y) {
+        for (int x = 0; x <= resolution; ++x) {
+            const float u = static_cast<float>(x) / resolution;
+            const float v = static_cast<float>(y) / resolution;
+            const float height = std::sin(u * 40.0f) * std::cos(v * 52.0f) * 2.0f + std::sin(u * 7.0f + v * 5.0f);
+            mesh.m_vertices.push_back({ .position = { u * 20.0f - 10.0f, height, v * 20.0f - 10.0f } });
+        }
+    }
+    for (int y = 0; y < resolution; ++y) {
+        for (int x = 0; x < resolution; ++x) {
+            const uint32_t i = static_cast<uint32_t>(y * (resolution + 1) + x);
+            const uint32_t row = static_cast<uint32_t>(resolution + 1);
+            for (uint32_t index : { i, i + 1, i + row, i + 1, i + row + 1, i + row }) {
+                mesh.m_indices.push_back(index);
+            }
+        }
+    }
+}
+
+// Small triangles scattered through a box, every ray passes through many overlapping nodes
+void MakeSoup(Mesh& mesh, uint32_t triangle_count, std::mt19937& rng) {
+    std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> offset(-0.4f, 0.4f);
+    for (uint32_t i = 0; i < triangle_count; ++i) {
+        const glm::vec3 center = { position(rng), position(rng), position(rng) };
+        for (int k = 0; k < 3; ++k) {
+            mesh.m_vertices.push_back({ .position = center + glm::vec3(offset(rng), offset(rng), offset(rng)) });
+            mesh.m_indices.push_back(static_cast<uint32_t>(mesh.m_indices.size()));
+        }
+    }
+}
+
+// Rows of 4x4 pixel blocks of a camera looking down at the scene, in the order the renderer traces them
+std::vector<Ray> MakeCameraRays(int resolution) {
+    std::vector<Ray> rays;
+    rays.reserve(static_cast<size_t>(resolution) * resolution);
+    for (int block_y = 0; block_y < resolution; block_y += 4) {
+        for (int block_x = 0; block_x < resolution; block_x += 4) {
+            for (int y = block_y; y < block_y + 4; ++y) {
+                for (int x = block_x; x < block_x + 4; ++x) {
+                    const glm::vec2 ndc =
+                        glm::vec2((x + 0.5f) / resolution, (y + 0.5f) / resolution) * 2.0f - 1.0f;
+                    rays.push_back({
+                        .origin = { 0.0f, 14.0f, -14.0f },
+                        .direction = glm::normalize(glm::vec3(ndc.x, ndc.y - 0.8f, 1.0f)),
+                    });
+                }
+            }
+        }
+    }
+    return rays;
+}
+
+// Random origins and directions inside the scene, like diffuse bounces
+std::vector<Ray> MakeIncoherentRays(size_t count, std::mt19937& rng) {
+    std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+    std::vector<Ray> rays(count);
+    for (Ray& ray : rays) {
+        ray.origin = { position(rng), position(rng) * 0.3f, position(rng) };
+        ray.direction = glm::normalize(glm::vec3(direction(rng), direction(rng), direction(rng)) + 1e-3f);
+    }
+    return rays;
+}
+
+// Child lookup of the two binary node orders the layout comparison traverses. DepthFirstOrder is the order shape::BVH
+// used before ReorderNodes: the left child directly behind its parent, offset pointing at the right one.
+struct DepthFirstOrder {
+    static uint32_t Left(uint32_t index, const shape::BvhNode&) { return index + 1; }
+    static uint32_t Right(uint32_t, const shape::BvhNode& node) { return node.offset; }
+};
+// What ReorderNodes produces, both children next to each other on one cache line
+struct SiblingPairOrder {
+    static uint32_t Left(uint32_t, const shape::BvhNode& node) { return node.Left(); }
+    static uint32_t Right(uint32_t, const shape::BvhNode& node) { return node.Right(); }
+};
+
+// Undoes ReorderNodes, the nodes are the same 32 byte nodes in the order FlattenRecursive emits them
+uint32_t AppendDepthFirst(const shape::BvhNodeArray& pairs, uint32_t index, shape::BvhNodeArray& out) {
+    const uint32_t out_index = static_cast<uint32_t>(out.size());
+    out.push_back(pairs[index]);
+    if (pairs[index].IsLeaf()) {
+        return out_index;
+    }
+    AppendDepthFirst(pairs, pairs[index].Left(), out);
+    out[out_index].offset = AppendDepthFirst(pairs, pairs[index].Right(), out);
+    return out_index;
+}
+
+// Front to back traversal down to the nearest leaf box, like BVH::IntersectBinary without the triangle tests, so only
+// the node fetches differ between the orders. Leaf boxes stand in for hits and cull the rest of the tree.
+template <typename TOrder>
+float NearestLeafEntry(const shape::BvhNodeArray& nodes, const Ray& ray) {
+    const PrecomputedRay query(ray);
+    float best = INFINITY;
+    float t_entry;
+    if (nodes.empty() || !nodes[0].aabb.RayIntersects(query, ray.t_min, ray.t_max, &t_entry)) {
+        return best;
+    }
+    struct StackEntry {
+        uint32_t node;
+        float t_entry;
+    };
+    StackEntry stack[shape::BVH::MAX_DEPTH + 1];
+    size_t stack_ptr = 0;
+    stack[stack_ptr++] = { 0, t_entry };
+    while (stack_ptr > 0) {
+        const StackEntry entry = stack[--stack_ptr];
+        if (entry.t_entry >= best) {
+            continue;
+        }
+        const shape::BvhNode& node = nodes[entry.node];
+        if (node.IsLeaf()) {
+            best = entry.t_entry;
+            continue;
+        }
+        const uint32_t children[2] = { TOrder::Left(entry.node, node), TOrder::Right(entry.node, node) };
+        float child_t[2];
+        bool b_hit[2];
+        for (int i = 0; i < 2; ++i) {
+            b_hit[i] = nodes[children[i]].aabb.RayIntersects(query, ray.t_min, best, &child_t[i]);
+        }
+        const int near = b_hit[0] && b_hit[1] && child_t[1] < child_t[0] ? 1 : 0;
+        if (b_hit[1 - near]) {
+            stack[stack_ptr++] = { children[1 - near], child_t[1 - near] };
+        }
+        if (b_hit[near]) {
+            stack[stack_ptr++] = { children[near], child_t[near] };
+        }
+    }
+    return best;
+}
+
+// Same tree in both orders, the checksums have to agree
+void RunLayouts(const shape::BVH& bvh, const std::vector<Ray>& camera_rays, const std::vector<Ray>& incoherent_rays,
+    int repeats) {
+    shape::BvhNodeArray depth_first;
+    depth_first.reserve(bvh.GetNodes().size());
+    if (!bvh.GetNodes().empty()) {
+        AppendDepthFirst(bvh.GetNodes(), 0, depth_first);
+    }
+
+    struct Layout {
+        const char* name;
+        const shape::BvhNodeArray* nodes;
+        float (*nearest)(const shape::BvhNodeArray& nodes, const Ray& ray);
+    };
+    const Layout layouts[] = {
+        { "depth first", &depth_first, NearestLeafEntry<DepthFirstOrder> },
+        { "sibling pairs", &bvh.GetNodes(), NearestLeafEntry<SiblingPairOrder> },
+    };
+    const std::pair<const char*, const std::vector<Ray>*> ray_sets[] = {
+        { "nearest leaf", &camera_rays },
+        { "nearest leaf incoh.", &incoherent_rays },
+    };
+
+    std::println("  {:<20} {:<13} {:>9} {:>8} {:>8} {:>8}", "node order", "layout", "ms", "L1D/ray", "LLC/ray",
+        "speedup");
+    for (const auto& [query_name, rays] : ray_sets) {
+        double baseline_ms = 0.0;
+        for (size_t i = 0; i < std::size(layouts); ++i) {
+            const Layout& layout = layouts[i];
+            const Measurement result = Measure(repeats, [&] {
+                uint64_t checksum = 0;
+                for (const Ray& ray : *rays) {
+                    const float t = layout.nearest(*layout.nodes, ray);
+                    checksum += std::isfinite(t) ? static_cast<uint64_t>(t * 1024.0f) : 0;
+                }
+                return checksum;
+            });
+            baseline_ms = i == 0 ? result.milliseconds : baseline_ms;
+            std::println("  {:<20} {:<13} {:9.2f} {} {} {:7.3f}x  ({:x})", query_name, layout.name,
+                result.milliseconds, FormatMisses(result.l1_misses, rays->size()),
+                FormatMisses(result.llc_misses, rays->size()), baseline_ms / result.milliseconds, result.checksum);
+        }
+    }
+}
+
+void RunScene(const char* name, const Mesh& mesh, int repeats, std::mt19937& rng) {
+    const MeshInstance instance(&mesh);
+    const std::vector<Ray> camera_rays = MakeCameraRays(1024);
+    const std::vector<Ray> incoherent_rays = MakeIncoherentRays(camera_rays.size(), rng);
+
+    struct Query {
+        const char* name;
+        const std::vector<Ray>* rays;
+        uint64_t (*run)(const shape::BVH& bvh, const std::vector<Ray>& rays);
+    };
+    const Query queries[] = {
+        { "closest", &camera_rays, [](const shape::BVH& bvh, const std::vector<Ray>& rays) {
+             uint64_t hits = 0;
+             for (const Ray& ray : rays) {
+                 Intersection hit;
+                 hits += bvh.Intersect(ray, &hit) ? hit.primitive : 0;
+             }
+             return hits;
+         } },
+        { "packet 4x4", &camera_rays, [](const shape::BVH& bvh, const std::vector<Ray>& rays) {
+             uint64_t hits = 0;
+             for (size_t i = 0; i + RayPacket::SIZE <= rays.size(); i += RayPacket::SIZE) {
+                 RayPacket packet;
+                 packet.Init(&rays[i], RayPacket::FULL_MASK);
+                 Intersection intersections[RayPacket::SIZE];
+                 ForEachRay(bvh.IntersectPacket(packet, intersections),
+                     [&](uint32_t lane) { hits += intersections[lane].primitive; });
+             }
+             return hits;
+         } },
+        { "closest incoherent", &incoherent_rays, [](const shape::BVH& bvh, const std::vector<Ray>& rays) {
+             uint64_t hits = 0;
+             for (const Ray& ray : rays) {
+                 Intersection hit;
+                 hits += bvh.Intersect(ray, &hit) ? hit.primitive : 0;
+             }
+             return hits;
+         } },
+        { "occluded incoherent", &incoherent_rays, [](const shape::BVH& bvh, const std::vector<Ray>& rays) {
+             uint64_t hits = 0;
+             for (const Ray& ray : rays) {
+                 hits += bvh.Occluded(ray) ? 1 : 0;
+             }
+             return hits;
+         } },
+    };
+
+    std::println("{}: {} triangles, {} rays per query, best of {}", name, mesh.m_indices.size() / 3,
+        camera_rays.size(), repeats);
+    const shape::BvhNodeFormat formats[] = {
+        shape::BvhNodeFormat::Full,
+        shape::BvhNodeFormat::Quantized16,
+        shape::BvhNodeFormat::Quantized8,
+    };
+    const char* format_names[] = { "full", "quantized16", "quantized8" };
+    std::vector<std::unique_ptr<shape::BVH>> bvhs;
+    for (shape::BvhNodeFormat format : formats) {
+        const shape::BvhBuildOptions options = { .node_format = format };
+        bvhs.push_back(std::make_unique<shape::BVH>(&instance, nullptr, options));
+        std::println("  {:<11} {:.2f} MiB nodes", format_names[bvhs.size() - 1],
+            static_cast<double>(bvhs.back()->GetNodeMemoryUsage()) / (1024.0 * 1024.0));
+    }
+    std::println("  {:<20} {:<11} {:>9} {:>8} {:>8} {:>8}", "query", "format", "ms", "L1D/ray", "LLC/ray", "speedup");
+    for (const Query& query : queries) {
+        double baseline_ms = 0.0;
+        for (size_t i = 0; i < bvhs.size(); ++i) {
+            const Measurement result = Measure(repeats, [&] { return query.run(*bvhs[i], *query.rays); });
+            baseline_ms = i == 0 ? result.milliseconds : baseline_ms;
+            std::println("  {:<20} {:<11} {:9.2f} {} {} {:7.3f}x  ({:x})", query.name, format_names[i],
+                result.milliseconds, FormatMisses(result.l1_misses, query.rays->size()),
+                FormatMisses(result.llc_misses, query.rays->size()), baseline_ms / result.milliseconds,
+                result.checksum);
+        }
+    }
+    RunLayouts(*bvhs[0], camera_rays, incoherent_rays, repeats);
+}
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const int repeats = argc > 1 ? std::max(std::atoi(argv[1]), 1) : 5;
+    std::mt19937 rng(1);
+    {
+        Mesh heightfield;
+        MakeHeightfield(heightfield, 700);
+        RunScene("heightfield", heightfield, repeats, rng);
+    }
+    {
+        Mesh soup;
+        MakeSoup(soup, 500000, rng);
+        RunScene("triangle soup", soup, repeats, rng);
+    }
+    return 0;
+}
@@ -6,6 +6,7 @@
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <new>
 #include <glm/glm.hpp>
 #include <glm/gtx/rotate_vector.hpp>
 #include <glm/gtx/quaternion.hpp>
@@ -84,6 +85,16 @@
 #define DOOB_PLATFORM_FAMILY_UNIX 1
 #endif
 
+/*
+ * SIMD instruction set detection, MSVC only reports AVX through __AVX2__ and always has SSE2 on x64
+ */
+#if defined(__AVX2__)
+#define DOOB_SIMD_AVX2 1
+#endif
+#if defined(DOOB_SIMD_AVX2) || defined(__SSE2__) || defined(DOOB_ARCH_X86_64) || defined(_M_IX86_FP)
+#define DOOB_SIMD_SSE 1
+#endif
+
 #define DOOB_NODISCARD [[nodiscard]]
 #define DOOB_UNUSED [[maybe_unused]]
 
@@ -105,6 +116,30 @@ struct NoMove {
     NoMove& operator=(NoMove&&) = delete;
 };
 
+// Allocator for std::vector storage that has to start on a cache line (or wider) boundary
+template <typename T, size_t ALIGNMENT>
+struct AlignedAllocator {
+    using value_type = T;
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, ALIGNMENT>;
+    };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, ALIGNMENT>&) {}
+
+    DOOB_NODISCARD T* allocate(size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(ALIGNMENT)));
+    }
+    void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t(ALIGNMENT)); }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, ALIGNMENT>&) const {
+        return true;
+    }
+};
+
 struct Size {
     uint32_t width = 0;
     uint32_t height = 0;
@@ -8,12 +8,55 @@ struct AABB {
     glm::vec3 min = {};
     glm::vec3 max = {};
 
-    DOOB_NODISCARD AABB Union(const AABB& other) {
+    // Inverted bounds, so that any Union/Grow replaces them
+    DOOB_NODISCARD static AABB Empty() {
+        return {
+            .min = { INFINITY, INFINITY, INFINITY },
+            .max = { -INFINITY, -INFINITY, -INFINITY },
+        };
+    }
+
+    DOOB_NODISCARD AABB Union(const AABB& other) const {
         return {
             .min = glm::min(other.min, min),
             .max = glm::max(other.max, max),
         };
     }
+    // Overlapping region of both boxes, inverted (see IsEmpty) when they do not overlap
+    DOOB_NODISCARD AABB Intersection(const AABB& other) const {
+        return {
+            .min = glm::max(other.min, min),
+            .max = glm::min(other.max, max),
+        };
+    }
+    DOOB_FORCEINLINE void Grow(const AABB& other) {
+        min = glm::min(other.min, min);
+        max = glm::max(other.max, max);
+    }
+    DOOB_FORCEINLINE void Grow(const glm::vec3& point) {
+        min = glm::min(point, min);
+        max = glm::max(point, max);
+    }
+
+    DOOB_NODISCARD DOOB_FORCEINLINE glm::vec3 Centroid() const { return (min + max) * 0.5f; }
+    DOOB_NODISCARD DOOB_FORCEINLINE glm::vec3 Extent() const { return max - min; }
+
+    DOOB_NODISCARD float SurfaceArea() const {
+        const glm::vec3 e = glm::max(max - min, glm::vec3(0.0f));
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    DOOB_NODISCARD DOOB_FORCEINLINE bool IsEmpty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+
+    // Shapes such as planes report infinite bounds, these cannot be put into a hierarchy
+    DOOB_NODISCARD bool IsBounded() const {
+        for (int i = 0; i < 3; ++i) {
+            if (!std::isfinite(min[i]) || !std::isfinite(max[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
 
     DOOB_NODISCARD bool RayIntersects(const Ray& ray) const {
         const glm::vec3 inv_dir = 1.0f / (ray.direction + glm::sign(ray.direction) * 1e-9f);
@@ -33,24 +76,25 @@ struct AABB {
         float t_in = glm::max(tx_in, ty_in, tz_in);
         float t_out = glm::min(tx_out, ty_out, tz_out);
 
-        if (t_in > t_out) {
-            return false;
-        }
-
-        float t_hit = t_in;
-        bool b_front_facing = true;
-
-        if (t_in < 0.0f) {
-            t_hit = t_out;
-            b_front_facing = false; // We are hitting the inside surface
-            if (t_hit > ray.t_max)
-                return false; // Exit point too far
-        }
+        // The box only counts if it overlaps the [t_min, t_max] segment of the ray, a box that is entered
+        // before t_min but exited after it still contains valid hits
+        return glm::max(t_in, ray.t_min) <= glm::min(t_out, ray.t_max);
+    }
 
-        if (t_hit < ray.t_min)
-            return false;
+    // Slab test for traversal loops, returns the distance at which the [t_min, t_max] segment enters the box
+    DOOB_NODISCARD DOOB_FORCEINLINE bool RayIntersects(
+        const PrecomputedRay& ray, float t_min, float t_max, float* out_t_entry) const {
+        const float tx_in = ((ray.sign[0] ? max.x : min.x) - ray.origin.x) * ray.inv_direction.x;
+        const float tx_out = ((ray.sign[0] ? min.x : max.x) - ray.origin.x) * ray.inv_direction.x;
+        const float ty_in = ((ray.sign[1] ? max.y : min.y) - ray.origin.y) * ray.inv_direction.y;
+        const float ty_out = ((ray.sign[1] ? min.y : max.y) - ray.origin.y) * ray.inv_direction.y;
+        const float tz_in = ((ray.sign[2] ? max.z : min.z) - ray.origin.z) * ray.inv_direction.z;
+        const float tz_out = ((ray.sign[2] ? min.z : max.z) - ray.origin.z) * ray.inv_direction.z;
 
-        return true;
+        const float t_in = glm::max(glm::max(tx_in, ty_in), glm::max(tz_in, t_min));
+        const float t_out = glm::min(glm::min(tx_out, ty_out), glm::min(tz_out, t_max));
+        *out_t_entry = t_in;
+        return t_in <= t_out;
     }
 };
 } // namespace devs_out_of_bounds
\ No newline at end of file
@@ -9,5 +9,9 @@ struct IMaterial {
     IMaterial() = default;
     virtual ~IMaterial() = default;
     DOOB_NODISCARD virtual void Evaluate(const Fragment& input, BSDF* out_bsdf, glm::vec3* out_emission) const = 0;
+    // Whether any hit on this material may let light through, shadow rays can stop at the first hit otherwise
+    DOOB_NODISCARD virtual bool MayTransmit() const { return false; }
+    // Whether a hit on the given side of a material that MayTransmit() still stops all light
+    DOOB_NODISCARD virtual bool IsOpaqueFace(bool b_front_face) const { return !MayTransmit(); }
 };
 } // namespace devs_out_of_bounds
\ No newline at end of file
@@ -1,12 +1,30 @@
 #pragma once
 #include <src/Graphics/AABB.hpp>
 #include <src/Graphics/Ray.hpp>
+#include <src/Graphics/RayPacket.hpp>
 #include <src/Graphics/Fragment.hpp>
 namespace devs_out_of_bounds {
 struct IShape {
     IShape() = default;
     virtual ~IShape() = default;
     DOOB_NODISCARD virtual bool Intersect(const Ray& ray, Intersection* out_intersection) const = 0;
+    // Any hit query, returns whether anything is hit within [t_min, t_max] without searching for the closest hit
+    DOOB_NODISCARD virtual bool Occluded(const Ray& ray) const { return Intersect(ray, nullptr); }
+    // Closest hit query for a packet. Every active ray that hits something before its t_max gets its intersection
+    // written and its t_max shortened, returns the mask of those rays. Shapes without a packet traversal fall back
+    // to one query per ray.
+    DOOB_NODISCARD virtual uint32_t IntersectPacket(RayPacket& packet, Intersection* out_intersections) const {
+        uint32_t hit_mask = 0;
+        ForEachRay(packet.active_mask, [&](uint32_t i) {
+            Intersection hit;
+            if (Intersect(packet.rays[i], &hit)) {
+                out_intersections[i] = hit;
+                packet.SetTMax(i, hit.t);
+                hit_mask |= 1U << i;
+            }
+        });
+        return hit_mask;
+    }
     DOOB_NODISCARD virtual Fragment SampleFragment(const Intersection& intersection) const = 0;
     DOOB_NODISCARD virtual AABB GetAABB() const = 0;
 };
@@ -19,6 +19,7 @@ namespace material {
                 out_bsdf->Add<bxdf::GgxMicrofacetBrdf>(glm::vec3(0.04f), m_roughness, nor);
             }
         }
+        DOOB_NODISCARD bool MayTransmit() const override { return true; }
 
         glm::vec3 m_tint = { 1, 1, 1 };
         float m_roughness = 0.02f;
@@ -95,6 +95,11 @@ namespace material {
             out_bsdf->Add<bxdf::LambertBrdf>(vec3(base_color) * (1.0f - metal), world_normal);
             out_bsdf->Add<bxdf::GgxMicrofacetBrdf>(mix(glm::vec3(0.04f), vec3(base_color), metal), rough, world_normal);
         }
+        // Single sided surfaces let everything through from behind, see Evaluate
+        DOOB_NODISCARD bool MayTransmit() const override { return blend_mode != BlendMode::Opaque || !b_double_sided; }
+        DOOB_NODISCARD bool IsOpaqueFace(bool b_front_face) const override {
+            return blend_mode == BlendMode::Opaque && (b_double_sided || b_front_face);
+        }
 
         ISamplerState* sampler_state = {};
 
@@ -19,6 +19,7 @@ namespace material {
                 }
             }
         }
+        DOOB_NODISCARD bool MayTransmit() const override { return true; }
 
         float m_grid_size = 0.5f;
         glm::vec3 m_grid_foreground = { 0.7f, 0.7f, 0.7f };
@@ -25,24 +25,30 @@ struct VertexAttributes {
 
 class MeshInstance : NoCopy, NoMove {
 public:
-    MeshInstance(const Mesh* mesh, const glm::mat4& transform = glm::mat4(1.0f)) {
-        m_positions.reserve(mesh->GetVertices().size());
-        m_attributes.reserve(mesh->GetVertices().size());
+    MeshInstance(const Mesh* mesh, const glm::mat4& transform = glm::mat4(1.0f)) : m_mesh(mesh) {
+        m_positions.resize(mesh->GetVertices().size());
+        m_attributes.resize(mesh->GetVertices().size());
 
         m_index_ptr = mesh->GetIndices().data();
         m_num_indices = mesh->GetIndices().size();
 
-        for (int i = 0; i < mesh->GetVertices().size(); ++i) {
-            glm::vec4 pos_h = glm::vec4(mesh->GetVertices()[i].position, 1.0f);
-            m_positions.push_back(glm::vec3(transform * pos_h));
+        SetTransform(transform);
+    }
+
+    // Rewrites the world space vertices in place, so pointers held by shapes stay valid. Shapes built over this
+    // instance have to be refit (or rebuilt) afterwards.
+    void SetTransform(const glm::mat4& transform) {
+        for (int i = 0; i < m_mesh->GetVertices().size(); ++i) {
+            glm::vec4 pos_h = glm::vec4(m_mesh->GetVertices()[i].position, 1.0f);
+            m_positions[i] = glm::vec3(transform * pos_h);
         }
         glm::mat3 normal_transform = glm::inverse(glm::transpose(glm::mat3(transform)));
-        for (int i = 0; i < mesh->GetVertices().size(); ++i) {
-            m_attributes.push_back({
-                .normal = normal_transform * mesh->GetVertices()[i].normal,
-                .tangent = normal_transform * mesh->GetVertices()[i].tangent,
-                .uv = mesh->GetVertices()[i].uv,
-            });
+        for (int i = 0; i < m_mesh->GetVertices().size(); ++i) {
+            m_attributes[i] = {
+                .normal = normal_transform * m_mesh->GetVertices()[i].normal,
+                .tangent = normal_transform * m_mesh->GetVertices()[i].tangent,
+                .uv = m_mesh->GetVertices()[i].uv,
+            };
         }
     }
 
@@ -78,6 +84,7 @@ public:
         };
     }
 
+    const Mesh* m_mesh;
     const uint32_t* m_index_ptr;
     uint32_t m_num_indices;
     std::vector<glm::vec3> m_positions;
@@ -0,0 +1,79 @@
+#pragma once
+#include <src/Core.hpp>
+
+namespace devs_out_of_bounds {
+// Spreads the lower 10 bits of v so two zero bits follow every bit, e.g. 0b111 -> 0b001001001
+DOOB_NODISCARD DOOB_FORCEINLINE uint32_t MortonExpandBits(uint32_t v) {
+    v &= 0x3FFU;
+    v = (v | (v << 16)) & 0x030000FFU;
+    v = (v | (v << 8)) & 0x0300F00FU;
+    v = (v | (v << 4)) & 0x030C30C3U;
+    v = (v | (v << 2)) & 0x09249249U;
+    return v;
+}
+
+// Interleaves three 10 bit coordinates into a 30 bit Morton code, x ends up in the lowest bit
+DOOB_NODISCARD DOOB_FORCEINLINE uint32_t MortonEncode3(uint32_t x, uint32_t y, uint32_t z) {
+    return MortonExpandBits(x) | (MortonExpandBits(y) << 1) | (MortonExpandBits(z) << 2);
+}
+
+// Spreads the lower 16 bits of v so a zero bit follows every bit, e.g. 0b111 -> 0b010101
+DOOB_NODISCARD DOOB_FORCEINLINE uint32_t MortonExpandBits2(uint32_t v) {
+    v &= 0xFFFFU;
+    v = (v | (v << 8)) & 0x00FF00FFU;
+    v = (v | (v << 4)) & 0x0F0F0F0FU;
+    v = (v | (v << 2)) & 0x33333333U;
+    v = (v | (v << 1)) & 0x55555555U;
+    return v;
+}
+
+// Inverse of MortonExpandBits2, gathers every other bit starting at the lowest one
+DOOB_NODISCARD DOOB_FORCEINLINE uint32_t MortonCompactBits2(uint32_t v) {
+    v &= 0x55555555U;
+    v = (v | (v >> 1)) & 0x33333333U;
+    v = (v | (v >> 2)) & 0x0F0F0F0FU;
+    v = (v | (v >> 4)) & 0x00FF00FFU;
+    v = (v | (v >> 8)) & 0x0000FFFFU;
+    return v;
+}
+
+// Interleaves two 16 bit coordinates into a 32 bit Morton code, x ends up in the lowest bit
+DOOB_NODISCARD DOOB_FORCEINLINE uint32_t MortonEncode2(uint32_t x, uint32_t y) {
+    return MortonExpandBits2(x) | (MortonExpandBits2(y) << 1);
+}
+
+DOOB_NODISCARD DOOB_FORCEINLINE glm::uvec2 MortonDecode2(uint32_t code) {
+    return { MortonCompactBits2(code), MortonCompactBits2(code >> 1) };
+}
+
+// Cell visited at step d of a Hilbert curve through a side x side grid (side a power of two). Unlike the Morton
+// order, consecutive cells always share an edge.
+DOOB_NODISCARD inline glm::uvec2 HilbertDecode2(uint32_t side, uint32_t d) {
+    uint32_t x = 0;
+    uint32_t y = 0;
+    for (uint32_t s = 1; s < side; s *= 2) {
+        const uint32_t rx = 1U & (d / 2);
+        const uint32_t ry = 1U & (d ^ rx);
+        // Rotates the sub curve so it connects to its neighbours
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+        x += s * rx;
+        y += s * ry;
+        d /= 4;
+    }
+    return { x, y };
+}
+
+// Morton code of a point inside bounds_min + [0, 1) / inv_extent, quantized to 2^bits cells per axis (bits <= 10)
+DOOB_NODISCARD DOOB_FORCEINLINE uint32_t MortonEncodePoint(
+    const glm::vec3& p, const glm::vec3& bounds_min, const glm::vec3& inv_extent, uint32_t bits) {
+    const float cells = static_cast<float>(1U << bits);
+    const glm::vec3 cell = glm::clamp((p - bounds_min) * inv_extent * cells, glm::vec3(0.0f), glm::vec3(cells - 1.0f));
+    return MortonEncode3(static_cast<uint32_t>(cell.x), static_cast<uint32_t>(cell.y), static_cast<uint32_t>(cell.z));
+}
+} // namespace devs_out_of_bounds
\ No newline at end of file
@@ -0,0 +1,52 @@
+#pragma once
+#include <src/Core.hpp>
+#include <vector>
+
+namespace devs_out_of_bounds {
+// Stable LSD radix sort of payloads by their keys, only the lowest key_bits bits of the keys are sorted on. Digits
+// that are the same for every key are skipped. The scratch vectors are resized to the key count and can be kept by
+// the caller to avoid heap allocations between calls.
+// Sorting the payloads as the low bits of packed 64 bit keys instead would also sort on every payload bit.
+inline void RadixSortByKey(std::vector<uint32_t>& keys, std::vector<uint32_t>& payloads, uint32_t key_bits,
+    std::vector<uint32_t>& scratch_keys, std::vector<uint32_t>& scratch_payloads) {
+    constexpr uint32_t DIGIT_BITS = 8;
+    constexpr uint32_t DIGIT_COUNT = 1U << DIGIT_BITS;
+    assert(keys.size() == payloads.size());
+    const size_t count = keys.size();
+    if (count < 2) {
+        return;
+    }
+    scratch_keys.resize(count);
+    scratch_payloads.resize(count);
+
+    for (uint32_t shift = 0; shift < key_bits; shift += DIGIT_BITS) {
+        uint32_t offsets[DIGIT_COUNT] = {};
+        for (uint32_t key : keys) {
+            ++offsets[(key >> shift) & (DIGIT_COUNT - 1)];
+        }
+        if (offsets[(keys[0] >> shift) & (DIGIT_COUNT - 1)] == count) {
+            continue;
+        }
+        uint32_t sum = 0;
+        for (uint32_t& offset : offsets) {
+            const uint32_t bucket_size = offset;
+            offset = sum;
+            sum += bucket_size;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            const uint32_t destination = offsets[(keys[i] >> shift) & (DIGIT_COUNT - 1)]++;
+            scratch_keys[destination] = keys[i];
+            scratch_payloads[destination] = payloads[i];
+        }
+        keys.swap(scratch_keys);
+        payloads.swap(scratch_payloads);
+    }
+}
+
+// Same as above with scratch vectors that only live for this call
+inline void RadixSortByKey(std::vector<uint32_t>& keys, std::vector<uint32_t>& payloads, uint32_t key_bits) {
+    std::vector<uint32_t> scratch_keys;
+    std::vector<uint32_t> scratch_payloads;
+    RadixSortByKey(keys, payloads, key_bits, scratch_keys, scratch_payloads);
+}
+} // namespace devs_out_of_bounds
@@ -16,4 +16,16 @@ struct Ray {
     glm::vec3 direction = {};
     float t_max = INFINITY;
 };
+// Per ray constants for slab tests, computed once and reused for every box the ray is tested against
+struct PrecomputedRay {
+    explicit PrecomputedRay(const Ray& ray)
+        : origin(ray.origin), inv_direction(1.0f / (ray.direction + glm::sign(ray.direction) * 1e-9f)) {
+        for (int i = 0; i < 3; ++i) {
+            sign[i] = inv_direction[i] < 0.0f ? 1 : 0;
+        }
+    }
+    glm::vec3 origin = {};
+    glm::vec3 inv_direction = {};
+    uint32_t sign[3] = {}; // 1 when the ray travels towards -axis, so the slab is entered through max
+};
 } // namespace devs_out_of_bounds
\ No newline at end of file
@@ -0,0 +1,205 @@
+#pragma once
+#include <bit>
+#include <src/Graphics/AABB.hpp>
+#include <src/Graphics/Ray.hpp>
+
+#if defined(DOOB_SIMD_SSE)
+#include <immintrin.h>
+#endif
+
+namespace devs_out_of_bounds {
+// Calls fn(i) for every set bit of mask, lowest first
+template <typename TCallable>
+DOOB_FORCEINLINE void ForEachRay(uint32_t mask, TCallable&& fn) {
+    while (mask != 0) {
+        fn(static_cast<uint32_t>(std::countr_zero(mask)));
+        mask &= mask - 1U;
+    }
+}
+
+// Coherent rays (e.g. the primary rays of a 4x4 pixel block) traced together, so every node a traversal visits is
+// fetched once for the whole packet. Slab data is stored SoA to test a box against all rays in SIMD.
+struct alignas(32) RayPacket {
+    static constexpr uint32_t SIZE = 16;
+    static constexpr uint32_t FULL_MASK = 0xFFFFU;
+    static_assert(SIZE <= 32, "Ray masks are stored in a uint32_t!");
+
+    DOOB_NODISCARD static constexpr uint32_t MaskOf(uint32_t count) {
+        return count >= SIZE ? FULL_MASK : (1U << count) - 1U;
+    }
+
+    // Only the rays in mask are traced, the other lanes get an empty [t_min, t_max] segment so they never hit
+    void Init(const Ray* in_rays, uint32_t mask) {
+        assert((mask & ~FULL_MASK) == 0);
+        active_mask = mask;
+        for (uint32_t i = 0; i < SIZE; ++i) {
+            const Ray ray = (mask >> i) & 1U ? in_rays[i]
+                                             : Ray{ .t_min = INFINITY, .direction = { 1, 1, 1 }, .t_max = -INFINITY };
+            const PrecomputedRay query(ray);
+            rays[i] = ray;
+            origin_x[i] = ray.origin.x;
+            origin_y[i] = ray.origin.y;
+            origin_z[i] = ray.origin.z;
+            inv_direction_x[i] = query.inv_direction.x;
+            inv_direction_y[i] = query.inv_direction.y;
+            inv_direction_z[i] = query.inv_direction.z;
+            t_min[i] = ray.t_min;
+            t_max[i] = ray.t_max;
+        }
+
+        origin_min = glm::vec3(INFINITY);
+        origin_max = glm::vec3(-INFINITY);
+        inv_direction_min = glm::vec3(INFINITY);
+        inv_direction_max = glm::vec3(-INFINITY);
+        packet_t_min = INFINITY;
+        ForEachRay(mask, [&](uint32_t i) {
+            const glm::vec3 inv_direction = { inv_direction_x[i], inv_direction_y[i], inv_direction_z[i] };
+            origin_min = glm::min(origin_min, rays[i].origin);
+            origin_max = glm::max(origin_max, rays[i].origin);
+            inv_direction_min = glm::min(inv_direction_min, inv_direction);
+            inv_direction_max = glm::max(inv_direction_max, inv_direction);
+            packet_t_min = glm::min(packet_t_min, rays[i].t_min);
+        });
+    }
+
+    void SetTMax(uint32_t i, float t) {
+        t_max[i] = t;
+        rays[i].t_max = t;
+    }
+
+    // Interval arithmetic over all rays of the packet, true when the box is guaranteed to be missed by every ray.
+    // Costs about as much as a single slab test, so coherent packets reject most boxes without the per ray test.
+    DOOB_NODISCARD bool MissesBox(const AABB& aabb) const {
+        float t_in = packet_t_min;
+        float t_out = INFINITY;
+        for (int axis = 0; axis < 3; ++axis) {
+            float near_plane, far_plane;
+            if (inv_direction_min[axis] > 0.0f) {
+                near_plane = aabb.min[axis];
+                far_plane = aabb.max[axis];
+            } else if (inv_direction_max[axis] < 0.0f) {
+                near_plane = aabb.max[axis];
+                far_plane = aabb.min[axis];
+            } else {
+                // Directions disagree in sign, the axis bounds nothing
+                continue;
+            }
+            const float near_lo = near_plane - origin_max[axis];
+            const float near_hi = near_plane - origin_min[axis];
+            const float far_lo = far_plane - origin_max[axis];
+            const float far_hi = far_plane - origin_min[axis];
+            const float inv_lo = inv_direction_min[axis];
+            const float inv_hi = inv_direction_max[axis];
+            t_in = glm::max(t_in,
+                glm::min(glm::min(near_lo * inv_lo, near_lo * inv_hi), glm::min(near_hi * inv_lo, near_hi * inv_hi)));
+            t_out = glm::min(t_out,
+                glm::max(glm::max(far_lo * inv_lo, far_lo * inv_hi), glm::max(far_hi * inv_lo, far_hi * inv_hi)));
+        }
+        return t_in > t_out;
+    }
+
+    // Slab test of every ray against the box, returns the mask of rays whose [t_min, t_max] segment overlaps it
+    DOOB_NODISCARD uint32_t IntersectBox(const AABB& aabb) const {
+        uint32_t mask = 0;
+#if defined(DOOB_SIMD_AVX2)
+        const __m256 min_x = _mm256_set1_ps(aabb.min.x);
+        const __m256 min_y = _mm256_set1_ps(aabb.min.y);
+        const __m256 min_z = _mm256_set1_ps(aabb.min.z);
+        const __m256 max_x = _mm256_set1_ps(aabb.max.x);
+        const __m256 max_y = _mm256_set1_ps(aabb.max.y);
+        const __m256 max_z = _mm256_set1_ps(aabb.max.z);
+        for (uint32_t i = 0; i < SIZE; i += 8) {
+            const __m256 ox = _mm256_load_ps(origin_x + i);
+            const __m256 oy = _mm256_load_ps(origin_y + i);
+            const __m256 oz = _mm256_load_ps(origin_z + i);
+            const __m256 ix = _mm256_load_ps(inv_direction_x + i);
+            const __m256 iy = _mm256_load_ps(inv_direction_y + i);
+            const __m256 iz = _mm256_load_ps(inv_direction_z + i);
+
+            const __m256 tx0 = _mm256_mul_ps(_mm256_sub_ps(min_x, ox), ix);
+            const __m256 ty0 = _mm256_mul_ps(_mm256_sub_ps(min_y, oy), iy);
+            const __m256 tz0 = _mm256_mul_ps(_mm256_sub_ps(min_z, oz), iz);
+            const __m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(max_x, ox), ix);
+            const __m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(max_y, oy), iy);
+            const __m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(max_z, oz), iz);
+
+            const __m256 t_in = _mm256_max_ps(
+                _mm256_max_ps(_mm256_min_ps(tx0, tx1), _mm256_min_ps(ty0, ty1)),
+                _mm256_max_ps(_mm256_min_ps(tz0, tz1), _mm256_load_ps(t_min + i)));
+            const __m256 t_out = _mm256_min_ps(
+                _mm256_min_ps(_mm256_max_ps(tx0, tx1), _mm256_max_ps(ty0, ty1)),
+                _mm256_min_ps(_mm256_max_ps(tz0, tz1), _mm256_load_ps(t_max + i)));
+            mask |= static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(t_in, t_out, _CMP_LE_OQ))) << i;
+        }
+#elif defined(DOOB_SIMD_SSE)
+        const __m128 min_x = _mm_set1_ps(aabb.min.x);
+        const __m128 min_y = _mm_set1_ps(aabb.min.y);
+        const __m128 min_z = _mm_set1_ps(aabb.min.z);
+        const __m128 max_x = _mm_set1_ps(aabb.max.x);
+        const __m128 max_y = _mm_set1_ps(aabb.max.y);
+        const __m128 max_z = _mm_set1_ps(aabb.max.z);
+        for (uint32_t i = 0; i < SIZE; i += 4) {
+            const __m128 ox = _mm_load_ps(origin_x + i);
+            const __m128 oy = _mm_load_ps(origin_y + i);
+            const __m128 oz = _mm_load_ps(origin_z + i);
+            const __m128 ix = _mm_load_ps(inv_direction_x + i);
+            const __m128 iy = _mm_load_ps(inv_direction_y + i);
+            const __m128 iz = _mm_load_ps(inv_direction_z + i);
+
+            const __m128 tx0 = _mm_mul_ps(_mm_sub_ps(min_x, ox), ix);
+            const __m128 ty0 = _mm_mul_ps(_mm_sub_ps(min_y, oy), iy);
+            const __m128 tz0 = _mm_mul_ps(_mm_sub_ps(min_z, oz), iz);
+            const __m128 tx1 = _mm_mul_ps(_mm_sub_ps(max_x, ox), ix);
+            const __m128 ty1 = _mm_mul_ps(_mm_sub_ps(max_y, oy), iy);
+            const __m128 tz1 = _mm_mul_ps(_mm_sub_ps(max_z, oz), iz);
+
+            const __m128 t_in = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)),
+                _mm_max_ps(_mm_min_ps(tz0, tz1), _mm_load_ps(t_min + i)));
+            const __m128 t_out = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)),
+                _mm_min_ps(_mm_max_ps(tz0, tz1), _mm_load_ps(t_max + i)));
+            mask |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(t_in, t_out))) << i;
+        }
+#else
+        for (uint32_t i = 0; i < SIZE; ++i) {
+            const float tx0 = (aabb.min.x - origin_x[i]) * inv_direction_x[i];
+            const float ty0 = (aabb.min.y - origin_y[i]) * inv_direction_y[i];
+            const float tz0 = (aabb.min.z - origin_z[i]) * inv_direction_z[i];
+            const float tx1 = (aabb.max.x - origin_x[i]) * inv_direction_x[i];
+            const float ty1 = (aabb.max.y - origin_y[i]) * inv_direction_y[i];
+            const float tz1 = (aabb.max.z - origin_z[i]) * inv_direction_z[i];
+            const float t_in = glm::max(glm::max(glm::min(tx0, tx1), glm::min(ty0, ty1)),
+                glm::max(glm::min(tz0, tz1), t_min[i]));
+            const float t_out = glm::min(glm::min(glm::max(tx0, tx1), glm::max(ty0, ty1)),
+                glm::min(glm::max(tz0, tz1), t_max[i]));
+            mask |= (t_in <= t_out ? 1U : 0U) << i;
+        }
+#endif
+        return mask & active_mask;
+    }
+
+    // Interval culling first, the per ray test only runs for boxes the packet as a whole may touch
+    DOOB_NODISCARD DOOB_FORCEINLINE uint32_t Cull(const AABB& aabb) const {
+        return MissesBox(aabb) ? 0 : IntersectBox(aabb);
+    }
+
+    alignas(32) float origin_x[SIZE];
+    alignas(32) float origin_y[SIZE];
+    alignas(32) float origin_z[SIZE];
+    alignas(32) float inv_direction_x[SIZE];
+    alignas(32) float inv_direction_y[SIZE];
+    alignas(32) float inv_direction_z[SIZE];
+    alignas(32) float t_min[SIZE];
+    alignas(32) float t_max[SIZE]; // shrinks as hits are found, kept in sync with rays[i].t_max
+    Ray rays[SIZE];
+
+    // Bounds of the packet for interval culling, t_max is left out as it only ever shrinks
+    glm::vec3 origin_min;
+    glm::vec3 origin_max;
+    glm::vec3 inv_direction_min;
+    glm::vec3 inv_direction_max;
+    float packet_t_min = 0.0f;
+
+    uint32_t active_mask = 0;
+};
+
+} // namespace devs_out_of_bounds
\ No newline at end of file
@@ -0,0 +1,611 @@
+#pragma once
+#include <bit>
+#include <src/Graphics/IShape.hpp>
+#include <src/Graphics/Shapes/BvhStatistics.hpp>
+#include <src/Graphics/Morton.hpp>
+#include <src/Graphics/RadixSort.hpp>
+#include <vector>
+
+#if defined(DOOB_SIMD_SSE)
+#include <immintrin.h>
+#endif
+
+// Primitives of one kind an analytic set tests in a single SIMD pass
+#if defined(DOOB_SIMD_AVX2)
+#define DOOB_ANALYTIC_GROUP_WIDTH 8
+#elif defined(DOOB_SIMD_SSE)
+#define DOOB_ANALYTIC_GROUP_WIDTH 4
+#else
+#define DOOB_ANALYTIC_GROUP_WIDTH 1
+#endif
+
+namespace devs_out_of_bounds {
+namespace shape {
+    // Minimal lane abstraction so every kernel of AnalyticSet is written once for all group widths
+    namespace analytic_lanes {
+#if DOOB_ANALYTIC_GROUP_WIDTH == 8
+        using Lanes = __m256;
+        using LaneMask = __m256;
+        DOOB_FORCEINLINE Lanes Set(float v) { return _mm256_set1_ps(v); }
+        DOOB_FORCEINLINE Lanes Load(const float* p) { return _mm256_load_ps(p); }
+        DOOB_FORCEINLINE void Store(float* p, Lanes a) { _mm256_store_ps(p, a); }
+        DOOB_FORCEINLINE Lanes Add(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+        DOOB_FORCEINLINE Lanes Sub(Lanes a, Lanes b) { return _mm256_sub_ps(a, b); }
+        DOOB_FORCEINLINE Lanes Mul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+        DOOB_FORCEINLINE Lanes Div(Lanes a, Lanes b) { return _mm256_div_ps(a, b); }
+        DOOB_FORCEINLINE Lanes Min(Lanes a, Lanes b) { return _mm256_min_ps(a, b); }
+        DOOB_FORCEINLINE Lanes Max(Lanes a, Lanes b) { return _mm256_max_ps(a, b); }
+        DOOB_FORCEINLINE Lanes Sqrt(Lanes a) { return _mm256_sqrt_ps(a); }
+        DOOB_FORCEINLINE LaneMask Lt(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+        DOOB_FORCEINLINE LaneMask Le(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+        DOOB_FORCEINLINE LaneMask Ge(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+        DOOB_FORCEINLINE LaneMask And(LaneMask a, LaneMask b) { return _mm256_and_ps(a, b); }
+        DOOB_FORCEINLINE Lanes Select(LaneMask mask, Lanes a, Lanes b) { return _mm256_blendv_ps(b, a, mask); }
+        DOOB_FORCEINLINE uint32_t Bits(LaneMask mask) { return static_cast<uint32_t>(_mm256_movemask_ps(mask)); }
+#elif DOOB_ANALYTIC_GROUP_WIDTH == 4
+        using Lanes = __m128;
+        using LaneMask = __m128;
+        DOOB_FORCEINLINE Lanes Set(float v) { return _mm_set1_ps(v); }
+        DOOB_FORCEINLINE Lanes Load(const float* p) { return _mm_load_ps(p); }
+        DOOB_FORCEINLINE void Store(float* p, Lanes a) { _mm_store_ps(p, a); }
+        DOOB_FORCEINLINE Lanes Add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+        DOOB_FORCEINLINE Lanes Sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+        DOOB_FORCEINLINE Lanes Mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+        DOOB_FORCEINLINE Lanes Div(Lanes a, Lanes b) { return _mm_div_ps(a, b); }
+        DOOB_FORCEINLINE Lanes Min(Lanes a, Lanes b) { return _mm_min_ps(a, b); }
+        DOOB_FORCEINLINE Lanes Max(Lanes a, Lanes b) { return _mm_max_ps(a, b); }
+        DOOB_FORCEINLINE Lanes Sqrt(Lanes a) { return _mm_sqrt_ps(a); }
+        DOOB_FORCEINLINE LaneMask Lt(Lanes a, Lanes b) { return _mm_cmplt_ps(a, b); }
+        DOOB_FORCEINLINE LaneMask Le(Lanes a, Lanes b) { return _mm_cmple_ps(a, b); }
+        DOOB_FORCEINLINE LaneMask Ge(Lanes a, Lanes b) { return _mm_cmpge_ps(a, b); }
+        DOOB_FORCEINLINE LaneMask And(LaneMask a, LaneMask b) { return _mm_and_ps(a, b); }
+        // SSE2 has no blend
+        DOOB_FORCEINLINE Lanes Select(LaneMask mask, Lanes a, Lanes b) {
+            return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+        }
+        DOOB_FORCEINLINE uint32_t Bits(LaneMask mask) { return static_cast<uint32_t>(_mm_movemask_ps(mask)); }
+#else
+        using Lanes = float;
+        using LaneMask = bool;
+        DOOB_FORCEINLINE Lanes Set(float v) { return v; }
+        DOOB_FORCEINLINE Lanes Load(const float* p) { return *p; }
+        DOOB_FORCEINLINE void Store(float* p, Lanes a) { *p = a; }
+        DOOB_FORCEINLINE Lanes Add(Lanes a, Lanes b) { return a + b; }
+        DOOB_FORCEINLINE Lanes Sub(Lanes a, Lanes b) { return a - b; }
+        DOOB_FORCEINLINE Lanes Mul(Lanes a, Lanes b) { return a * b; }
+        DOOB_FORCEINLINE Lanes Div(Lanes a, Lanes b) { return a / b; }
+        DOOB_FORCEINLINE Lanes Min(Lanes a, Lanes b) { return glm::min(a, b); }
+        DOOB_FORCEINLINE Lanes Max(Lanes a, Lanes b) { return glm::max(a, b); }
+        DOOB_FORCEINLINE Lanes Sqrt(Lanes a) { return glm::sqrt(a); }
+        DOOB_FORCEINLINE LaneMask Lt(Lanes a, Lanes b) { return a < b; }
+        DOOB_FORCEINLINE LaneMask Le(Lanes a, Lanes b) { return a <= b; }
+        DOOB_FORCEINLINE LaneMask Ge(Lanes a, Lanes b) { return a >= b; }
+        DOOB_FORCEINLINE LaneMask And(LaneMask a, LaneMask b) { return a && b; }
+        DOOB_FORCEINLINE Lanes Select(LaneMask mask, Lanes a, Lanes b) { return mask ? a : b; }
+        DOOB_FORCEINLINE uint32_t Bits(LaneMask mask) { return mask ? 1U : 0U; }
+#endif
+    } // namespace analytic_lanes
+
+    // Spheres, boxes and planes sharing a material, stored by kind in SoA groups so a ray is tested against a
+    // whole group at once. Bounded primitives are ordered along a Morton curve, every group becomes a cluster and
+    // a binary hierarchy over the cluster bounds culls them. Planes are unbounded and always tested.
+    // A hit is the nearest surface crossing within [t_min, t_max]. Rays starting inside a sphere or box hit its far
+    // side as a back face, planes are one sided and only hit from the side their normal faces.
+    class AnalyticSet : public IShape {
+    public:
+        static constexpr int WIDTH = DOOB_ANALYTIC_GROUP_WIDTH;
+        static constexpr size_t MAX_DEPTH = 64;
+        static constexpr uint32_t MORTON_BITS_PER_AXIS = 10;
+
+        enum class Kind : uint32_t {
+            Sphere,
+            Box,
+            Plane,
+        };
+
+        AnalyticSet() = default;
+
+        // Primitives are only visible to queries after the next Build()
+        void AddSphere(const glm::vec3& center, float radius) { m_spheres.push_back({ center, radius }); }
+        void AddBox(const glm::vec3& center, const glm::vec3& extent) {
+            m_boxes.push_back({ .min = center - extent / 2.0f, .max = center + extent / 2.0f });
+        }
+        void AddPlane(const glm::vec3& normal, const glm::vec3& position) {
+            m_planes.push_back({ normal, glm::dot(position, normal) });
+        }
+
+        void Build() {
+            m_bounds = AABB::Empty();
+            for (const SphereData& sphere : m_spheres) {
+                m_bounds.Grow(sphere.Bounds());
+            }
+            for (const AABB& box : m_boxes) {
+                m_bounds.Grow(box);
+            }
+
+            SortSpatially(m_spheres);
+            SortSpatially(m_boxes);
+
+            m_sphere_groups.assign(GroupCount(m_spheres.size()), {});
+            for (size_t i = 0; i < m_spheres.size(); ++i) {
+                SphereGroup& group = m_sphere_groups[i / WIDTH];
+                const size_t lane = i % WIDTH;
+                group.center_x[lane] = m_spheres[i].center.x;
+                group.center_y[lane] = m_spheres[i].center.y;
+                group.center_z[lane] = m_spheres[i].center.z;
+                group.radius2[lane] = m_spheres[i].radius * m_spheres[i].radius;
+            }
+            m_box_groups.assign(GroupCount(m_boxes.size()), {});
+            for (size_t i = 0; i < m_boxes.size(); ++i) {
+                BoxGroup& group = m_box_groups[i / WIDTH];
+                const size_t lane = i % WIDTH;
+                group.min_x[lane] = m_boxes[i].min.x;
+                group.min_y[lane] = m_boxes[i].min.y;
+                group.min_z[lane] = m_boxes[i].min.z;
+                group.max_x[lane] = m_boxes[i].max.x;
+                group.max_y[lane] = m_boxes[i].max.y;
+                group.max_z[lane] = m_boxes[i].max.z;
+            }
+            m_plane_groups.assign(GroupCount(m_planes.size()), {});
+            for (size_t i = 0; i < m_planes.size(); ++i) {
+                PlaneGroup& group = m_plane_groups[i / WIDTH];
+                const size_t lane = i % WIDTH;
+                group.normal_x[lane] = m_planes[i].normal.x;
+                group.normal_y[lane] = m_planes[i].normal.y;
+                group.normal_z[lane] = m_planes[i].normal.z;
+                group.d[lane] = m_planes[i].d;
+            }
+
+            // Clusters keep the Morton order of their primitives, so halving the cluster range is a spatial split
+            m_clusters.clear();
+            for (uint32_t g = 0; g < m_sphere_groups.size(); ++g) {
+                Cluster cluster = { .aabb = AABB::Empty(), .kind = Kind::Sphere, .group = g, .count = 0 };
+                for (size_t i = g * WIDTH; i < glm::min(m_spheres.size(), size_t(g + 1) * WIDTH); ++i) {
+                    cluster.aabb.Grow(m_spheres[i].Bounds());
+                    ++cluster.count;
+                }
+                m_clusters.push_back(cluster);
+            }
+            for (uint32_t g = 0; g < m_box_groups.size(); ++g) {
+                Cluster cluster = { .aabb = AABB::Empty(), .kind = Kind::Box, .group = g, .count = 0 };
+                for (size_t i = g * WIDTH; i < glm::min(m_boxes.size(), size_t(g + 1) * WIDTH); ++i) {
+                    cluster.aabb.Grow(m_boxes[i]);
+                    ++cluster.count;
+                }
+                m_clusters.push_back(cluster);
+            }
+
+            m_nodes.clear();
+            if (!m_clusters.empty()) {
+                m_nodes.reserve(m_clusters.size() * 2 - 1);
+                m_nodes.emplace_back(); // root
+                BuildRecursive(0, 0, static_cast<uint32_t>(m_clusters.size()));
+            }
+        }
+
+        DOOB_NODISCARD bool Intersect(const Ray& ray, Intersection* out_intersection) const override {
+            RayLanes lanes(ray);
+            LaneHit closest = { .t = ray.t_max };
+            bool b_hit = false;
+            uint32_t num_intersections = 0;
+
+            const auto visit = [&](Kind kind, uint32_t group, uint32_t count) {
+                alignas(32) float t_lanes[WIDTH];
+                uint32_t front_mask = 0;
+                DOOB_COUNT_PRIMITIVE_TESTS(count);
+                const uint32_t hit_mask = IntersectGroup(kind, group, lanes, t_lanes, &front_mask) & CountMask(count);
+                if (!hit_mask) {
+                    return;
+                }
+                num_intersections += static_cast<uint32_t>(std::popcount(hit_mask));
+                for (uint32_t mask = hit_mask; mask; mask &= mask - 1) {
+                    const int lane = std::countr_zero(mask);
+                    if (t_lanes[lane] <= closest.t) {
+                        closest = {
+                            .kind = kind,
+                            .index = group * WIDTH + static_cast<uint32_t>(lane),
+                            .t = t_lanes[lane],
+                            .b_front_facing = ((front_mask >> lane) & 1U) != 0,
+                        };
+                        b_hit = true;
+                    }
+                }
+                // Groups further away than this hit can be culled
+                lanes.t_max = analytic_lanes::Set(closest.t);
+            };
+
+            for (uint32_t g = 0; g < m_plane_groups.size(); ++g) {
+                visit(Kind::Plane, g, LaneCount(m_planes.size(), g));
+            }
+            if (!m_nodes.empty()) {
+                TraverseNearestFirst(ray, closest.t, visit);
+            }
+            if (!b_hit) {
+                return false;
+            }
+
+            if (out_intersection) {
+                FillIntersection(ray, closest, out_intersection);
+                out_intersection->num_intersections = num_intersections;
+            }
+            return true;
+        }
+
+        DOOB_NODISCARD bool Occluded(const Ray& ray) const override {
+            RayLanes lanes(ray);
+            alignas(32) float t_lanes[WIDTH];
+            uint32_t front_mask = 0;
+            for (uint32_t g = 0; g < m_plane_groups.size(); ++g) {
+                DOOB_COUNT_PRIMITIVE_TESTS(LaneCount(m_planes.size(), g));
+                if (IntersectGroup(Kind::Plane, g, lanes, t_lanes, &front_mask) &
+                    CountMask(LaneCount(m_planes.size(), g))) {
+                    return true;
+                }
+            }
+            if (m_nodes.empty()) {
+                return false;
+            }
+
+            const PrecomputedRay precomputed(ray);
+            int32_t stack[MAX_DEPTH + 1];
+            size_t stack_ptr = 0;
+            stack[stack_ptr++] = 0;
+            while (stack_ptr > 0) {
+                const Node& node = m_nodes[stack[--stack_ptr]];
+                DOOB_COUNT_NODE_VISIT();
+                float t_entry;
+                if (!node.aabb.RayIntersects(precomputed, ray.t_min, ray.t_max, &t_entry)) {
+                    continue;
+                }
+                if (node.cluster >= 0) {
+                    const Cluster& cluster = m_clusters[node.cluster];
+                    DOOB_COUNT_PRIMITIVE_TESTS(cluster.count);
+                    if (IntersectGroup(cluster.kind, cluster.group, lanes, t_lanes, &front_mask) &
+                        CountMask(cluster.count)) {
+                        return true;
+                    }
+                    continue;
+                }
+                assert(stack_ptr + 2 <= MAX_DEPTH + 1);
+                stack[stack_ptr++] = node.right_child;
+                stack[stack_ptr++] = node.left_child;
+            }
+            return false;
+        }
+
+        DOOB_NODISCARD Fragment SampleFragment(const Intersection& intersection) const override {
+            return {
+                .position = intersection.position,
+                .normal = intersection.flat_normal,
+                .flat_normal = intersection.flat_normal,
+                .tangent = {},
+                .uv = {},
+            };
+        }
+
+        // Planes are infinite, so the set is unbounded as soon as it holds one
+        DOOB_NODISCARD AABB GetAABB() const override {
+            if (!m_planes.empty()) {
+                return AABB{
+                    .min = { -INFINITY, -INFINITY, -INFINITY },
+                    .max = { INFINITY, INFINITY, INFINITY },
+                };
+            }
+            return m_bounds;
+        }
+
+        DOOB_NODISCARD size_t GetPrimitiveCount() const { return m_spheres.size() + m_boxes.size() + m_planes.size(); }
+        DOOB_NODISCARD size_t GetNodeCount() const { return m_nodes.size(); }
+
+    private:
+        struct SphereData {
+            glm::vec3 center;
+            float radius;
+
+            DOOB_NODISCARD AABB Bounds() const { return { .min = center - radius, .max = center + radius }; }
+            DOOB_NODISCARD glm::vec3 Centroid() const { return center; }
+        };
+        struct PlaneData {
+            glm::vec3 normal;
+            float d;
+        };
+
+        struct alignas(32) SphereGroup {
+            float center_x[WIDTH];
+            float center_y[WIDTH];
+            float center_z[WIDTH];
+            float radius2[WIDTH];
+        };
+        struct alignas(32) BoxGroup {
+            float min_x[WIDTH];
+            float min_y[WIDTH];
+            float min_z[WIDTH];
+            float max_x[WIDTH];
+            float max_y[WIDTH];
+            float max_z[WIDTH];
+        };
+        struct alignas(32) PlaneGroup {
+            float normal_x[WIDTH];
+            float normal_y[WIDTH];
+            float normal_z[WIDTH];
+            float d[WIDTH];
+        };
+
+        // One group of bounded primitives, the leaves of the hierarchy
+        struct Cluster {
+            AABB aabb;
+            Kind kind;
+            uint32_t group;
+            uint32_t count;
+        };
+        struct Node {
+            AABB aabb = {};
+            int32_t cluster = -1;
+            int32_t left_child = -1;
+            int32_t right_child = -1;
+        };
+
+        struct LaneHit {
+            Kind kind = Kind::Sphere;
+            uint32_t index = 0;
+            float t = INFINITY;
+            bool b_front_facing = true;
+        };
+
+        // Ray broadcast to all lanes once per query
+        struct RayLanes {
+            explicit RayLanes(const Ray& ray) {
+                using namespace analytic_lanes;
+                const glm::vec3 inv_dir = 1.0f / (ray.direction + glm::sign(ray.direction) * 1e-9f);
+                origin_x = Set(ray.origin.x);
+                origin_y = Set(ray.origin.y);
+                origin_z = Set(ray.origin.z);
+                dir_x = Set(ray.direction.x);
+                dir_y = Set(ray.direction.y);
+                dir_z = Set(ray.direction.z);
+                inv_dir_x = Set(inv_dir.x);
+                inv_dir_y = Set(inv_dir.y);
+                inv_dir_z = Set(inv_dir.z);
+                t_min = Set(ray.t_min);
+                t_max = Set(ray.t_max);
+            }
+            analytic_lanes::Lanes origin_x, origin_y, origin_z;
+            analytic_lanes::Lanes dir_x, dir_y, dir_z;
+            analytic_lanes::Lanes inv_dir_x, inv_dir_y, inv_dir_z;
+            analytic_lanes::Lanes t_min, t_max;
+        };
+
+        DOOB_NODISCARD static size_t GroupCount(size_t count) { return (count + WIDTH - 1) / WIDTH; }
+        DOOB_NODISCARD static uint32_t LaneCount(size_t count, uint32_t group) {
+            return static_cast<uint32_t>(glm::min(count - size_t(group) * WIDTH, size_t(WIDTH)));
+        }
+        // Lanes past count are padding and never report a hit
+        DOOB_NODISCARD static DOOB_FORCEINLINE uint32_t CountMask(uint32_t count) {
+            return count >= 32 ? ~0U : (1U << count) - 1U;
+        }
+
+        template <typename T>
+        void SortSpatially(std::vector<T>& items) const {
+            if (items.size() < 2) {
+                return;
+            }
+            const glm::vec3 inv_extent = 1.0f / glm::max(m_bounds.Extent(), glm::vec3(1e-6f));
+            std::vector<uint32_t> codes(items.size());
+            std::vector<uint32_t> order(items.size());
+            for (size_t i = 0; i < items.size(); ++i) {
+                codes[i] = MortonEncodePoint(items[i].Centroid(), m_bounds.min, inv_extent, MORTON_BITS_PER_AXIS);
+                order[i] = static_cast<uint32_t>(i);
+            }
+            RadixSortByKey(codes, order, 3 * MORTON_BITS_PER_AXIS);
+
+            std::vector<T> sorted;
+            sorted.reserve(items.size());
+            for (uint32_t index : order) {
+                sorted.push_back(items[index]);
+            }
+            items = std::move(sorted);
+        }
+
+        void BuildRecursive(int32_t node_index, uint32_t begin, uint32_t end) {
+            if (end - begin == 1) {
+                m_nodes[node_index].aabb = m_clusters[begin].aabb;
+                m_nodes[node_index].cluster = static_cast<int32_t>(begin);
+                return;
+            }
+            // Halving keeps the tree balanced, so its depth stays at log2(cluster count)
+            const uint32_t mid = begin + (end - begin) / 2;
+            const int32_t left = static_cast<int32_t>(m_nodes.size());
+            m_nodes.emplace_back();
+            const int32_t right = static_cast<int32_t>(m_nodes.size());
+            m_nodes.emplace_back();
+            m_nodes[node_index].left_child = left;
+            m_nodes[node_index].right_child = right;
+
+            BuildRecursive(left, begin, mid);
+            BuildRecursive(right, mid, end);
+            m_nodes[node_index].aabb = m_nodes[left].aabb.Union(m_nodes[right].aabb);
+        }
+
+        // Visits the clusters overlapped by the ray, nearer children first. visit may shorten t_max.
+        template <typename TCallable>
+        void TraverseNearestFirst(const Ray& ray, const float& t_max, TCallable& visit) const {
+            struct StackEntry {
+                int32_t node;
+                float t_entry;
+            };
+            const PrecomputedRay precomputed(ray);
+            StackEntry stack[MAX_DEPTH + 1];
+            size_t stack_ptr = 0;
+
+            float t_entry;
+            if (!m_nodes[0].aabb.RayIntersects(precomputed, ray.t_min, t_max, &t_entry)) {
+                return;
+            }
+            stack[stack_ptr++] = { 0, t_entry };
+            while (stack_ptr > 0) {
+                const StackEntry entry = stack[--stack_ptr];
+                // t_max may have shrunk since this node was pushed
+                if (entry.t_entry > t_max) {
+                    continue;
+                }
+                const Node& node = m_nodes[entry.node];
+                DOOB_COUNT_NODE_VISIT();
+                if (node.cluster >= 0) {
+                    const Cluster& cluster = m_clusters[node.cluster];
+                    visit(cluster.kind, cluster.group, cluster.count);
+                    continue;
+                }
+                float t_left, t_right;
+                const bool b_left = m_nodes[node.left_child].aabb.RayIntersects(precomputed, ray.t_min, t_max, &t_left);
+                const bool b_right =
+                    m_nodes[node.right_child].aabb.RayIntersects(precomputed, ray.t_min, t_max, &t_right);
+                assert(stack_ptr + 2 <= MAX_DEPTH + 1);
+                if (b_left && b_right) {
+                    // The far child goes below the near one
+                    if (t_left <= t_right) {
+                        stack[stack_ptr++] = { node.right_child, t_right };
+                        stack[stack_ptr++] = { node.left_child, t_left };
+                    } else {
+                        stack[stack_ptr++] = { node.left_child, t_left };
+                        stack[stack_ptr++] = { node.right_child, t_right };
+                    }
+                } else if (b_left) {
+                    stack[stack_ptr++] = { node.left_child, t_left };
+                } else if (b_right) {
+                    stack[stack_ptr++] = { node.right_child, t_right };
+                }
+            }
+        }
+
+        // Returns the mask of lanes hit within [t_min, t_max], padding lanes are not masked out here
+        DOOB_NODISCARD DOOB_FORCEINLINE uint32_t IntersectGroup(
+            Kind kind, uint32_t group, const RayLanes& ray, float* out_t, uint32_t* out_front_mask) const {
+            switch (kind) {
+            case Kind::Sphere:
+                return IntersectSpheres(m_sphere_groups[group], ray, out_t, out_front_mask);
+            case Kind::Box:
+                return IntersectBoxes(m_box_groups[group], ray, out_t, out_front_mask);
+            case Kind::Plane:
+                return IntersectPlanes(m_plane_groups[group], ray, out_t, out_front_mask);
+            }
+            return 0;
+        }
+
+        // Nearest root in front of t_min, the exit point when the ray starts inside the sphere
+        DOOB_NODISCARD static DOOB_FORCEINLINE uint32_t IntersectSpheres(
+            const SphereGroup& group, const RayLanes& ray, float* out_t, uint32_t* out_front_mask) {
+            using namespace analytic_lanes;
+            const Lanes ocx = Sub(ray.origin_x, Load(group.center_x));
+            const Lanes ocy = Sub(ray.origin_y, Load(group.center_y));
+            const Lanes ocz = Sub(ray.origin_z, Load(group.center_z));
+
+            const Lanes b = Mul(Set(2.0f), Add(Add(Mul(ray.dir_x, ocx), Mul(ray.dir_y, ocy)), Mul(ray.dir_z, ocz)));
+            const Lanes c = Sub(Add(Add(Mul(ocx, ocx), Mul(ocy, ocy)), Mul(ocz, ocz)), Load(group.radius2));
+            const Lanes discriminant = Sub(Mul(b, b), Mul(Set(4.0f), c));
+            LaneMask valid = Ge(discriminant, Set(0.0f));
+
+            const Lanes sqrt_disc = Sqrt(Max(discriminant, Set(0.0f)));
+            const Lanes neg_b = Sub(Set(0.0f), b);
+            const Lanes t_near = Mul(Sub(neg_b, sqrt_disc), Set(0.5f));
+            const Lanes t_far = Mul(Add(neg_b, sqrt_disc), Set(0.5f));
+            const LaneMask front = Ge(t_near, ray.t_min);
+            const Lanes t = Select(front, t_near, t_far);
+            valid = And(valid, And(Ge(t, ray.t_min), Le(t, ray.t_max)));
+
+            Store(out_t, t);
+            *out_front_mask = Bits(front);
+            return Bits(valid);
+        }
+
+        // Slab test, the exit point counts as a back facing hit when the ray starts inside the box
+        DOOB_NODISCARD static DOOB_FORCEINLINE uint32_t IntersectBoxes(
+            const BoxGroup& group, const RayLanes& ray, float* out_t, uint32_t* out_front_mask) {
+            using namespace analytic_lanes;
+            const Lanes tx0 = Mul(Sub(Load(group.min_x), ray.origin_x), ray.inv_dir_x);
+            const Lanes tx1 = Mul(Sub(Load(group.max_x), ray.origin_x), ray.inv_dir_x);
+            const Lanes ty0 = Mul(Sub(Load(group.min_y), ray.origin_y), ray.inv_dir_y);
+            const Lanes ty1 = Mul(Sub(Load(group.max_y), ray.origin_y), ray.inv_dir_y);
+            const Lanes tz0 = Mul(Sub(Load(group.min_z), ray.origin_z), ray.inv_dir_z);
+            const Lanes tz1 = Mul(Sub(Load(group.max_z), ray.origin_z), ray.inv_dir_z);
+
+            const Lanes t_in = Max(Max(Min(tx0, tx1), Min(ty0, ty1)), Min(tz0, tz1));
+            const Lanes t_out = Min(Min(Max(tx0, tx1), Max(ty0, ty1)), Max(tz0, tz1));
+            LaneMask valid = Le(t_in, t_out);
+
+            const LaneMask front = Ge(t_in, ray.t_min);
+            const Lanes t = Select(front, t_in, t_out);
+            valid = And(valid, And(Ge(t, ray.t_min), Le(t, ray.t_max)));
+
+            Store(out_t, t);
+            *out_front_mask = Bits(front);
+            return Bits(valid);
+        }
+
+        // Planes are one sided, rays from behind pass through
+        DOOB_NODISCARD static DOOB_FORCEINLINE uint32_t IntersectPlanes(
+            const PlaneGroup& group, const RayLanes& ray, float* out_t, uint32_t* out_front_mask) {
+            using namespace analytic_lanes;
+            const Lanes nx = Load(group.normal_x);
+            const Lanes ny = Load(group.normal_y);
+            const Lanes nz = Load(group.normal_z);
+            const Lanes cos_angle = Add(Add(Mul(ray.dir_x, nx), Mul(ray.dir_y, ny)), Mul(ray.dir_z, nz));
+            LaneMask valid = Lt(cos_angle, Set(-std::numeric_limits<float>::epsilon()));
+
+            const Lanes origin_d = Add(Add(Mul(ray.origin_x, nx), Mul(ray.origin_y, ny)), Mul(ray.origin_z, nz));
+            const Lanes t = Div(Sub(Load(group.d), origin_d), cos_angle);
+            valid = And(valid, And(Ge(t, ray.t_min), Le(t, ray.t_max)));
+
+            Store(out_t, t);
+            *out_front_mask = ~0U;
+            return Bits(valid);
+        }
+
+        void FillIntersection(const Ray& ray, const LaneHit& hit, Intersection* out_intersection) const {
+            const glm::vec3 position = ray.origin + ray.direction * hit.t;
+            out_intersection->t = hit.t;
+            out_intersection->position = position;
+            out_intersection->barycentric = { 0.0f, 0.0f };
+            out_intersection->primitive = hit.index; // index within the primitives of its kind
+            out_intersection->b_front_facing = hit.b_front_facing ? 1 : 0;
+
+            switch (hit.kind) {
+            case Kind::Sphere:
+                out_intersection->flat_normal =
+                    glm::normalize(position - m_spheres[hit.index].center) * (hit.b_front_facing ? 1.0f : -1.0f);
+                break;
+            case Kind::Box: {
+                const AABB& box = m_boxes[hit.index];
+                const glm::vec3 p = position - box.Centroid();
+                const glm::vec3 bias = glm::abs(p / (box.Extent() * 0.5f + 1e-6f));
+
+                out_intersection->flat_normal = glm::vec3(0.0f);
+                if (bias.x > bias.y && bias.x > bias.z) {
+                    out_intersection->flat_normal.x = glm::sign(p.x);
+                } else if (bias.y > bias.z) {
+                    out_intersection->flat_normal.y = glm::sign(p.y);
+                } else {
+                    out_intersection->flat_normal.z = glm::sign(p.z);
+                }
+                break;
+            }
+            case Kind::Plane:
+                out_intersection->flat_normal = m_planes[hit.index].normal;
+                break;
+            }
+        }
+
+    private:
+        std::vector<SphereData> m_spheres;
+        std::vector<AABB> m_boxes;
+        std::vector<PlaneData> m_planes;
+
+        std::vector<SphereGroup> m_sphere_groups;
+        std::vector<BoxGroup> m_box_groups;
+        std::vector<PlaneGroup> m_plane_groups;
+
+        std::vector<Cluster> m_clusters;
+        std::vector<Node> m_nodes;
+        AABB m_bounds = AABB::Empty();
+    };
+} // namespace shape
+} // namespace devs_out_of_bounds
@@ -1,143 +1,493 @@
 #pragma once
 
 #include <algorithm>
+#include <bit>
+#include <memory>
+#include <mutex>
+#include <numeric>
 #include <src/Core.hpp>
 #include <src/Graphics/AABB.hpp>
+#include <src/Graphics/Shapes/BvhStatistics.hpp>
+#include <src/Graphics/Morton.hpp>
+#include <src/Graphics/RadixSort.hpp>
+#include <src/Graphics/Shapes/QuantizedBVH.hpp>
+#include <src/Graphics/Shapes/WideBVH.hpp>
 #include <src/Graphics/Trimesh.hpp>
-#include <stack>
+#include <src/Threading/TaskPool.hpp>
 #include <vector>
 
 
 namespace devs_out_of_bounds {
 namespace shape {
 
+    // Siblings are stored next to each other, so both children of a node share one cache line. Children are always
+    // stored after their parent.
     struct BvhNode {
         AABB aabb = {};
-        uint32_t left = 0; // nodes can never point to the root so 0 is assumed to be NULL
-        uint32_t right = 0;
-        int32_t leaf = -1;
+        uint32_t offset = 0;          // interior: index of the left child, the right one follows it, leaf: index
+                                      // of the first triangle
+        uint32_t primitive_count = 0; // 0 for interior nodes
+
+        DOOB_NODISCARD DOOB_FORCEINLINE bool IsLeaf() const { return primitive_count > 0; }
+        DOOB_NODISCARD DOOB_FORCEINLINE uint32_t Left() const { return offset; }
+        DOOB_NODISCARD DOOB_FORCEINLINE uint32_t Right() const { return offset + 1; }
+    };
+    static_assert(sizeof(BvhNode) == 32, "BvhNode should stay half a cache line!");
+
+    // Cache line aligned, so the sibling pairs starting at even indices never straddle two lines
+    using BvhNodeArray = std::vector<BvhNode, AlignedAllocator<BvhNode, 64>>;
+
+    enum class BvhSplitMode : uint8_t {
+        Object,  // primitives are partitioned by centroid, children may overlap
+        Spatial, // SBVH, primitives may also be clipped at the split plane and referenced by both children
+        Linear,  // LBVH, primitives are sorted along a Morton curve and split where the codes differ, the fastest
+                 // build but the loosest tree
+    };
+
+    enum class BvhNodeFormat : uint8_t {
+        Full,        // float bounds, supports cheap refits
+        Quantized16, // child bounds stored as 16 bit offsets into the parent box
+        Quantized8,  // 8 bit offsets, the smallest nodes but the loosest bounds
+    };
+
+    struct BvhBuildOptions {
+        BvhSplitMode split_mode = BvhSplitMode::Object;
+        // Quantized nodes replace the full precision ones after the build, refitting them rebuilds the tree
+        BvhNodeFormat node_format = BvhNodeFormat::Full;
+        // Extra primitive references spatial splits are allowed to create, relative to the primitive count
+        float duplication_budget = 0.3f;
+        // Spatial splits are only evaluated for nodes whose best object split has children overlapping by more
+        // than this fraction of the root surface area
+        float spatial_split_alpha = 1e-5f;
+        // Subtrees with at most this many primitives are only built once the first ray reaches them, 0 builds the
+        // whole tree up front. The levels above them always use binned SAH object splits.
+        uint32_t lazy_subtree_size = 0;
+        // Scene loading only: meshes start out with a Linear build and are rebuilt with these options in the
+        // background, see BvhRefiner
+        bool b_progressive = false;
     };
+
     class BVH : public IShape {
     public:
         static constexpr size_t MAX_PRIMITIVES_PER_LEAF = 8;
 
-        static constexpr size_t MAX_DEPTH = 32;
+        static constexpr size_t MAX_DEPTH = BVH_MAX_DEPTH;
 
-        static constexpr int AXIS_X = 0;
-        static constexpr int AXIS_Y = 1;
-        static constexpr int AXIS_Z = 2;
         static constexpr int MAX_AXIS = 3;
 
-        void BuildBvhRecursive(uint32_t node_index, const std::vector<uint32_t>& primitives, int depth, int axis) {
-            assert(!primitives.empty());
+        // Binned surface area heuristic, costs are relative to a single triangle test
+        static constexpr int NUM_SAH_BINS = 16;
+        static constexpr float SAH_TRAVERSAL_COST = 1.0f;
+        static constexpr float SAH_INTERSECTION_COST = 1.0f;
 
-            AABB aabb = {};
-            aabb.min = { INFINITY, INFINITY, INFINITY };
-            aabb.max = { -INFINITY, -INFINITY, -INFINITY };
-            std::vector<float> centers;
-            for (uint32_t prim_index : primitives) {
-                AABB prim_aabb = m_instance->GetPrimitiveAabb(prim_index);
-                aabb = aabb.Union(m_instance->GetPrimitiveAabb(prim_index));
-                centers.push_back((prim_aabb.min[axis] + prim_aabb.max[axis]) * 0.5f);
-            }
-            m_nodes[node_index].aabb = aabb;
-
-            if (primitives.size() < MAX_PRIMITIVES_PER_LEAF || depth >= MAX_DEPTH) {
-                BuildBvhLeaf(node_index, primitives);
-                return;
+        // Leaves are tested a whole triangle group at a time, so a partially filled group costs as much as a full one
+        DOOB_NODISCARD static float LeafCost(uint32_t count) {
+#if DOOB_TRIANGLE_GROUP_WIDTH > 0
+            count = (count + TriangleGroup::WIDTH - 1) / TriangleGroup::WIDTH;
+#endif
+            return SAH_INTERSECTION_COST * static_cast<float>(count);
+        }
+
+        // Spatial splits are binned over the node bounds instead of the centroid bounds
+        static constexpr int NUM_SPATIAL_BINS = 32;
+
+        // Linear builds quantize centroids to this many bits per axis, which gives 30 bit Morton codes
+        static constexpr uint32_t MORTON_BITS_PER_AXIS = 10;
+        // Linear builds do not evaluate the SAH, ranges this small always become a leaf
+        static constexpr uint32_t LINEAR_LEAF_SIZE = 4;
+
+        // Subtrees with at least this many primitives are built as separate tasks when a pool is given
+        static constexpr uint32_t PARALLEL_BUILD_THRESHOLD = 4096;
+
+        // Update rebuilds the tree once refitting made its SAH cost this much worse than right after the build
+        static constexpr float REFIT_MAX_COST_RATIO = 1.5f;
+
+        // The root has no sibling, an unused node after it keeps every sibling pair on its own cache line
+        static constexpr uint32_t PADDING_NODE_INDEX = 1;
+
+        BVH(const MeshInstance* instance, TaskPool* pool = nullptr, const BvhBuildOptions& options = {})
+            : m_instance(instance), m_options(options) {
+            Build(pool);
+        }
+        // Builds over a subset of the primitives of the instance, e.g. a deferred subtree of a lazy BVH
+        BVH(const MeshInstance* instance, std::vector<uint32_t> primitives, const BvhBuildOptions& options)
+            : m_instance(instance), m_primitives(std::move(primitives)), m_options(options) {
+            Build(nullptr);
+        }
+
+        // Recomputes all node bounds bottom up from the current vertices of the instance, keeping the topology.
+        // Quantized and lazy trees cannot be refit and are rebuilt on the pool instead, returns true when that
+        // happened. Must not run while the BVH is being traversed.
+        bool Refit(TaskPool* pool = nullptr) {
+            // Quantized children are encoded relative to their parent, so every bound changes anyway. Deferred
+            // subtrees may not have been built yet, lazy trees are rebuilt as well.
+            if (m_options.node_format != BvhNodeFormat::Full || m_options.lazy_subtree_size > 0) {
+                Build(pool);
+                return true;
+            }
+            if (m_nodes.empty()) {
+                return false;
+            }
+            // Children are always stored after their parent, so a reverse sweep visits them first
+            for (size_t i = m_nodes.size(); i-- > 0;) {
+                if (i == PADDING_NODE_INDEX) {
+                    continue;
+                }
+                BvhNode& node = m_nodes[i];
+                if (node.IsLeaf()) {
+                    node.aabb = AABB::Empty();
+                    for (uint32_t t = node.offset; t < node.offset + node.primitive_count; ++t) {
+                        PrecomputedTriangle& triangle = m_triangles[t];
+                        triangle = PrecomputedTriangle::FromMesh(m_instance, triangle.primitive);
+                        // Same bounds the build starts from, v0 + edge does not always round back to the vertex
+                        node.aabb.Grow(m_instance->GetPrimitiveAabb(triangle.primitive));
+                    }
+                } else {
+                    node.aabb = m_nodes[node.Left()].aabb.Union(m_nodes[node.Right()].aabb);
+                }
             }
+            // A fresh build over the moved vertices would end up with exactly these root bounds
+            assert(m_nodes[0].aabb.min == ComputePrimitiveBounds().min &&
+                   m_nodes[0].aabb.max == ComputePrimitiveBounds().max && "Refit bounds differ from a fresh build!");
+#if DOOB_TRIANGLE_GROUP_WIDTH > 0
+            BuildTriangleGroups();
+#endif
+#if DOOB_BVH_WIDTH > 0
+            m_wide.Build(m_nodes);
+#endif
+            ComputeStatistics();
+            return false;
+        }
 
-            float median_along_axis = 0.0f;
+        // Refits the tree, and rebuilds it from scratch when the refit tree has degraded too far.
+        // Returns true when the tree was rebuilt, either here or by Refit.
+        bool Update(TaskPool* pool = nullptr) {
+            if (Refit(pool)) {
+                return true;
+            }
+            if (!NeedsRebuild()) {
+                return false;
+            }
+            Build(pool);
+            return true;
+        }
 
-            std::sort(centers.begin(), centers.end());
-            if ((centers.size() % 2) == 0) {
-                median_along_axis = (centers[centers.size() / 2 - 1] + centers[centers.size() / 2]) * 0.5f;
-            } else {
-                median_along_axis = centers[centers.size() / 2];
+        // Takes over the tree of other, which has to be built over the same instance. Must not run while either BVH
+        // is being traversed.
+        void Swap(BVH& other) {
+            assert(m_instance == other.m_instance);
+            std::swap(m_triangles, other.m_triangles);
+#if DOOB_TRIANGLE_GROUP_WIDTH > 0
+            std::swap(m_triangle_groups, other.m_triangle_groups);
+#endif
+            std::swap(m_nodes, other.m_nodes);
+#if DOOB_BVH_WIDTH > 0
+            std::swap(m_wide, other.m_wide);
+#endif
+            std::swap(m_quantized16, other.m_quantized16);
+            std::swap(m_quantized8, other.m_quantized8);
+            std::swap(m_lazy_subtrees, other.m_lazy_subtrees);
+            std::swap(m_primitives, other.m_primitives);
+            std::swap(m_options, other.m_options);
+            std::swap(m_build_sah_cost, other.m_build_sah_cost);
+            std::swap(m_statistics, other.m_statistics);
+        }
+
+        DOOB_NODISCARD const MeshInstance* GetMeshInstance() const { return m_instance; }
+        // Full precision binary nodes in sibling pair order, empty for quantized trees
+        DOOB_NODISCARD const BvhNodeArray& GetNodes() const { return m_nodes; }
+        DOOB_NODISCARD const BvhBuildOptions& GetBuildOptions() const { return m_options; }
+        // Measured after every build and refit
+        DOOB_NODISCARD const BvhStatistics& GetStatistics() const { return m_statistics; }
+
+        // Expected cost of a random ray that hits the root, relative to a single triangle test
+        DOOB_NODISCARD float ComputeSahCost() const {
+            if (m_nodes.empty()) {
+                return 0.0f;
+            }
+            float cost = 0.0f;
+            for (const BvhNode& node : m_nodes) {
+                const float area = node.aabb.SurfaceArea();
+                cost += node.IsLeaf() ? area * LeafCost(node.primitive_count)
+                                      : area * SAH_TRAVERSAL_COST;
+            }
+            return cost / glm::max(m_nodes[0].aabb.SurfaceArea(), std::numeric_limits<float>::min());
+        }
+        // Union of the current bounds of all primitives of the tree, which the root of a fresh build covers
+        DOOB_NODISCARD AABB ComputePrimitiveBounds() const {
+            const uint32_t num_primitives =
+                m_primitives.empty() ? m_instance->m_num_indices / 3 : static_cast<uint32_t>(m_primitives.size());
+            AABB bounds = AABB::Empty();
+            for (uint32_t i = 0; i < num_primitives; ++i) {
+                bounds.Grow(m_instance->GetPrimitiveAabb(MeshPrimitive(i)));
             }
+            return bounds;
+        }
+        DOOB_NODISCARD bool NeedsRebuild() const {
+            return ComputeSahCost() > m_build_sah_cost * REFIT_MAX_COST_RATIO;
+        }
 
-            std::vector<uint32_t> left_primitives;
-            std::vector<uint32_t> right_primitives;
-            for (uint32_t prim_index : primitives) {
-                AABB prim_aabb = m_instance->GetPrimitiveAabb(prim_index);
-                float prim_center = (prim_aabb.min[axis] + prim_aabb.max[axis]) * 0.5f;
-                if (prim_center < median_along_axis) {
-                    left_primitives.push_back(prim_index);
-                } else {
-                    right_primitives.push_back(prim_index);
+        DOOB_NODISCARD bool Intersect(const Ray& ray, Intersection* out_intersection) const override {
+            switch (m_options.node_format) {
+            case BvhNodeFormat::Quantized16:
+                return IntersectQuantized(m_quantized16, ray, out_intersection);
+            case BvhNodeFormat::Quantized8:
+                return IntersectQuantized(m_quantized8, ray, out_intersection);
+            default:
+                break;
+            }
+#if DOOB_BVH_WIDTH > 0
+            return IntersectWide(ray, out_intersection);
+#else
+            return IntersectBinary(ray, out_intersection);
+#endif
+        }
+
+        DOOB_NODISCARD bool IntersectWide(const Ray& ray, Intersection* out_intersection) const {
+#if DOOB_BVH_WIDTH > 0
+            Ray local_ray = ray;
+            uint32_t num_intersections = 0;
+            Intersection best_intersection;
+
+            const bool b_hit = m_wide.Traverse(local_ray, num_intersections, [&](uint32_t node_index, Ray& leaf_ray) {
+                if (!IntersectLeaf(m_nodes[node_index], leaf_ray, &best_intersection)) {
+                    return false;
+                }
+                num_intersections += best_intersection.num_intersections;
+                leaf_ray.t_max = best_intersection.t;
+                if (out_intersection) {
+                    *out_intersection = best_intersection;
                 }
+                return true;
+            });
+            if (out_intersection) {
+                out_intersection->num_intersections = num_intersections;
             }
+            return b_hit;
+#else
+            return IntersectBinary(ray, out_intersection);
+#endif
+        }
 
+        DOOB_NODISCARD bool Occluded(const Ray& ray) const override {
+            switch (m_options.node_format) {
+            case BvhNodeFormat::Quantized16:
+                return OccludedQuantized(m_quantized16, ray);
+            case BvhNodeFormat::Quantized8:
+                return OccludedQuantized(m_quantized8, ray);
+            default:
+                break;
+            }
+#if DOOB_BVH_WIDTH > 0
+            return m_wide.TraverseAny(
+                ray, [&](uint32_t node_index) { return OccludedLeaf(m_nodes[node_index], ray); });
+#else
+            return OccludedBinary(ray);
+#endif
+        }
 
-            if (left_primitives.empty() || right_primitives.empty()) {
-                BuildBvhLeaf(node_index, primitives);
-            } else {
-                uint32_t left_idx = static_cast<uint32_t>(m_nodes.size());
-                m_nodes.emplace_back();
-                m_nodes[node_index].left = left_idx;
-                BuildBvhRecursive(m_nodes[node_index].left, left_primitives, depth + 1, (axis + 1) % MAX_AXIS);
+        DOOB_NODISCARD bool OccludedBinary(const Ray& ray) const {
+            if (m_nodes.empty()) {
+                return false;
+            }
+            const PrecomputedRay query(ray);
+
+            float t_entry;
+            if (!m_nodes[0].aabb.RayIntersects(query, ray.t_min, ray.t_max, &t_entry)) {
+                return false;
+            }
+
+            // Any hit ends the query, so children are neither sorted nor culled by distance
+            uint32_t stack[MAX_DEPTH + 1];
+            size_t stack_ptr = 0;
+            stack[stack_ptr++] = 0;
+            while (stack_ptr > 0) {
+                const BvhNode& node = m_nodes[stack[--stack_ptr]];
+                DOOB_COUNT_NODE_VISIT();
+                if (node.IsLeaf()) {
+                    if (OccludedLeaf(node, ray)) {
+                        return true;
+                    }
+                    continue;
+                }
+                const uint32_t left = node.Left();
+                const uint32_t right = node.Right();
+                if (m_nodes[right].aabb.RayIntersects(query, ray.t_min, ray.t_max, &t_entry)) {
+                    assert(stack_ptr <= MAX_DEPTH);
+                    stack[stack_ptr++] = right;
+                }
+                if (m_nodes[left].aabb.RayIntersects(query, ray.t_min, ray.t_max, &t_entry)) {
+                    assert(stack_ptr <= MAX_DEPTH);
+                    stack[stack_ptr++] = left;
+                }
+            }
+            return false;
+        }
+
+        // Packet traversal over the binary nodes, every node is fetched once for all rays that may still hit it.
+        // Children are visited front to back along the first active ray, which coherent packets share. Quantized
+        // trees traverse their own nodes the same way, see QuantizedBvh::TraversePacket.
+        DOOB_NODISCARD uint32_t IntersectPacket(RayPacket& packet, Intersection* out_intersections) const override {
+            switch (m_options.node_format) {
+            case BvhNodeFormat::Quantized16:
+                return IntersectPacketQuantized(m_quantized16, packet, out_intersections);
+            case BvhNodeFormat::Quantized8:
+                return IntersectPacketQuantized(m_quantized8, packet, out_intersections);
+            default:
+                break;
+            }
+            if (m_nodes.empty() || packet.active_mask == 0) {
+                return 0;
+            }
+            const glm::vec3 direction = packet.rays[std::countr_zero(packet.active_mask)].direction;
+
+            // Both children are pushed, the stack only holds one deferred sibling per level
+            uint32_t stack[MAX_DEPTH + 1];
+            size_t stack_ptr = 0;
+            stack[stack_ptr++] = 0;
+
+            uint32_t hit_mask = 0;
+            while (stack_ptr > 0) {
+                const uint32_t node_index = stack[--stack_ptr];
+                const BvhNode& node = m_nodes[node_index];
+                // Rays may have found closer hits since this node was pushed
+                const uint32_t ray_mask = packet.Cull(node.aabb);
+                if (ray_mask == 0) {
+                    continue;
+                }
+                DOOB_COUNT_NODE_VISIT();
 
-                uint32_t right_idx = static_cast<uint32_t>(m_nodes.size());
-                m_nodes.emplace_back();
-                m_nodes[node_index].right = right_idx;
-                BuildBvhRecursive(m_nodes[node_index].right, right_primitives, depth + 1, (axis + 1) % MAX_AXIS);
+                if (node.IsLeaf()) {
+                    ForEachRay(ray_mask, [&](uint32_t i) {
+                        Intersection hit;
+                        if (IntersectLeaf(node, packet.rays[i], &hit)) {
+                            out_intersections[i] = hit;
+                            packet.SetTMax(i, hit.t);
+                            hit_mask |= 1U << i;
+                        }
+                    });
+                    continue;
+                }
+
+                const uint32_t left = node.Left();
+                const uint32_t right = node.Right();
+                const glm::vec3 separation = m_nodes[right].aabb.Centroid() - m_nodes[left].aabb.Centroid();
+                assert(stack_ptr + 2 <= MAX_DEPTH + 1);
+                if (glm::dot(separation, direction) < 0.0f) {
+                    stack[stack_ptr++] = left;
+                    stack[stack_ptr++] = right;
+                } else {
+                    stack[stack_ptr++] = right;
+                    stack[stack_ptr++] = left;
+                }
             }
+            return hit_mask;
         }
 
-        void BuildBvhLeaf(uint32_t node_index, const std::vector<uint32_t>& primitives) {
-            m_nodes[node_index].leaf = static_cast<int32_t>(m_leafs.size());
-            m_leafs.emplace_back(m_instance, primitives);
+        template <typename TQuant>
+        DOOB_NODISCARD bool IntersectQuantized(
+            const QuantizedBvh<TQuant>& bvh, const Ray& ray, Intersection* out_intersection) const {
+            Ray local_ray = ray;
+            uint32_t num_intersections = 0;
+            Intersection best_intersection;
+
+            const bool b_hit = bvh.Traverse(local_ray, num_intersections, [&](uint32_t leaf_id, Ray& leaf_ray) {
+                if (!IntersectLeaf(bvh.GetLeaf(leaf_id), leaf_ray, &best_intersection)) {
+                    return false;
+                }
+                num_intersections += best_intersection.num_intersections;
+                leaf_ray.t_max = best_intersection.t;
+                if (out_intersection) {
+                    *out_intersection = best_intersection;
+                }
+                return true;
+            });
+            if (out_intersection) {
+                out_intersection->num_intersections = num_intersections;
+            }
+            return b_hit;
         }
 
+        template <typename TQuant>
+        DOOB_NODISCARD uint32_t IntersectPacketQuantized(
+            const QuantizedBvh<TQuant>& bvh, RayPacket& packet, Intersection* out_intersections) const {
+            uint32_t hit_mask = 0;
+            bvh.TraversePacket(packet, [&](uint32_t leaf_id, uint32_t ray_mask) {
+                ForEachRay(ray_mask, [&](uint32_t i) {
+                    Intersection hit;
+                    if (IntersectLeaf(bvh.GetLeaf(leaf_id), packet.rays[i], &hit)) {
+                        out_intersections[i] = hit;
+                        packet.SetTMax(i, hit.t);
+                        hit_mask |= 1U << i;
+                    }
+                });
+            });
+            return hit_mask;
+        }
 
-        BVH(const MeshInstance* instance) : m_instance(instance) {
-            std::vector<uint32_t> all_primitives;
-            all_primitives.resize(instance->m_num_indices / 3);
-            std::iota(all_primitives.begin(), all_primitives.end(), 0U);
-            m_nodes.reserve(all_primitives.size() * 2);
-            m_nodes.emplace_back(); // root node
-            BuildBvhRecursive(0, all_primitives, 0, AXIS_X);
+        template <typename TQuant>
+        DOOB_NODISCARD bool OccludedQuantized(const QuantizedBvh<TQuant>& bvh, const Ray& ray) const {
+            return bvh.TraverseAny(ray, [&](uint32_t leaf_id) { return OccludedLeaf(bvh.GetLeaf(leaf_id), ray); });
+        }
 
-          /*  for (auto& bvh : m_nodes) {
-                printf("Node AABB Min: (%f, %f, %f) Max: (%f, %f, %f)", bvh.aabb.min.x, bvh.aabb.min.y,
-                    bvh.aabb.min.z, bvh.aabb.max.x, bvh.aabb.max.y, bvh.aabb.max.z);
-                printf(" Left: %u Right: %u Leaf: %d\n", bvh.left, bvh.right, bvh.leaf);
+        // Bytes taken by the nodes the traversal uses, triangles are not included
+        DOOB_NODISCARD size_t GetNodeMemoryUsage() const {
+            switch (m_options.node_format) {
+            case BvhNodeFormat::Quantized16:
+                return m_quantized16.GetMemoryUsage();
+            case BvhNodeFormat::Quantized8:
+                return m_quantized8.GetMemoryUsage();
+            default:
+                break;
             }
-            for (auto& leaf : m_leafs) {
-                printf("Leaf with %u primitives\n", leaf.GetPrimitiveCount());
-            }*/
+            size_t bytes = m_nodes.size() * sizeof(BvhNode);
+#if DOOB_BVH_WIDTH > 0
+            bytes += m_wide.GetNodeCount() * sizeof(WideBvh<DOOB_BVH_WIDTH>::Node);
+#endif
+            return bytes;
         }
 
-        DOOB_NODISCARD bool Intersect(const Ray& ray, Intersection* out_intersection) const override {
+        DOOB_NODISCARD bool IntersectBinary(const Ray& ray, Intersection* out_intersection) const {
+            if (m_nodes.empty()) {
+                return false;
+            }
             Ray local_ray = ray;
+            const PrecomputedRay query(ray);
 
-             constexpr size_t MAX_STACK_SIZE = MAX_DEPTH * 2 + 1;
+            float root_t_entry;
+            if (!m_nodes[0].aabb.RayIntersects(query, local_ray.t_min, local_ray.t_max, &root_t_entry)) {
+                return false;
+            }
 
-            const BvhNode* stack[MAX_STACK_SIZE];
+            struct StackEntry {
+                uint32_t node;
+                float t_entry;
+            };
+            // At most one sibling is pushed per level of the tree
+            constexpr size_t MAX_STACK_SIZE = MAX_DEPTH + 1;
+            StackEntry stack[MAX_STACK_SIZE];
             size_t stack_ptr = 0;
-            stack[stack_ptr++] = &m_nodes[0];
+            stack[stack_ptr++] = { 0, root_t_entry };
 
             uint32_t num_intersections = 0;
-
-            float closest_prim_t = INFINITY;
             Intersection best_intersection;
 
             bool b_hit = false;
             while (stack_ptr > 0) {
-                const BvhNode* node = stack[--stack_ptr];
-                if (node->aabb.RayIntersects(local_ray)) {
+                const StackEntry entry = stack[--stack_ptr];
+                // A closer hit may have been found since this node was pushed
+                if (entry.t_entry > local_ray.t_max) {
+                    continue;
+                }
+
+                uint32_t node_index = entry.node;
+                while (true) {
+                    const BvhNode& node = m_nodes[node_index];
                     ++num_intersections;
-                    if (node->left > 0) {
-                        assert(stack_ptr + 1 < MAX_STACK_SIZE);
-                        stack[stack_ptr++] = &m_nodes[node->left];
-                    }
-                    if (node->right > 0) {
-                        assert(stack_ptr + 1 < MAX_STACK_SIZE);
-                        stack[stack_ptr++] = &m_nodes[node->right];
-                    }
-                    if (node->leaf != -1) {
-                        const shape::Trimesh& leaf_shape = m_leafs[node->leaf];
-                        if (leaf_shape.Intersect(local_ray, &best_intersection)) {
+                    DOOB_COUNT_NODE_VISIT();
+
+                    if (node.IsLeaf()) {
+                        if (IntersectLeaf(node, local_ray, &best_intersection)) {
                             num_intersections += best_intersection.num_intersections;
                             local_ray.t_max = best_intersection.t;
                             b_hit = true;
@@ -145,6 +495,33 @@ namespace shape {
                                 *out_intersection = best_intersection;
                             }
                         }
+                        break;
+                    }
+
+                    // Test both children up front, then descend into the nearer one and defer the other
+                    const uint32_t left = node.Left();
+                    const uint32_t right = node.Right();
+                    float t_left, t_right;
+                    const bool b_hit_left =
+                        m_nodes[left].aabb.RayIntersects(query, local_ray.t_min, local_ray.t_max, &t_left);
+                    const bool b_hit_right =
+                        m_nodes[right].aabb.RayIntersects(query, local_ray.t_min, local_ray.t_max, &t_right);
+
+                    if (b_hit_left && b_hit_right) {
+                        assert(stack_ptr < MAX_STACK_SIZE);
+                        if (t_right < t_left) {
+                            stack[stack_ptr++] = { left, t_left };
+                            node_index = right;
+                        } else {
+                            stack[stack_ptr++] = { right, t_right };
+                            node_index = left;
+                        }
+                    } else if (b_hit_left) {
+                        node_index = left;
+                    } else if (b_hit_right) {
+                        node_index = right;
+                    } else {
+                        break;
                     }
                 }
             }
@@ -153,7 +530,17 @@ namespace shape {
             }
             return b_hit;
         }
-        DOOB_NODISCARD AABB GetAABB() const override { return m_nodes.empty() ? AABB{} : m_nodes[0].aabb; }
+        DOOB_NODISCARD AABB GetAABB() const override {
+            switch (m_options.node_format) {
+            case BvhNodeFormat::Quantized16:
+                return m_quantized16.GetAABB();
+            case BvhNodeFormat::Quantized8:
+                return m_quantized8.GetAABB();
+            default:
+                break;
+            }
+            return m_nodes.empty() ? AABB{} : m_nodes[0].aabb;
+        }
         DOOB_NODISCARD Fragment SampleFragment(const Intersection& intersection) const override {
             return m_instance->SampleFragment(intersection);
         }
@@ -162,9 +549,870 @@ namespace shape {
         glm::vec3 m_max;
 
     private:
-        std::vector<shape::Trimesh> m_leafs;
-        std::vector<BvhNode> m_nodes;
+        // Scratch data that only lives for the duration of the build. Every node owns the range
+        // [begin, end) of primitives, which is partitioned in place when the node is split.
+        struct LeafRange {
+            uint32_t begin = 0;
+            uint32_t end = 0;
+        };
+        struct BuildNode {
+            AABB aabb = {};
+            uint32_t left = 0; // nodes can never point to the root so 0 is assumed to be NULL
+            uint32_t right = 0;
+            int32_t leaf = -1;
+        };
+        struct BuildState {
+            std::vector<BuildNode> nodes;
+            std::vector<uint32_t> primitives;
+            std::vector<AABB> bounds;
+            std::vector<glm::vec3> centroids;
+
+            // Leaf triangles are only gathered once the (possibly parallel) build has finished
+            std::vector<LeafRange> leaf_ranges;
+            std::atomic_uint32_t node_count = 0;
+            std::atomic_uint32_t leaf_count = 0;
+
+            // Linear builds only, the Morton code of every entry in primitives
+            std::vector<uint32_t> morton_codes;
+
+            // Spatial splits only, leafs copy their references into primitives
+            std::atomic_uint32_t leaf_primitive_count = 0;
+            float min_overlap_area = 0.0f;
+
+            // Lazy builds only, ranges this small become leafs that defer to a subtree built on demand
+            uint32_t lazy_subtree_size = 0;
+
+            TaskPool* pool = nullptr;
+        };
+        struct SahSplit {
+            int axis = -1;
+            int bin = 0;
+            float cost = INFINITY;
+            AABB left_bounds = {};
+            AABB right_bounds = {};
+        };
+
+        // A (possibly clipped) primitive during a spatial split build
+        struct Reference {
+            AABB bounds = {};
+            uint32_t primitive = 0;
+        };
+        struct SpatialSplit {
+            int axis = -1;
+            float position = 0.0f;
+            float cost = INFINITY;
+        };
+
+        // A deferred subtree of a lazy BVH, its primitives are only turned into a BVH by ExpandSubtree
+        struct LazySubtree {
+            std::once_flag expanded;
+            std::vector<uint32_t> primitives; // released once expanded
+            std::unique_ptr<BVH> bvh;
+        };
+
+        void Build(TaskPool* pool) {
+            m_nodes.clear();
+            m_triangles.clear();
+#if DOOB_TRIANGLE_GROUP_WIDTH > 0
+            m_triangle_groups.clear();
+#endif
+            m_lazy_subtrees.clear();
+            m_build_sah_cost = 0.0f;
+            m_statistics = {};
+
+            const uint32_t num_primitives =
+                m_primitives.empty() ? m_instance->m_num_indices / 3 : static_cast<uint32_t>(m_primitives.size());
+            if (num_primitives == 0) {
+                return;
+            }
+
+            BuildState state;
+            state.pool = pool;
+            state.bounds.resize(num_primitives);
+            state.centroids.resize(num_primitives);
+            for (uint32_t i = 0; i < num_primitives; ++i) {
+                state.bounds[i] = m_instance->GetPrimitiveAabb(MeshPrimitive(i));
+                state.centroids[i] = state.bounds[i].Centroid();
+            }
+
+            const bool b_lazy = m_options.lazy_subtree_size > 0;
+            if (m_options.split_mode == BvhSplitMode::Spatial && !b_lazy) {
+                BuildSpatial(state, m_options);
+            } else if (m_options.split_mode == BvhSplitMode::Linear && !b_lazy) {
+                BuildLinear(state);
+            } else {
+                state.primitives.resize(num_primitives);
+                std::iota(state.primitives.begin(), state.primitives.end(), 0U);
+
+                // A binary tree with at most one leaf per primitive never needs more nodes than this, which lets
+                // parallel subtree builds allocate nodes with an atomic counter
+                state.nodes.resize(static_cast<size_t>(num_primitives) * 2 - 1);
+                state.leaf_ranges.resize(num_primitives);
+                state.node_count = 1; // root node
+                state.lazy_subtree_size = m_options.lazy_subtree_size;
+                BuildBvhRecursive(state, 0, 0, num_primitives, 0);
+            }
+
+            m_nodes.reserve(state.node_count);
+            FlattenRecursive(state, 0);
+
+            // Store the triangles of every leaf next to each other, in the same depth first order as the nodes
+            m_triangles.reserve(state.primitives.size());
+            for (BvhNode& node : m_nodes) {
+                if (!node.IsLeaf()) {
+                    continue;
+                }
+                const LeafRange& range = state.leaf_ranges[node.offset];
+                if (b_lazy) {
+                    // Lazy leafs point to their subtree instead
+                    node.offset = static_cast<uint32_t>(m_lazy_subtrees.size());
+                    auto subtree = std::make_unique<LazySubtree>();
+                    subtree->primitives.reserve(range.end - range.begin);
+                    for (uint32_t i = range.begin; i < range.end; ++i) {
+                        subtree->primitives.push_back(MeshPrimitive(state.primitives[i]));
+                    }
+                    m_lazy_subtrees.push_back(std::move(subtree));
+                    continue;
+                }
+#if DOOB_TRIANGLE_GROUP_WIDTH > 0
+                // Leafs start on a group boundary, the zeroed triangles in between never hit anything
+                m_triangles.resize(RoundUpToGroup(m_triangles.size()));
+#endif
+                node.offset = static_cast<uint32_t>(m_triangles.size());
+                for (uint32_t i = range.begin; i < range.end; ++i) {
+                    const uint32_t primitive = MeshPrimitive(state.primitives[i]);
+                    m_triangles.push_back(PrecomputedTriangle::FromMesh(m_instance, primitive));
+                }
+            }
+#if DOOB_TRIANGLE_GROUP_WIDTH > 0
+            m_triangles.resize(RoundUpToGroup(m_triangles.size()));
+            BuildTriangleGroups();
+#endif
+            ReorderNodes();
+#if DOOB_BVH_WIDTH > 0
+            m_wide.Build(m_nodes);
+#endif
+            m_build_sah_cost = ComputeSahCost();
+            // Before compressing, quantized trees drop the full precision nodes
+            ComputeStatistics();
+
+            if (m_options.node_format != BvhNodeFormat::Full) {
+                Compress();
+                m_statistics.node_bytes = GetNodeMemoryUsage();
+            }
+        }
+
+        // Replaces the full precision nodes with the quantized tree selected by the build options
+        void Compress() {
+            switch (m_options.node_format) {
+            case BvhNodeFormat::Quantized16:
+                m_quantized16.Build(m_nodes);
+                break;
+            case BvhNodeFormat::Quantized8:
+                m_quantized8.Build(m_nodes);
+                break;
+            default:
+                return;
+            }
+            BvhNodeArray().swap(m_nodes);
+#if DOOB_BVH_WIDTH > 0
+            m_wide = {};
+#endif
+        }
+
+        void ComputeStatistics() {
+            BvhStatistics& stats = m_statistics;
+            stats = {};
+            stats.lazy_subtree_count = static_cast<uint32_t>(m_lazy_subtrees.size());
+            stats.node_bytes = GetNodeMemoryUsage();
+            stats.primitive_bytes = m_triangles.size() * sizeof(PrecomputedTriangle);
+#if DOOB_TRIANGLE_GROUP_WIDTH > 0
+            stats.primitive_bytes += m_triangle_groups.size() * sizeof(TriangleGroup);
+#endif
+            if (m_nodes.empty()) {
+                return;
+            }
+            stats.sah_cost = ComputeSahCost();
+
+            struct StackEntry {
+                uint32_t node;
+                uint32_t depth;
+            };
+            std::vector<StackEntry> stack = { { 0, 0 } };
+            uint64_t depth_sum = 0;
+            stats.min_leaf_depth = std::numeric_limits<uint32_t>::max();
+            float overlap_area = 0.0f;
+            while (!stack.empty()) {
+                const StackEntry entry = stack.back();
+                stack.pop_back();
+                const BvhNode& node = m_nodes[entry.node];
+                ++stats.node_count;
+                if (node.IsLeaf()) {
+                    ++stats.leaf_count;
+                    stats.primitive_references += node.primitive_count;
+                    ++stats.leaf_size_histogram[glm::min<size_t>(
+                        node.primitive_count, BvhStatistics::MAX_LEAF_SIZE_BUCKET)];
+                    if (stats.leaf_depth_histogram.size() <= entry.depth) {
+                        stats.leaf_depth_histogram.resize(entry.depth + 1, 0);
+                    }
+                    ++stats.leaf_depth_histogram[entry.depth];
+                    stats.min_leaf_depth = glm::min(stats.min_leaf_depth, entry.depth);
+                    stats.max_leaf_depth = glm::max(stats.max_leaf_depth, entry.depth);
+                    depth_sum += entry.depth;
+                    continue;
+                }
+                const AABB overlap = m_nodes[node.Left()].aabb.Intersection(m_nodes[node.Right()].aabb);
+                if (!overlap.IsEmpty()) {
+                    overlap_area += overlap.SurfaceArea();
+                }
+                stack.push_back({ node.Left(), entry.depth + 1 });
+                stack.push_back({ node.Right(), entry.depth + 1 });
+            }
+            stats.average_leaf_depth = static_cast<double>(depth_sum) / stats.leaf_count;
+            stats.sibling_overlap =
+                overlap_area / glm::max(m_nodes[0].aabb.SurfaceArea(), std::numeric_limits<float>::min());
+        }
+
+        // Moves the depth first nodes from FlattenRecursive into sibling pairs, still in depth first order of their
+        // parents. Grouping the pairs into page sized treelets was measured and did not beat this order.
+        void ReorderNodes() {
+            if (m_nodes.size() <= 1) {
+                return;
+            }
+            const BvhNodeArray depth_first = std::move(m_nodes);
+            m_nodes.clear();
+            m_nodes.reserve(depth_first.size() + 1);
+            m_nodes.push_back(depth_first[0]);
+            m_nodes.push_back({}); // PADDING_NODE_INDEX, an empty box never adds to the SAH cost
+
+            // Where each interior node ended up, so its child index can be patched once the children are placed
+            std::vector<uint32_t> new_index(depth_first.size(), 0);
+            std::vector<uint32_t> parents = { 0 };
+            while (!parents.empty()) {
+                const uint32_t parent = parents.back();
+                parents.pop_back();
+                const uint32_t children[2] = { parent + 1, depth_first[parent].offset };
+                const uint32_t pair_index = static_cast<uint32_t>(m_nodes.size());
+                m_nodes[new_index[parent]].offset = pair_index;
+                for (int i = 0; i < 2; ++i) {
+                    new_index[children[i]] = pair_index + i;
+                    m_nodes.push_back(depth_first[children[i]]);
+                }
+                // Pushed in reverse, so the left subtree is placed before the right one
+                for (int i = 1; i >= 0; --i) {
+                    if (!depth_first[children[i]].IsLeaf()) {
+                        parents.push_back(children[i]);
+                    }
+                }
+            }
+        }
+
+        template <typename TLeaf>
+        DOOB_NODISCARD DOOB_FORCEINLINE Trimesh GetLeaf(const TLeaf& leaf) const {
+#if DOOB_TRIANGLE_GROUP_WIDTH > 0
+            return Trimesh(m_triangles.data() + leaf.offset, leaf.primitive_count,
+                m_triangle_groups.data() + leaf.offset / TriangleGroup::WIDTH);
+#else
+            return Trimesh(m_triangles.data() + leaf.offset, leaf.primitive_count);
+#endif
+        }
+
+#if DOOB_TRIANGLE_GROUP_WIDTH > 0
+        DOOB_NODISCARD static size_t RoundUpToGroup(size_t count) {
+            return (count + TriangleGroup::WIDTH - 1) / TriangleGroup::WIDTH * TriangleGroup::WIDTH;
+        }
+        // m_triangles is padded to whole groups, every leaf starts at the first lane of a group
+        void BuildTriangleGroups() {
+            m_triangle_groups.resize(m_triangles.size() / TriangleGroup::WIDTH);
+            for (size_t i = 0; i < m_triangles.size(); ++i) {
+                m_triangle_groups[i / TriangleGroup::WIDTH].SetLane(
+                    static_cast<int>(i % TriangleGroup::WIDTH), m_triangles[i]);
+            }
+        }
+#endif
+
+        // Leaf tests of all traversal kernels, lazy leafs are answered by their (possibly just built) subtree
+        template <typename TLeaf>
+        DOOB_NODISCARD DOOB_FORCEINLINE bool IntersectLeaf(
+            const TLeaf& leaf, const Ray& ray, Intersection* out_intersection) const {
+            if (!m_lazy_subtrees.empty()) {
+                return ExpandSubtree(leaf.offset).Intersect(ray, out_intersection);
+            }
+            DOOB_COUNT_PRIMITIVE_TESTS(leaf.primitive_count);
+            return GetLeaf(leaf).Intersect(ray, out_intersection);
+        }
+        template <typename TLeaf>
+        DOOB_NODISCARD DOOB_FORCEINLINE bool OccludedLeaf(const TLeaf& leaf, const Ray& ray) const {
+            if (!m_lazy_subtrees.empty()) {
+                return ExpandSubtree(leaf.offset).Occluded(ray);
+            }
+            DOOB_COUNT_PRIMITIVE_TESTS(leaf.primitive_count);
+            return GetLeaf(leaf).Occluded(ray);
+        }
+
+        // Builds a deferred subtree once, on the first ray that reaches it. Rays reaching it during that build wait
+        // for it to finish.
+        DOOB_NODISCARD const BVH& ExpandSubtree(uint32_t subtree_index) const {
+            LazySubtree& subtree = *m_lazy_subtrees[subtree_index];
+            std::call_once(subtree.expanded, [&]() {
+                BvhBuildOptions options = m_options;
+                options.lazy_subtree_size = 0;
+                subtree.bvh = std::make_unique<BVH>(m_instance, std::move(subtree.primitives), options);
+                subtree.primitives = {};
+            });
+            return *subtree.bvh;
+        }
+
+        // Primitives are numbered within m_primitives during the build when the BVH only covers a subset of the mesh
+        DOOB_NODISCARD DOOB_FORCEINLINE uint32_t MeshPrimitive(uint32_t index) const {
+            return m_primitives.empty() ? index : m_primitives[index];
+        }
+
+        DOOB_NODISCARD static DOOB_FORCEINLINE int ComputeBin(float centroid, float axis_min, float axis_scale) {
+            const int bin = static_cast<int>((centroid - axis_min) * axis_scale);
+            return std::clamp(bin, 0, NUM_SAH_BINS - 1);
+        }
+
+        // bounds_fn(i) and centroid_fn(i) return the bounds and centroid of the i-th primitive in [begin, end)
+        template <typename TBoundsFn, typename TCentroidFn>
+        DOOB_NODISCARD static SahSplit FindSahSplit(uint32_t begin, uint32_t end, const AABB& aabb,
+            const AABB& centroid_bounds, TBoundsFn&& bounds_fn, TCentroidFn&& centroid_fn) {
+            struct Bin {
+                AABB bounds = AABB::Empty();
+                uint32_t count = 0;
+            };
+
+            SahSplit best = {};
+            const float inv_parent_area = 1.0f / glm::max(aabb.SurfaceArea(), std::numeric_limits<float>::min());
+
+            glm::vec3 axis_scale = {};
+            for (int axis = 0; axis < MAX_AXIS; ++axis) {
+                const float extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+                axis_scale[axis] = extent > 0.0f ? static_cast<float>(NUM_SAH_BINS) / extent : 0.0f;
+            }
+
+            // Bin all three axes in a single pass over the primitives
+            Bin bins[MAX_AXIS][NUM_SAH_BINS];
+            for (uint32_t i = begin; i < end; ++i) {
+                const AABB& prim_aabb = bounds_fn(i);
+                const glm::vec3 centroid = centroid_fn(i);
+                for (int axis = 0; axis < MAX_AXIS; ++axis) {
+                    Bin& bin = bins[axis][ComputeBin(centroid[axis], centroid_bounds.min[axis], axis_scale[axis])];
+                    bin.bounds.Grow(prim_aabb);
+                    ++bin.count;
+                }
+            }
+
+            for (int axis = 0; axis < MAX_AXIS; ++axis) {
+                if (axis_scale[axis] <= 0.0f) {
+                    continue;
+                }
+
+                // Split plane i lies between bins i - 1 and i
+                float right_area[NUM_SAH_BINS];
+                uint32_t right_count[NUM_SAH_BINS];
+                AABB right_bounds = AABB::Empty();
+                uint32_t right_sum = 0;
+                for (int i = NUM_SAH_BINS - 1; i > 0; --i) {
+                    right_bounds.Grow(bins[axis][i].bounds);
+                    right_sum += bins[axis][i].count;
+                    right_area[i] = right_bounds.SurfaceArea();
+                    right_count[i] = right_sum;
+                }
+
+                AABB left_bounds = AABB::Empty();
+                uint32_t left_sum = 0;
+                for (int i = 1; i < NUM_SAH_BINS; ++i) {
+                    left_bounds.Grow(bins[axis][i - 1].bounds);
+                    left_sum += bins[axis][i - 1].count;
+                    if (left_sum == 0 || right_count[i] == 0) {
+                        continue;
+                    }
+                    const float cost = SAH_TRAVERSAL_COST + inv_parent_area *
+                                                                (left_bounds.SurfaceArea() * LeafCost(left_sum) +
+                                                                    right_area[i] * LeafCost(right_count[i]));
+                    if (cost < best.cost) {
+                        best = { .axis = axis, .bin = i, .cost = cost, .left_bounds = left_bounds };
+                    }
+                }
+            }
+            if (best.axis >= 0) {
+                best.right_bounds = AABB::Empty();
+                for (int i = best.bin; i < NUM_SAH_BINS; ++i) {
+                    best.right_bounds.Grow(bins[best.axis][i].bounds);
+                }
+            }
+            return best;
+        }
+
+        void BuildBvhRecursive(BuildState& state, uint32_t node_index, uint32_t begin, uint32_t end, int depth) {
+            assert(begin < end);
+
+            AABB aabb = AABB::Empty();
+            AABB centroid_bounds = AABB::Empty();
+            for (uint32_t i = begin; i < end; ++i) {
+                aabb.Grow(state.bounds[state.primitives[i]]);
+                centroid_bounds.Grow(state.centroids[state.primitives[i]]);
+            }
+            state.nodes[node_index].aabb = aabb;
+
+            const uint32_t count = end - begin;
+            if (count == 1 || count <= state.lazy_subtree_size || depth >= MAX_DEPTH) {
+                BuildBvhLeaf(state, node_index, begin, end);
+                return;
+            }
+
+            const SahSplit split = FindSahSplit(
+                begin, end, aabb, centroid_bounds,
+                [&](uint32_t i) -> const AABB& { return state.bounds[state.primitives[i]]; },
+                [&](uint32_t i) { return state.centroids[state.primitives[i]]; });
+            const float leaf_cost = LeafCost(count);
+            if (count <= MAX_PRIMITIVES_PER_LEAF && (split.axis < 0 || split.cost >= leaf_cost)) {
+                BuildBvhLeaf(state, node_index, begin, end);
+                return;
+            }
+
+            uint32_t* first = state.primitives.data() + begin;
+            uint32_t* last = state.primitives.data() + end;
+            uint32_t mid = begin + count / 2;
+            if (split.axis >= 0) {
+                const float axis_min = centroid_bounds.min[split.axis];
+                const float axis_scale =
+                    static_cast<float>(NUM_SAH_BINS) / (centroid_bounds.max[split.axis] - axis_min);
+                uint32_t* pivot = std::partition(first, last, [&](uint32_t prim_index) {
+                    return ComputeBin(state.centroids[prim_index][split.axis], axis_min, axis_scale) < split.bin;
+                });
+                mid = static_cast<uint32_t>(pivot - state.primitives.data());
+            }
+            // All centroids coincide (or binning degenerated), any split is as good as another
+            if (mid == begin || mid == end) {
+                mid = begin + count / 2;
+            }
+
+            const uint32_t left_idx = state.node_count.fetch_add(2, std::memory_order_relaxed);
+            const uint32_t right_idx = left_idx + 1;
+            state.nodes[node_index].left = left_idx;
+            state.nodes[node_index].right = right_idx;
+
+            // Both halves own disjoint primitive ranges and nodes, so they can be built concurrently
+            if (state.pool && count >= PARALLEL_BUILD_THRESHOLD) {
+                TaskGroup group(state.pool);
+                group.Run([this, &state, left_idx, begin, mid, depth]() {
+                    BuildBvhRecursive(state, left_idx, begin, mid, depth + 1);
+                });
+                BuildBvhRecursive(state, right_idx, mid, end, depth + 1);
+                group.Wait();
+            } else {
+                BuildBvhRecursive(state, left_idx, begin, mid, depth + 1);
+                BuildBvhRecursive(state, right_idx, mid, end, depth + 1);
+            }
+        }
+
+        void BuildBvhLeaf(BuildState& state, uint32_t node_index, uint32_t begin, uint32_t end) {
+            const uint32_t leaf_index = state.leaf_count.fetch_add(1, std::memory_order_relaxed);
+            state.leaf_ranges[leaf_index] = { .begin = begin, .end = end };
+            state.nodes[node_index].leaf = static_cast<int32_t>(leaf_index);
+        }
+
+        void BuildLinear(BuildState& state) {
+            const uint32_t num_primitives = static_cast<uint32_t>(state.centroids.size());
+            AABB centroid_bounds = AABB::Empty();
+            for (const glm::vec3& centroid : state.centroids) {
+                centroid_bounds.Grow(centroid);
+            }
+            const glm::vec3 inv_extent = 1.0f / glm::max(centroid_bounds.Extent(), glm::vec3(1e-6f));
+
+            // The primitive indices are sorted along with the codes as payload
+            state.morton_codes.resize(num_primitives);
+            state.primitives.resize(num_primitives);
+            for (uint32_t i = 0; i < num_primitives; ++i) {
+                state.morton_codes[i] =
+                    MortonEncodePoint(state.centroids[i], centroid_bounds.min, inv_extent, MORTON_BITS_PER_AXIS);
+                state.primitives[i] = i;
+            }
+            RadixSortByKey(state.morton_codes, state.primitives, 3 * MORTON_BITS_PER_AXIS);
+
+            state.nodes.resize(static_cast<size_t>(num_primitives) * 2 - 1);
+            state.leaf_ranges.resize(num_primitives);
+            state.node_count = 1; // root node
+            BuildLinearRecursive(state, 0, 0, num_primitives, 0);
+        }
+
+        // Splits [begin, end) at the first primitive whose code differs from the first one in the highest bit that
+        // is not shared by the whole range. Bounds are only known once both children are done, so they are returned.
+        AABB BuildLinearRecursive(BuildState& state, uint32_t node_index, uint32_t begin, uint32_t end, int depth) {
+            assert(begin < end);
+
+            const uint32_t count = end - begin;
+            if (count <= LINEAR_LEAF_SIZE || depth >= MAX_DEPTH) {
+                AABB aabb = AABB::Empty();
+                for (uint32_t i = begin; i < end; ++i) {
+                    aabb.Grow(state.bounds[state.primitives[i]]);
+                }
+                state.nodes[node_index].aabb = aabb;
+                BuildBvhLeaf(state, node_index, begin, end);
+                return aabb;
+            }
+
+            const uint32_t first_code = state.morton_codes[begin];
+            const uint32_t last_code = state.morton_codes[end - 1];
+            uint32_t mid = begin + count / 2;
+            // Equal codes have no order worth keeping, they are simply halved
+            if (first_code != last_code) {
+                const int common_prefix = std::countl_zero(first_code ^ last_code);
+                uint32_t split = begin;
+                uint32_t step = count - 1;
+                do {
+                    step = (step + 1) / 2;
+                    const uint32_t candidate = split + step;
+                    if (candidate < end - 1 &&
+                        std::countl_zero(first_code ^ state.morton_codes[candidate]) > common_prefix) {
+                        split = candidate;
+                    }
+                } while (step > 1);
+                mid = split + 1;
+            }
+
+            const uint32_t left_idx = state.node_count.fetch_add(2, std::memory_order_relaxed);
+            const uint32_t right_idx = left_idx + 1;
+            state.nodes[node_index].left = left_idx;
+            state.nodes[node_index].right = right_idx;
+
+            AABB left_aabb, right_aabb;
+            if (state.pool && count >= PARALLEL_BUILD_THRESHOLD) {
+                TaskGroup group(state.pool);
+                group.Run([this, &state, &left_aabb, left_idx, begin, mid, depth]() {
+                    left_aabb = BuildLinearRecursive(state, left_idx, begin, mid, depth + 1);
+                });
+                right_aabb = BuildLinearRecursive(state, right_idx, mid, end, depth + 1);
+                group.Wait();
+            } else {
+                left_aabb = BuildLinearRecursive(state, left_idx, begin, mid, depth + 1);
+                right_aabb = BuildLinearRecursive(state, right_idx, mid, end, depth + 1);
+            }
+            state.nodes[node_index].aabb = left_aabb.Union(right_aabb);
+            return state.nodes[node_index].aabb;
+        }
+
+        void BuildSpatial(BuildState& state, const BvhBuildOptions& options) {
+            const uint32_t num_primitives = static_cast<uint32_t>(state.bounds.size());
+            const uint32_t max_duplicates =
+                static_cast<uint32_t>(static_cast<float>(num_primitives) * glm::max(options.duplication_budget, 0.0f));
+            const uint32_t max_references = num_primitives + max_duplicates;
+
+            std::vector<Reference> references(num_primitives);
+            AABB root_aabb = AABB::Empty();
+            for (uint32_t i = 0; i < num_primitives; ++i) {
+                references[i] = { .bounds = state.bounds[i], .primitive = i };
+                root_aabb.Grow(state.bounds[i]);
+            }
+
+            // Duplicated references end up in extra leafs, the budget bounds how many there can be
+            state.primitives.resize(max_references);
+            state.nodes.resize(static_cast<size_t>(max_references) * 2 - 1);
+            state.leaf_ranges.resize(max_references);
+            state.node_count = 1; // root node
+            state.min_overlap_area = options.spatial_split_alpha * root_aabb.SurfaceArea();
+            BuildSpatialRecursive(state, 0, references, max_duplicates, 0);
+        }
+
+        // Every subtree gets its own share of the duplication budget, so a depth first build cannot spend all of
+        // it on the first branches it visits
+        void BuildSpatialRecursive(BuildState& state, uint32_t node_index, std::vector<Reference>& references,
+            uint32_t duplicates_left, int depth) {
+            assert(!references.empty());
+
+            AABB aabb = AABB::Empty();
+            AABB centroid_bounds = AABB::Empty();
+            for (const Reference& reference : references) {
+                aabb.Grow(reference.bounds);
+                centroid_bounds.Grow(reference.bounds.Centroid());
+            }
+            state.nodes[node_index].aabb = aabb;
+
+            const uint32_t count = static_cast<uint32_t>(references.size());
+            if (count == 1 || depth >= MAX_DEPTH) {
+                BuildSpatialLeaf(state, node_index, references);
+                return;
+            }
+
+            const SahSplit object_split = FindSahSplit(
+                0, count, aabb, centroid_bounds, [&](uint32_t i) -> const AABB& { return references[i].bounds; },
+                [&](uint32_t i) { return references[i].bounds.Centroid(); });
+
+            // Spatial splits only pay off where object split children overlap noticeably, skip the (much more
+            // expensive) clipping everywhere else
+            SpatialSplit spatial_split = {};
+            const bool b_try_spatial = object_split.axis < 0 ||
+                                       object_split.left_bounds.Intersection(object_split.right_bounds).SurfaceArea() >
+                                           state.min_overlap_area;
+            if (b_try_spatial && duplicates_left > 0) {
+                spatial_split = FindSpatialSplit(references, aabb);
+            }
+
+            const float leaf_cost = LeafCost(count);
+            const float split_cost = glm::min(object_split.cost, spatial_split.cost);
+            if (count <= MAX_PRIMITIVES_PER_LEAF && split_cost >= leaf_cost) {
+                BuildSpatialLeaf(state, node_index, references);
+                return;
+            }
+
+            std::vector<Reference> left_references;
+            std::vector<Reference> right_references;
+            const bool b_spatial = spatial_split.cost < object_split.cost &&
+                                   SplitSpatial(references, spatial_split, duplicates_left, left_references,
+                                       right_references);
+            if (!b_spatial) {
+                Reference* first = references.data();
+                Reference* last = references.data() + count;
+                Reference* pivot = first + count / 2;
+                if (object_split.axis >= 0) {
+                    const int axis = object_split.axis;
+                    const float axis_min = centroid_bounds.min[axis];
+                    const float axis_scale = static_cast<float>(NUM_SAH_BINS) / (centroid_bounds.max[axis] - axis_min);
+                    pivot = std::partition(first, last, [&](const Reference& reference) {
+                        return ComputeBin(reference.bounds.Centroid()[axis], axis_min, axis_scale) < object_split.bin;
+                    });
+                }
+                // All centroids coincide (or binning degenerated), any split is as good as another
+                if (pivot == first || pivot == last) {
+                    pivot = first + count / 2;
+                }
+                left_references.assign(first, pivot);
+                right_references.assign(pivot, last);
+            }
+            // The children own copies now, release this level before descending
+            references.clear();
+            references.shrink_to_fit();
+
+            const uint32_t left_count = static_cast<uint32_t>(left_references.size());
+            const uint32_t right_count = static_cast<uint32_t>(right_references.size());
+            duplicates_left -= left_count + right_count - count;
+            const uint32_t left_duplicates = static_cast<uint32_t>(
+                static_cast<uint64_t>(duplicates_left) * left_count / (left_count + right_count));
+            const uint32_t right_duplicates = duplicates_left - left_duplicates;
+
+            const uint32_t left_idx = state.node_count.fetch_add(2, std::memory_order_relaxed);
+            const uint32_t right_idx = left_idx + 1;
+            state.nodes[node_index].left = left_idx;
+            state.nodes[node_index].right = right_idx;
+
+            if (state.pool && count >= PARALLEL_BUILD_THRESHOLD) {
+                TaskGroup group(state.pool);
+                group.Run([this, &state, left_idx, &left_references, left_duplicates, depth]() {
+                    BuildSpatialRecursive(state, left_idx, left_references, left_duplicates, depth + 1);
+                });
+                BuildSpatialRecursive(state, right_idx, right_references, right_duplicates, depth + 1);
+                group.Wait();
+            } else {
+                BuildSpatialRecursive(state, left_idx, left_references, left_duplicates, depth + 1);
+                BuildSpatialRecursive(state, right_idx, right_references, right_duplicates, depth + 1);
+            }
+        }
+
+        void BuildSpatialLeaf(BuildState& state, uint32_t node_index, const std::vector<Reference>& references) {
+            const uint32_t count = static_cast<uint32_t>(references.size());
+            const uint32_t begin = state.leaf_primitive_count.fetch_add(count, std::memory_order_relaxed);
+            assert(begin + count <= state.primitives.size());
+            for (uint32_t i = 0; i < count; ++i) {
+                state.primitives[begin + i] = references[i].primitive;
+            }
+            BuildBvhLeaf(state, node_index, begin, begin + count);
+        }
+
+        // Clips the triangle of a reference against the plane at position on axis, the halves are kept within
+        // the bounds of the reference as it may have been clipped before
+        void SplitReference(
+            const Reference& reference, int axis, float position, Reference& out_left, Reference& out_right) const {
+            out_left = { .bounds = AABB::Empty(), .primitive = reference.primitive };
+            out_right = { .bounds = AABB::Empty(), .primitive = reference.primitive };
+
+            const uint32_t* indices = m_instance->m_index_ptr + MeshPrimitive(reference.primitive) * 3;
+            glm::vec3 v1 = m_instance->m_positions[indices[2]];
+            for (int i = 0; i < 3; ++i) {
+                const glm::vec3 v0 = v1;
+                v1 = m_instance->m_positions[indices[i]];
+                const float p0 = v0[axis];
+                const float p1 = v1[axis];
+                if (p0 <= position) {
+                    out_left.bounds.Grow(v0);
+                }
+                if (p0 >= position) {
+                    out_right.bounds.Grow(v0);
+                }
+                // Edge crosses the plane, both halves get the crossing point
+                if ((p0 < position && p1 > position) || (p0 > position && p1 < position)) {
+                    const float t = glm::clamp((position - p0) / (p1 - p0), 0.0f, 1.0f);
+                    const glm::vec3 crossing = glm::mix(v0, v1, t);
+                    out_left.bounds.Grow(crossing);
+                    out_right.bounds.Grow(crossing);
+                }
+            }
+            out_left.bounds.max[axis] = position;
+            out_right.bounds.min[axis] = position;
+            out_left.bounds = out_left.bounds.Intersection(reference.bounds);
+            out_right.bounds = out_right.bounds.Intersection(reference.bounds);
+        }
+
+        DOOB_NODISCARD SpatialSplit FindSpatialSplit(const std::vector<Reference>& references, const AABB& aabb) const {
+            struct Bin {
+                AABB bounds = AABB::Empty();
+                uint32_t entry = 0; // references starting in this bin
+                uint32_t exit = 0;  // references ending in this bin
+            };
+
+            SpatialSplit best = {};
+            const float inv_parent_area = 1.0f / glm::max(aabb.SurfaceArea(), std::numeric_limits<float>::min());
+
+            for (int axis = 0; axis < MAX_AXIS; ++axis) {
+                const float axis_min = aabb.min[axis];
+                const float extent = aabb.max[axis] - axis_min;
+                if (extent <= 0.0f) {
+                    continue;
+                }
+                const float bin_size = extent / static_cast<float>(NUM_SPATIAL_BINS);
+                const float inv_bin_size = 1.0f / bin_size;
+
+                // Every reference is chopped into the bins it overlaps, so bin bounds are tight around the clipped
+                // triangles rather than their boxes
+                Bin bins[NUM_SPATIAL_BINS];
+                for (const Reference& reference : references) {
+                    const int first_bin =
+                        std::clamp(static_cast<int>((reference.bounds.min[axis] - axis_min) * inv_bin_size), 0,
+                            NUM_SPATIAL_BINS - 1);
+                    const int last_bin =
+                        std::clamp(static_cast<int>((reference.bounds.max[axis] - axis_min) * inv_bin_size),
+                            first_bin, NUM_SPATIAL_BINS - 1);
+
+                    Reference remainder = reference;
+                    for (int bin = first_bin; bin < last_bin; ++bin) {
+                        Reference left, right;
+                        SplitReference(remainder, axis, axis_min + bin_size * static_cast<float>(bin + 1), left, right);
+                        bins[bin].bounds.Grow(left.bounds);
+                        remainder = right;
+                    }
+                    bins[last_bin].bounds.Grow(remainder.bounds);
+                    ++bins[first_bin].entry;
+                    ++bins[last_bin].exit;
+                }
+
+                // Split plane i lies between bins i - 1 and i
+                float right_area[NUM_SPATIAL_BINS];
+                uint32_t right_count[NUM_SPATIAL_BINS];
+                AABB right_bounds = AABB::Empty();
+                uint32_t right_sum = 0;
+                for (int i = NUM_SPATIAL_BINS - 1; i > 0; --i) {
+                    right_bounds.Grow(bins[i].bounds);
+                    right_sum += bins[i].exit;
+                    right_area[i] = right_bounds.SurfaceArea();
+                    right_count[i] = right_sum;
+                }
+
+                AABB left_bounds = AABB::Empty();
+                uint32_t left_sum = 0;
+                for (int i = 1; i < NUM_SPATIAL_BINS; ++i) {
+                    left_bounds.Grow(bins[i - 1].bounds);
+                    left_sum += bins[i - 1].entry;
+                    if (left_sum == 0 || right_count[i] == 0) {
+                        continue;
+                    }
+                    const float cost = SAH_TRAVERSAL_COST + inv_parent_area *
+                                                                (left_bounds.SurfaceArea() * LeafCost(left_sum) +
+                                                                    right_area[i] * LeafCost(right_count[i]));
+                    if (cost < best.cost) {
+                        best = { .axis = axis, .position = axis_min + bin_size * static_cast<float>(i), .cost = cost };
+                    }
+                }
+            }
+            return best;
+        }
+
+        // Returns false without touching the output when the split makes no progress or exceeds the duplication
+        // budget, the caller then falls back to the object split
+        bool SplitSpatial(const std::vector<Reference>& references, const SpatialSplit& split, uint32_t duplicates_left,
+            std::vector<Reference>& out_left, std::vector<Reference>& out_right) const {
+            const int axis = split.axis;
+            uint32_t left_only = 0;
+            uint32_t right_only = 0;
+            for (const Reference& reference : references) {
+                if (reference.bounds.max[axis] <= split.position) {
+                    ++left_only;
+                } else if (reference.bounds.min[axis] >= split.position) {
+                    ++right_only;
+                }
+            }
+            if (left_only == 0 || right_only == 0) {
+                return false;
+            }
+
+            const uint32_t straddling = static_cast<uint32_t>(references.size()) - left_only - right_only;
+            if (straddling > duplicates_left) {
+                return false;
+            }
+
+            out_left.reserve(left_only + straddling);
+            out_right.reserve(right_only + straddling);
+            for (const Reference& reference : references) {
+                if (reference.bounds.max[axis] <= split.position) {
+                    out_left.push_back(reference);
+                } else if (reference.bounds.min[axis] >= split.position) {
+                    out_right.push_back(reference);
+                } else {
+                    // The box straddles the plane but the triangle itself may lie on one side only
+                    Reference left, right;
+                    SplitReference(reference, axis, split.position, left, right);
+                    if (left.bounds.IsEmpty()) {
+                        out_right.push_back(right);
+                    } else if (right.bounds.IsEmpty()) {
+                        out_left.push_back(left);
+                    } else {
+                        out_left.push_back(left);
+                        out_right.push_back(right);
+                    }
+                }
+            }
+            return true;
+        }
+
+        // Emits the subtree depth first, so left children end up directly behind their parent. Interior nodes point
+        // to their right child until ReorderNodes moves them into the final layout.
+        uint32_t FlattenRecursive(const BuildState& state, uint32_t build_index) {
+            const BuildNode& build_node = state.nodes[build_index];
+            const uint32_t flat_index = static_cast<uint32_t>(m_nodes.size());
+            m_nodes.push_back({ .aabb = build_node.aabb });
+
+            if (build_node.leaf >= 0) {
+                const LeafRange& range = state.leaf_ranges[build_node.leaf];
+                m_nodes[flat_index].offset = static_cast<uint32_t>(build_node.leaf); // patched to the first triangle
+                m_nodes[flat_index].primitive_count = range.end - range.begin;
+                return flat_index;
+            }
+
+            FlattenRecursive(state, build_node.left);
+            const uint32_t right_index = FlattenRecursive(state, build_node.right);
+            m_nodes[flat_index].offset = right_index;
+            return flat_index;
+        }
+
+        std::vector<PrecomputedTriangle> m_triangles;
+#if DOOB_TRIANGLE_GROUP_WIDTH > 0
+        // SoA copy of m_triangles the leaf tests run on, the AoS triangles are kept for refits and hit attributes
+        std::vector<TriangleGroup> m_triangle_groups;
+#endif
+        BvhNodeArray m_nodes;
+#if DOOB_BVH_WIDTH > 0
+        WideBvh<DOOB_BVH_WIDTH> m_wide;
+#endif
+        // Only the one selected by m_options.node_format is built
+        QuantizedBvh<uint16_t> m_quantized16;
+        QuantizedBvh<uint8_t> m_quantized8;
+        // Lazy builds only, indexed by the offset of the leafs
+        std::vector<std::unique_ptr<LazySubtree>> m_lazy_subtrees;
         const MeshInstance* m_instance;
+        std::vector<uint32_t> m_primitives; // empty when the BVH covers the whole mesh
+        BvhBuildOptions m_options;
+        float m_build_sah_cost = 0.0f;
+        BvhStatistics m_statistics;
     };
 } // namespace shape
 } // namespace devs_out_of_bounds
\ No newline at end of file
@@ -0,0 +1,129 @@
+#pragma once
+#include <array>
+#include <src/Core.hpp>
+#include <vector>
+
+// Traversal counters only count on threads that enabled them (see TraversalCountingScope), other threads pay a thread
+// local flag test per visited node and tested leaf. Define this as 0 (JETWAVE_BVH_STATISTICS=OFF) to compile them
+// out of the traversal loops entirely.
+#ifndef DOOB_BVH_STATISTICS
+#define DOOB_BVH_STATISTICS 1
+#endif
+
+namespace devs_out_of_bounds {
+// Work done by the ray queries of the current thread, only ever grows. Diagnostics take the difference between two
+// snapshots to attribute work to the queries made in between.
+struct TraversalCounters {
+    uint64_t rays = 0;
+    uint64_t nodes_visited = 0;
+    uint64_t primitives_tested = 0;
+
+    DOOB_NODISCARD TraversalCounters operator-(const TraversalCounters& other) const {
+        return {
+            .rays = rays - other.rays,
+            .nodes_visited = nodes_visited - other.nodes_visited,
+            .primitives_tested = primitives_tested - other.primitives_tested,
+        };
+    }
+    TraversalCounters& operator+=(const TraversalCounters& other) {
+        rays += other.rays;
+        nodes_visited += other.nodes_visited;
+        primitives_tested += other.primitives_tested;
+        return *this;
+    }
+};
+inline thread_local TraversalCounters g_traversal_counters = {};
+inline thread_local bool g_b_traversal_counting = false;
+
+// Counts the traversal work of the current thread while alive, e.g. for the sample paths of a diagnostics pass
+class TraversalCountingScope : NoCopy, NoMove {
+public:
+    TraversalCountingScope() : m_b_was_counting(g_b_traversal_counting) { g_b_traversal_counting = true; }
+    ~TraversalCountingScope() { g_b_traversal_counting = m_b_was_counting; }
+
+private:
+    bool m_b_was_counting;
+};
+
+#if DOOB_BVH_STATISTICS
+#define DOOB_COUNT_RAYS(n)                                                                                             \
+    (::devs_out_of_bounds::g_b_traversal_counting ? (void)(::devs_out_of_bounds::g_traversal_counters.rays += (n))    \
+                                                  : (void)0)
+#define DOOB_COUNT_NODE_VISIT()                                                                                        \
+    (::devs_out_of_bounds::g_b_traversal_counting                                                                      \
+            ? (void)(++::devs_out_of_bounds::g_traversal_counters.nodes_visited)                                       \
+            : (void)0)
+#define DOOB_COUNT_PRIMITIVE_TESTS(n)                                                                                  \
+    (::devs_out_of_bounds::g_b_traversal_counting                                                                      \
+            ? (void)(::devs_out_of_bounds::g_traversal_counters.primitives_tested += (n))                              \
+            : (void)0)
+#else
+#define DOOB_COUNT_RAYS(n) ((void)0)
+#define DOOB_COUNT_NODE_VISIT() ((void)0)
+#define DOOB_COUNT_PRIMITIVE_TESTS(n) ((void)0)
+#endif
+
+namespace shape {
+    // Shape of a built BVH, see BVH::GetStatistics. Quantized trees are measured on the full precision nodes they
+    // were compressed from, lazy trees only up to their deferred subtrees.
+    struct BvhStatistics {
+        // Leafs with more primitives than this share the last bucket
+        static constexpr size_t MAX_LEAF_SIZE_BUCKET = 16;
+
+        uint32_t node_count = 0;
+        uint32_t leaf_count = 0;
+        uint32_t lazy_subtree_count = 0;
+        // References from leafs, larger than the triangle count when spatial splits duplicated triangles
+        uint64_t primitive_references = 0;
+
+        std::array<uint32_t, MAX_LEAF_SIZE_BUCKET + 1> leaf_size_histogram = {};
+        std::vector<uint32_t> leaf_depth_histogram = {};
+        uint32_t min_leaf_depth = 0;
+        uint32_t max_leaf_depth = 0;
+        double average_leaf_depth = 0.0;
+
+        // Expected cost of a ray hitting the root, relative to a single triangle test
+        float sah_cost = 0.0f;
+        // Summed surface area of the overlap between sibling boxes, relative to the root. Rays through an overlap
+        // have to visit both siblings, so lower is better.
+        float sibling_overlap = 0.0f;
+
+        size_t node_bytes = 0;
+        size_t primitive_bytes = 0;
+
+        DOOB_NODISCARD double AverageLeafSize() const {
+            return leaf_count > 0 ? static_cast<double>(primitive_references) / leaf_count : 0.0;
+        }
+
+        // Accumulates the counts of another tree, e.g. for scene wide totals. Costs and overlap are not additive and
+        // are left as they are.
+        void Merge(const BvhStatistics& other) {
+            const uint32_t merged_leafs = leaf_count + other.leaf_count;
+            if (merged_leafs > 0) {
+                average_leaf_depth =
+                    (average_leaf_depth * leaf_count + other.average_leaf_depth * other.leaf_count) / merged_leafs;
+            }
+            min_leaf_depth = leaf_count == 0 ? other.min_leaf_depth
+                             : other.leaf_count == 0 ? min_leaf_depth
+                                                     : glm::min(min_leaf_depth, other.min_leaf_depth);
+            max_leaf_depth = glm::max(max_leaf_depth, other.max_leaf_depth);
+
+            node_count += other.node_count;
+            leaf_count = merged_leafs;
+            lazy_subtree_count += other.lazy_subtree_count;
+            primitive_references += other.primitive_references;
+            for (size_t i = 0; i < leaf_size_histogram.size(); ++i) {
+                leaf_size_histogram[i] += other.leaf_size_histogram[i];
+            }
+            if (leaf_depth_histogram.size() < other.leaf_depth_histogram.size()) {
+                leaf_depth_histogram.resize(other.leaf_depth_histogram.size(), 0);
+            }
+            for (size_t i = 0; i < other.leaf_depth_histogram.size(); ++i) {
+                leaf_depth_histogram[i] += other.leaf_depth_histogram[i];
+            }
+            node_bytes += other.node_bytes;
+            primitive_bytes += other.primitive_bytes;
+        }
+    };
+} // namespace shape
+} // namespace devs_out_of_bounds
@@ -0,0 +1,117 @@
+#pragma once
+#include <src/Graphics/IShape.hpp>
+
+namespace devs_out_of_bounds {
+namespace shape {
+    // Places an object space shape (usually a mesh BVH shared by many instances) in the world. Rays are moved into
+    // object space instead of baking a world space copy of the geometry per instance.
+    class Instance : public IShape {
+    public:
+        Instance(const IShape* shape, const glm::mat4& object_to_world) : m_shape(shape) {
+            SetTransform(object_to_world);
+        }
+
+        // Moves the instance without touching the shared shape, only the top level tree has to be refit afterwards.
+        // Also refreshes the bounds after the shared shape was refit. Must not run while the instance is traversed.
+        void SetTransform(const glm::mat4& object_to_world) {
+            m_object_to_world = object_to_world;
+            m_world_to_object = glm::inverse(object_to_world);
+            m_normal_to_world = glm::inverse(glm::transpose(glm::mat3(object_to_world)));
+            m_normal_to_object = glm::transpose(glm::mat3(object_to_world));
+            // Mirroring transforms flip the winding of the geometry, see Intersect
+            m_b_mirrored = glm::determinant(glm::mat3(object_to_world)) < 0.0f;
+
+            const AABB local_aabb = m_shape->GetAABB();
+            m_aabb = AABB::Empty();
+            for (int i = 0; i < 8; ++i) {
+                const glm::vec3 corner = {
+                    (i & 1) ? local_aabb.max.x : local_aabb.min.x,
+                    (i & 2) ? local_aabb.max.y : local_aabb.min.y,
+                    (i & 4) ? local_aabb.max.z : local_aabb.min.z,
+                };
+                m_aabb.Grow(glm::vec3(object_to_world * glm::vec4(corner, 1.0f)));
+            }
+        }
+
+        DOOB_NODISCARD bool Intersect(const Ray& ray, Intersection* out_intersection) const override {
+            if (!m_shape->Intersect(ToObject(ray), out_intersection)) {
+                return false;
+            }
+            if (out_intersection) {
+                out_intersection->position = ray.origin + ray.direction * out_intersection->t;
+                out_intersection->flat_normal = glm::normalize(m_normal_to_world * out_intersection->flat_normal);
+                // Match a world space copy of the geometry, whose triangle normals flip along with the winding
+                if (m_b_mirrored) {
+                    out_intersection->b_front_facing = out_intersection->b_front_facing ? 0 : 1;
+                }
+            }
+            return true;
+        }
+
+        DOOB_NODISCARD bool Occluded(const Ray& ray) const override { return m_shape->Occluded(ToObject(ray)); }
+
+        // Rays are moved into object space together, so shared geometry keeps its packet traversal
+        DOOB_NODISCARD uint32_t IntersectPacket(RayPacket& packet, Intersection* out_intersections) const override {
+            Ray local_rays[RayPacket::SIZE];
+            ForEachRay(packet.active_mask, [&](uint32_t i) { local_rays[i] = ToObject(packet.rays[i]); });
+            RayPacket local_packet;
+            local_packet.Init(local_rays, packet.active_mask);
+
+            Intersection local_intersections[RayPacket::SIZE];
+            const uint32_t hit_mask = m_shape->IntersectPacket(local_packet, local_intersections);
+            ForEachRay(hit_mask, [&](uint32_t i) {
+                Intersection& hit = out_intersections[i];
+                hit = local_intersections[i];
+                hit.position = packet.rays[i].origin + packet.rays[i].direction * hit.t;
+                hit.flat_normal = glm::normalize(m_normal_to_world * hit.flat_normal);
+                if (m_b_mirrored) {
+                    hit.b_front_facing = hit.b_front_facing ? 0 : 1;
+                }
+                packet.SetTMax(i, hit.t);
+            });
+            return hit_mask;
+        }
+
+        DOOB_NODISCARD Fragment SampleFragment(const Intersection& intersection) const override {
+            Intersection local_intersection = intersection;
+            local_intersection.position = glm::vec3(m_world_to_object * glm::vec4(intersection.position, 1.0f));
+            local_intersection.flat_normal = glm::normalize(m_normal_to_object * intersection.flat_normal);
+            if (m_b_mirrored) {
+                local_intersection.b_front_facing = intersection.b_front_facing ? 0 : 1;
+            }
+
+            Fragment fragment = m_shape->SampleFragment(local_intersection);
+            fragment.position = intersection.position;
+            fragment.flat_normal = intersection.flat_normal;
+            fragment.b_front_face = intersection.b_front_facing != 0;
+            fragment.normal = m_normal_to_world * fragment.normal;
+            fragment.tangent = m_normal_to_world * fragment.tangent;
+            return fragment;
+        }
+
+        DOOB_NODISCARD AABB GetAABB() const override { return m_aabb; }
+
+        DOOB_NODISCARD const IShape* GetShape() const { return m_shape; }
+        DOOB_NODISCARD const glm::mat4& GetObjectToWorld() const { return m_object_to_world; }
+
+    private:
+        // The direction is not renormalized, so distances along the ray are the same in both spaces
+        DOOB_NODISCARD Ray ToObject(const Ray& ray) const {
+            return {
+                .origin = glm::vec3(m_world_to_object * glm::vec4(ray.origin, 1.0f)),
+                .t_min = ray.t_min,
+                .direction = glm::mat3(m_world_to_object) * ray.direction,
+                .t_max = ray.t_max,
+            };
+        }
+
+        const IShape* m_shape;
+        glm::mat4 m_object_to_world;
+        glm::mat4 m_world_to_object;
+        glm::mat3 m_normal_to_world;
+        glm::mat3 m_normal_to_object;
+        AABB m_aabb;
+        bool m_b_mirrored;
+    };
+} // namespace shape
+} // namespace devs_out_of_bounds
\ No newline at end of file
@@ -0,0 +1,404 @@
+#pragma once
+
+#include <bit>
+#include <limits>
+#include <src/Core.hpp>
+#include <src/Graphics/AABB.hpp>
+#include <src/Graphics/Shapes/WideBVH.hpp>
+#include <type_traits>
+#include <vector>
+
+namespace devs_out_of_bounds {
+namespace shape {
+    // Maps boxes inside a frame box to TQuant grid coordinates, a box decodes to origin + q * scale. Boxes are
+    // rounded outwards, so a decoded box always contains the box it was encoded from.
+    template <typename TQuant>
+    struct Quantizer {
+        static_assert(std::is_unsigned_v<TQuant>, "Quantized coordinates must be unsigned integers!");
+        static constexpr uint32_t QMAX = std::numeric_limits<TQuant>::max();
+
+        // Deterministic, so the traversal can rebuild the quantizer of a node from its decoded box
+        explicit Quantizer(const AABB& frame) : origin(frame.min) {
+            // Pad the grid by a few ulps of the coordinates, so origin + QMAX * scale stays above frame.max however
+            // the decode rounds (e.g. fused multiply add)
+            const glm::vec3 slack = (glm::abs(frame.min) + glm::abs(frame.max)) * (1.0f / (1 << 20));
+            scale = (frame.Extent() + slack) * (1.0f + 1.0f / 1024.0f) / static_cast<float>(QMAX);
+            scale = glm::max(scale, glm::vec3(std::numeric_limits<float>::min()));
+        }
+        Quantizer(const glm::vec3& origin, const glm::vec3& scale) : origin(origin), scale(scale) {}
+
+        void Encode(const AABB& aabb, TQuant* out_min, TQuant* out_max) const {
+            const glm::vec3 inv_scale = 1.0f / scale;
+            for (int axis = 0; axis < 3; ++axis) {
+                const float slack =
+                    (std::abs(aabb.min[axis]) + std::abs(origin[axis])) * 4.0f * std::numeric_limits<float>::epsilon();
+                float q = glm::clamp(std::floor((aabb.min[axis] - origin[axis]) * inv_scale[axis]), 0.0f,
+                    static_cast<float>(QMAX));
+                while (q > 0.0f && Decode(axis, q) > aabb.min[axis] - slack) {
+                    q -= 1.0f;
+                }
+                out_min[axis] = static_cast<TQuant>(q);
+            }
+            for (int axis = 0; axis < 3; ++axis) {
+                const float slack =
+                    (std::abs(aabb.max[axis]) + std::abs(origin[axis])) * 4.0f * std::numeric_limits<float>::epsilon();
+                float q = glm::clamp(std::ceil((aabb.max[axis] - origin[axis]) * inv_scale[axis]), 0.0f,
+                    static_cast<float>(QMAX));
+                while (q < static_cast<float>(QMAX) && Decode(axis, q) < aabb.max[axis] + slack) {
+                    q += 1.0f;
+                }
+                out_max[axis] = static_cast<TQuant>(q);
+            }
+        }
+
+        DOOB_NODISCARD DOOB_FORCEINLINE float Decode(int axis, float q) const { return origin[axis] + q * scale[axis]; }
+        DOOB_NODISCARD DOOB_FORCEINLINE AABB Decode(const TQuant* q_min, const TQuant* q_max) const {
+            return {
+                .min = origin + glm::vec3(q_min[0], q_min[1], q_min[2]) * scale,
+                .max = origin + glm::vec3(q_max[0], q_max[1], q_max[2]) * scale,
+            };
+        }
+
+        glm::vec3 origin;
+        glm::vec3 scale;
+    };
+
+    // Wide node whose child bounds are stored relative to the box of the node itself
+    template <int WIDTH, typename TQuant>
+    struct alignas(32) QuantizedWideBvhNode {
+        static constexpr uint32_t LEAF_FLAG = 0x80000000U;
+        static constexpr uint32_t EMPTY = 0xFFFFFFFFU;
+
+        glm::vec3 origin;
+        glm::vec3 scale;
+        TQuant min_x[WIDTH];
+        TQuant min_y[WIDTH];
+        TQuant min_z[WIDTH];
+        TQuant max_x[WIDTH];
+        TQuant max_y[WIDTH];
+        TQuant max_z[WIDTH];
+        uint32_t child[WIDTH]; // interior: wide node index, leaf: LEAF_FLAG | leaf id, unused: EMPTY
+
+        void SetFrame(const AABB& aabb) {
+            const Quantizer<TQuant> quantizer(aabb);
+            origin = quantizer.origin;
+            scale = quantizer.scale;
+        }
+        void SetChild(int slot, const AABB& aabb, uint32_t child_index) {
+            TQuant q_min[3], q_max[3];
+            Quantizer<TQuant>(origin, scale).Encode(aabb, q_min, q_max);
+            min_x[slot] = q_min[0];
+            min_y[slot] = q_min[1];
+            min_z[slot] = q_min[2];
+            max_x[slot] = q_max[0];
+            max_y[slot] = q_max[1];
+            max_z[slot] = q_max[2];
+            child[slot] = child_index;
+        }
+        // Decodes to an inverted box, which never passes the slab test
+        void SetEmpty(int slot) {
+            min_x[slot] = min_y[slot] = min_z[slot] = static_cast<TQuant>(Quantizer<TQuant>::QMAX);
+            max_x[slot] = max_y[slot] = max_z[slot] = 0;
+            child[slot] = EMPTY;
+        }
+
+        DOOB_NODISCARD DOOB_FORCEINLINE const WideBvhBounds<WIDTH>& Decode(WideBvhBounds<WIDTH>& out) const {
+            for (int i = 0; i < WIDTH; ++i) {
+                out.min_x[i] = origin.x + static_cast<float>(min_x[i]) * scale.x;
+                out.min_y[i] = origin.y + static_cast<float>(min_y[i]) * scale.y;
+                out.min_z[i] = origin.z + static_cast<float>(min_z[i]) * scale.z;
+                out.max_x[i] = origin.x + static_cast<float>(max_x[i]) * scale.x;
+                out.max_y[i] = origin.y + static_cast<float>(max_y[i]) * scale.y;
+                out.max_z[i] = origin.z + static_cast<float>(max_z[i]) * scale.z;
+            }
+            return out;
+        }
+    };
+
+    // Binary node storing the bounds of both children relative to its own box. The box of a node is not stored,
+    // traversal decodes it from the parent, starting at the full precision root bounds.
+    template <typename TQuant>
+    struct QuantizedBvhNode {
+        static constexpr uint32_t LEAF_FLAG = 0x80000000U;
+
+        TQuant child_min[2][3];
+        TQuant child_max[2][3];
+        uint32_t child[2]; // interior: node index, leaf: LEAF_FLAG | leaf id
+    };
+
+    // Compressed copy of a built shape::BVH, for meshes whose full precision nodes take too much memory. Leafs
+    // are referenced through a table of triangle ranges, the triangles stay with the BVH. Only the layout of the
+    // compiled in kernel is built: wide nodes when DOOB_BVH_WIDTH > 0, binary nodes otherwise. x86 targets always
+    // have a wide kernel, the binary nodes are exercised there by bvh_node_bench_binary.
+    template <typename TQuant>
+    class QuantizedBvh {
+    public:
+        using Node = QuantizedBvhNode<TQuant>;
+        static constexpr uint32_t LEAF_FLAG = Node::LEAF_FLAG;
+        static constexpr size_t MAX_STACK_SIZE = BVH_MAX_DEPTH + 1;
+
+        struct Leaf {
+            uint32_t offset = 0;
+            uint32_t primitive_count = 0;
+        };
+
+        template <typename TBinaryNodes>
+        void Build(const TBinaryNodes& binary_nodes) {
+#if DOOB_BVH_WIDTH == 0
+            m_nodes.clear();
+#endif
+            m_leaves.clear();
+            m_aabb = binary_nodes.empty() ? AABB{} : binary_nodes[0].aabb;
+            if (binary_nodes.empty()) {
+                return;
+            }
+
+            // Leaf ids follow the order of the binary nodes, so leafs close in the node array stay close in the table
+            std::vector<uint32_t> leaf_ids(binary_nodes.size(), 0);
+            for (size_t i = 0; i < binary_nodes.size(); ++i) {
+                if (binary_nodes[i].IsLeaf()) {
+                    leaf_ids[i] = static_cast<uint32_t>(m_leaves.size());
+                    m_leaves.push_back({ binary_nodes[i].offset, binary_nodes[i].primitive_count });
+                }
+            }
+
+#if DOOB_BVH_WIDTH > 0
+            m_wide.Build(binary_nodes, [&](uint32_t binary_index) { return leaf_ids[binary_index]; });
+#else
+            if (binary_nodes[0].IsLeaf()) {
+                m_root = LEAF_FLAG | leaf_ids[0];
+            } else {
+                m_nodes.reserve(binary_nodes.size() / 2);
+                m_root = EncodeRecursive(binary_nodes, leaf_ids, 0, m_aabb);
+            }
+            m_nodes.shrink_to_fit();
+#endif
+        }
+
+        DOOB_NODISCARD const Leaf& GetLeaf(uint32_t leaf_id) const { return m_leaves[leaf_id]; }
+        DOOB_NODISCARD const AABB& GetAABB() const { return m_aabb; }
+        DOOB_NODISCARD bool IsEmpty() const { return m_leaves.empty(); }
+        DOOB_NODISCARD size_t GetMemoryUsage() const {
+#if DOOB_BVH_WIDTH > 0
+            const size_t node_bytes = m_wide.GetNodeCount() * sizeof(typename WideBvh<DOOB_BVH_WIDTH, WideNode>::Node);
+#else
+            const size_t node_bytes = m_nodes.size() * sizeof(Node);
+#endif
+            return node_bytes + m_leaves.size() * sizeof(Leaf);
+        }
+
+        // Closest hit, fn(leaf_id, ray) tests a leaf, shortening ray.t_max on a hit, and returns whether it hit
+        template <typename TLeafFn>
+        bool Traverse(Ray& ray, uint32_t& num_visited, TLeafFn&& fn) const {
+#if DOOB_BVH_WIDTH > 0
+            return m_wide.Traverse(ray, num_visited, fn);
+#else
+            return TraverseBinary(ray, num_visited, fn);
+#endif
+        }
+
+        // Any hit, fn(leaf_id) returns true when the leaf blocks the ray which ends the query
+        template <typename TLeafFn>
+        bool TraverseAny(const Ray& ray, TLeafFn&& fn) const {
+#if DOOB_BVH_WIDTH > 0
+            return m_wide.TraverseAny(ray, fn);
+#else
+            return TraverseAnyBinary(ray, fn);
+#endif
+        }
+
+        // Packet traversal, fn(leaf_id, ray_mask) tests a leaf for the rays in ray_mask and shortens the t_max of
+        // the rays it hits
+        template <typename TLeafFn>
+        void TraversePacket(RayPacket& packet, TLeafFn&& fn) const {
+#if DOOB_BVH_WIDTH > 0
+            m_wide.TraversePacket(packet, fn);
+#else
+            TraversePacketBinary(packet, fn);
+#endif
+        }
+
+#if DOOB_BVH_WIDTH == 0
+        template <typename TLeafFn>
+        bool TraverseBinary(Ray& ray, uint32_t& num_visited, TLeafFn&& fn) const {
+            if (IsEmpty()) {
+                return false;
+            }
+            const PrecomputedRay query(ray);
+            float root_t_entry;
+            if (!m_aabb.RayIntersects(query, ray.t_min, ray.t_max, &root_t_entry)) {
+                return false;
+            }
+
+            struct StackEntry {
+                uint32_t child;
+                float t_entry;
+                AABB aabb; // decoded box of child, the frame of its children
+            };
+            StackEntry stack[MAX_STACK_SIZE];
+            size_t stack_ptr = 0;
+            stack[stack_ptr++] = { m_root, root_t_entry, m_aabb };
+
+            bool b_hit = false;
+            while (stack_ptr > 0) {
+                const StackEntry entry = stack[--stack_ptr];
+                // A closer hit may have been found since this child was pushed
+                if (entry.t_entry > ray.t_max) {
+                    continue;
+                }
+                if (entry.child & LEAF_FLAG) {
+                    b_hit |= fn(entry.child & ~LEAF_FLAG, ray);
+                    continue;
+                }
+
+                const Node& node = m_nodes[entry.child];
+                ++num_visited;
+                DOOB_COUNT_NODE_VISIT();
+                const Quantizer<TQuant> quantizer(entry.aabb);
+                StackEntry children[2];
+                bool b_hit_child[2];
+                for (int i = 0; i < 2; ++i) {
+                    children[i].child = node.child[i];
+                    children[i].aabb = quantizer.Decode(node.child_min[i], node.child_max[i]);
+                    b_hit_child[i] =
+                        children[i].aabb.RayIntersects(query, ray.t_min, ray.t_max, &children[i].t_entry);
+                }
+
+                // Push the far child first, so the near one is popped next
+                assert(stack_ptr + 2 <= MAX_STACK_SIZE);
+                const int near = b_hit_child[0] && b_hit_child[1] && children[1].t_entry < children[0].t_entry ? 1 : 0;
+                if (b_hit_child[1 - near]) {
+                    stack[stack_ptr++] = children[1 - near];
+                }
+                if (b_hit_child[near]) {
+                    stack[stack_ptr++] = children[near];
+                }
+            }
+            return b_hit;
+        }
+
+        template <typename TLeafFn>
+        bool TraverseAnyBinary(const Ray& ray, TLeafFn&& fn) const {
+            if (IsEmpty()) {
+                return false;
+            }
+            const PrecomputedRay query(ray);
+            float t_entry;
+            if (!m_aabb.RayIntersects(query, ray.t_min, ray.t_max, &t_entry)) {
+                return false;
+            }
+
+            struct StackEntry {
+                uint32_t child;
+                AABB aabb;
+            };
+            StackEntry stack[MAX_STACK_SIZE];
+            size_t stack_ptr = 0;
+            stack[stack_ptr++] = { m_root, m_aabb };
+
+            while (stack_ptr > 0) {
+                const StackEntry entry = stack[--stack_ptr];
+                if (entry.child & LEAF_FLAG) {
+                    if (fn(entry.child & ~LEAF_FLAG)) {
+                        return true;
+                    }
+                    continue;
+                }
+                const Node& node = m_nodes[entry.child];
+                DOOB_COUNT_NODE_VISIT();
+                const Quantizer<TQuant> quantizer(entry.aabb);
+                for (int i = 0; i < 2; ++i) {
+                    const AABB child_aabb = quantizer.Decode(node.child_min[i], node.child_max[i]);
+                    if (child_aabb.RayIntersects(query, ray.t_min, ray.t_max, &t_entry)) {
+                        assert(stack_ptr < MAX_STACK_SIZE);
+                        stack[stack_ptr++] = { node.child[i], child_aabb };
+                    }
+                }
+            }
+            return false;
+        }
+
+        template <typename TLeafFn>
+        void TraversePacketBinary(RayPacket& packet, TLeafFn&& fn) const {
+            if (IsEmpty() || packet.active_mask == 0) {
+                return;
+            }
+            const glm::vec3 direction = packet.rays[std::countr_zero(packet.active_mask)].direction;
+
+            struct StackEntry {
+                uint32_t child;
+                AABB aabb; // decoded box of child, the frame of its children
+            };
+            StackEntry stack[MAX_STACK_SIZE];
+            size_t stack_ptr = 0;
+            stack[stack_ptr++] = { m_root, m_aabb };
+
+            while (stack_ptr > 0) {
+                const StackEntry entry = stack[--stack_ptr];
+                // Rays may have found closer hits since this child was pushed
+                const uint32_t ray_mask = packet.Cull(entry.aabb);
+                if (ray_mask == 0) {
+                    continue;
+                }
+                if (entry.child & LEAF_FLAG) {
+                    fn(entry.child & ~LEAF_FLAG, ray_mask);
+                    continue;
+                }
+
+                const Node& node = m_nodes[entry.child];
+                DOOB_COUNT_NODE_VISIT();
+                const Quantizer<TQuant> quantizer(entry.aabb);
+                StackEntry children[2];
+                for (int i = 0; i < 2; ++i) {
+                    children[i] = { node.child[i], quantizer.Decode(node.child_min[i], node.child_max[i]) };
+                }
+                // Push the far child first, so the near one is popped next
+                const glm::vec3 separation = children[1].aabb.Centroid() - children[0].aabb.Centroid();
+                const int near = glm::dot(separation, direction) < 0.0f ? 1 : 0;
+                assert(stack_ptr + 2 <= MAX_STACK_SIZE);
+                stack[stack_ptr++] = children[1 - near];
+                stack[stack_ptr++] = children[near];
+            }
+        }
+#endif
+
+    private:
+#if DOOB_BVH_WIDTH == 0
+        // Children are encoded relative to the decoded box of their parent, which is what the traversal sees
+        template <typename TBinaryNodes>
+        uint32_t EncodeRecursive(const TBinaryNodes& binary_nodes, const std::vector<uint32_t>& leaf_ids,
+            uint32_t binary_index, const AABB& decoded_aabb) {
+            const uint32_t node_index = static_cast<uint32_t>(m_nodes.size());
+            m_nodes.emplace_back();
+
+            const Quantizer<TQuant> quantizer(decoded_aabb);
+            const auto& binary_node = binary_nodes[binary_index];
+            const uint32_t binary_children[2] = { binary_node.Left(), binary_node.Right() };
+            for (int i = 0; i < 2; ++i) {
+                const auto& binary_child = binary_nodes[binary_children[i]];
+                Node& node = m_nodes[node_index];
+                quantizer.Encode(binary_child.aabb, node.child_min[i], node.child_max[i]);
+                if (binary_child.IsLeaf()) {
+                    node.child[i] = LEAF_FLAG | leaf_ids[binary_children[i]];
+                    continue;
+                }
+                const AABB child_aabb = quantizer.Decode(node.child_min[i], node.child_max[i]);
+                const uint32_t child = EncodeRecursive(binary_nodes, leaf_ids, binary_children[i], child_aabb);
+                m_nodes[node_index].child[i] = child;
+            }
+            return node_index;
+        }
+#endif
+
+#if DOOB_BVH_WIDTH > 0
+        using WideNode = QuantizedWideBvhNode<DOOB_BVH_WIDTH, TQuant>;
+        WideBvh<DOOB_BVH_WIDTH, WideNode> m_wide;
+#else
+        std::vector<Node> m_nodes;
+        uint32_t m_root = 0;
+#endif
+        std::vector<Leaf> m_leaves;
+        AABB m_aabb = {};
+    };
+} // namespace shape
+} // namespace devs_out_of_bounds
\ No newline at end of file
@@ -0,0 +1,400 @@
+#pragma once
+
+#include <bit>
+#include <src/Core.hpp>
+#include <src/Graphics/AABB.hpp>
+#include <src/Graphics/RayPacket.hpp>
+#include <src/Graphics/Shapes/BvhStatistics.hpp>
+#include <vector>
+
+#if defined(DOOB_SIMD_SSE)
+#include <immintrin.h>
+#endif
+
+// Widest node the target can test in a single SIMD pass, 0 disables the wide BVH. Can be defined as 0 up front to
+// build the binary kernels on a SIMD target, e.g. the bvh_node_bench_binary benchmark.
+#ifndef DOOB_BVH_WIDTH
+#if defined(DOOB_SIMD_AVX2)
+#define DOOB_BVH_WIDTH 8
+#elif defined(DOOB_SIMD_SSE)
+#define DOOB_BVH_WIDTH 4
+#else
+#define DOOB_BVH_WIDTH 0
+#endif
+#endif
+
+namespace devs_out_of_bounds {
+namespace shape {
+    // Deepest binary tree shape::BVH builds (BVH::MAX_DEPTH), the traversal stacks of all its node formats are sized
+    // from it
+    inline constexpr size_t BVH_MAX_DEPTH = 32;
+
+    // SoA child bounds of a wide node, the layout the traversal kernels test all children of a node from
+    template <int WIDTH>
+    struct alignas(32) WideBvhBounds {
+        float min_x[WIDTH];
+        float min_y[WIDTH];
+        float min_z[WIDTH];
+        float max_x[WIDTH];
+        float max_y[WIDTH];
+        float max_z[WIDTH];
+    };
+
+    // Full precision node, the child bounds are stored SoA so all children of a node are slab tested at once
+    template <int WIDTH>
+    struct alignas(32) WideBvhNode : WideBvhBounds<WIDTH> {
+        static constexpr uint32_t LEAF_FLAG = 0x80000000U;
+        static constexpr uint32_t EMPTY = 0xFFFFFFFFU;
+
+        uint32_t child[WIDTH]; // interior: wide node index, leaf: LEAF_FLAG | leaf id, unused: EMPTY
+
+        // Called with the bounds of the node itself before its children are set, nodes storing child bounds
+        // relative to their own box use it, full precision nodes do not need it
+        void SetFrame(const AABB&) {}
+        void SetChild(int slot, const AABB& aabb, uint32_t child_index) {
+            this->min_x[slot] = aabb.min.x;
+            this->min_y[slot] = aabb.min.y;
+            this->min_z[slot] = aabb.min.z;
+            this->max_x[slot] = aabb.max.x;
+            this->max_y[slot] = aabb.max.y;
+            this->max_z[slot] = aabb.max.z;
+            child[slot] = child_index;
+        }
+        // Inverted bounds never pass the slab test
+        void SetEmpty(int slot) { SetChild(slot, AABB::Empty(), EMPTY); }
+
+        // Compressed nodes decode into scratch, full precision nodes already are in the traversal layout
+        DOOB_NODISCARD DOOB_FORCEINLINE const WideBvhBounds<WIDTH>& Decode(WideBvhBounds<WIDTH>&) const {
+            return *this;
+        }
+    };
+
+    // N-ary BVH collapsed from the binary shape::BVH node array, shares its leafs. TNode is WideBvhNode or a
+    // compressed node with the same interface.
+    template <int WIDTH, typename TNode = WideBvhNode<WIDTH>>
+    class WideBvh {
+    public:
+        using Node = TNode;
+
+        // Depth of the wide tree never exceeds the binary one, every wide node may defer WIDTH - 1 children
+        static constexpr size_t MAX_STACK_SIZE = BVH_MAX_DEPTH * (WIDTH - 1) + 1;
+
+        // Leafs are referenced by their binary node index
+        template <typename TBinaryNodes>
+        void Build(const TBinaryNodes& binary_nodes) {
+            Build(binary_nodes, [](uint32_t binary_index) { return binary_index; });
+        }
+
+        // leaf_id(binary_index) returns the id leafs are referenced by, which is passed to the traversal callbacks
+        template <typename TBinaryNodes, typename TLeafIdFn>
+        void Build(const TBinaryNodes& binary_nodes, TLeafIdFn&& leaf_id) {
+            m_nodes.clear();
+            if (binary_nodes.empty()) {
+                return;
+            }
+            m_nodes.reserve(binary_nodes.size() / 2 + 1);
+            m_nodes.emplace_back();
+            m_nodes[0].SetFrame(binary_nodes[0].aabb);
+            if (binary_nodes[0].IsLeaf()) {
+                m_nodes[0].SetChild(0, binary_nodes[0].aabb, Node::LEAF_FLAG | leaf_id(0U));
+                for (int i = 1; i < WIDTH; ++i) {
+                    m_nodes[0].SetEmpty(i);
+                }
+                return;
+            }
+            CollapseRecursive(binary_nodes, 0, 0, leaf_id);
+        }
+
+        // fn(leaf_id, ray) tests a leaf, shortening ray.t_max on a hit, and returns whether it hit
+        template <typename TLeafFn>
+        bool Traverse(Ray& ray, uint32_t& num_visited, TLeafFn&& fn) const {
+            if (m_nodes.empty()) {
+                return false;
+            }
+            const PrecomputedRay query(ray);
+
+            struct StackEntry {
+                uint32_t child;
+                float t_entry;
+            };
+            StackEntry stack[MAX_STACK_SIZE];
+            size_t stack_ptr = 0;
+            stack[stack_ptr++] = { 0, ray.t_min };
+
+            bool b_hit = false;
+            while (stack_ptr > 0) {
+                const StackEntry entry = stack[--stack_ptr];
+                // A closer hit may have been found since this child was pushed
+                if (entry.t_entry > ray.t_max) {
+                    continue;
+                }
+                if (entry.child & Node::LEAF_FLAG) {
+                    b_hit |= fn(entry.child & ~Node::LEAF_FLAG, ray);
+                    continue;
+                }
+
+                const Node& node = m_nodes[entry.child];
+                ++num_visited;
+                DOOB_COUNT_NODE_VISIT();
+
+                alignas(32) float t_entry[WIDTH];
+                uint32_t hit_mask = IntersectChildren(node, query, ray.t_min, ray.t_max, t_entry);
+
+                // Push hit children sorted far to near, so the nearest one is popped first
+                const size_t first = stack_ptr;
+                while (hit_mask) {
+                    const int slot = std::countr_zero(hit_mask);
+                    hit_mask &= hit_mask - 1;
+
+                    const StackEntry child_entry = { node.child[slot], t_entry[slot] };
+                    size_t i = stack_ptr++;
+                    assert(stack_ptr <= MAX_STACK_SIZE);
+                    while (i > first && stack[i - 1].t_entry < child_entry.t_entry) {
+                        stack[i] = stack[i - 1];
+                        --i;
+                    }
+                    stack[i] = child_entry;
+                }
+            }
+            return b_hit;
+        }
+
+        // Any hit traversal, fn(leaf_id) returns true when the leaf blocks the ray which ends the query.
+        // Children are visited in slot order as there is no closest hit to converge to.
+        template <typename TLeafFn>
+        bool TraverseAny(const Ray& ray, TLeafFn&& fn) const {
+            if (m_nodes.empty()) {
+                return false;
+            }
+            const PrecomputedRay query(ray);
+
+            uint32_t stack[MAX_STACK_SIZE];
+            size_t stack_ptr = 0;
+            stack[stack_ptr++] = 0;
+
+            while (stack_ptr > 0) {
+                const uint32_t child = stack[--stack_ptr];
+                if (child & Node::LEAF_FLAG) {
+                    if (fn(child & ~Node::LEAF_FLAG)) {
+                        return true;
+                    }
+                    continue;
+                }
+
+                const Node& node = m_nodes[child];
+                DOOB_COUNT_NODE_VISIT();
+                alignas(32) float t_entry[WIDTH];
+                uint32_t hit_mask = IntersectChildren(node, query, ray.t_min, ray.t_max, t_entry);
+                while (hit_mask) {
+                    const int slot = std::countr_zero(hit_mask);
+                    hit_mask &= hit_mask - 1;
+                    assert(stack_ptr < MAX_STACK_SIZE);
+                    stack[stack_ptr++] = node.child[slot];
+                }
+            }
+            return false;
+        }
+
+        // Packet traversal, every node is fetched once for all rays that may still hit one of its children.
+        // fn(leaf_id, ray_mask) tests a leaf for the rays in ray_mask and shortens the t_max of the rays it hits.
+        // Children are visited front to back along the first active ray, which coherent packets share.
+        template <typename TLeafFn>
+        void TraversePacket(RayPacket& packet, TLeafFn&& fn) const {
+            if (m_nodes.empty() || packet.active_mask == 0) {
+                return;
+            }
+            const glm::vec3 direction = packet.rays[std::countr_zero(packet.active_mask)].direction;
+
+            // Child boxes are kept with the entry, rays may have found closer hits by the time it is popped
+            struct StackEntry {
+                uint32_t child;
+                AABB aabb;
+                float distance; // along direction, only used to sort siblings
+            };
+            StackEntry stack[MAX_STACK_SIZE];
+            size_t stack_ptr = 0;
+
+            uint32_t node_index = 0;
+            for (;;) {
+                const Node& node = m_nodes[node_index];
+                DOOB_COUNT_NODE_VISIT();
+                WideBvhBounds<WIDTH> scratch;
+                const WideBvhBounds<WIDTH>& bounds = node.Decode(scratch);
+
+                // Push the children far to near, so the nearest one is popped first
+                const size_t first = stack_ptr;
+                for (int slot = 0; slot < WIDTH; ++slot) {
+                    if (node.child[slot] == Node::EMPTY) {
+                        continue;
+                    }
+                    StackEntry child_entry;
+                    child_entry.child = node.child[slot];
+                    child_entry.aabb = {
+                        .min = { bounds.min_x[slot], bounds.min_y[slot], bounds.min_z[slot] },
+                        .max = { bounds.max_x[slot], bounds.max_y[slot], bounds.max_z[slot] },
+                    };
+                    child_entry.distance = glm::dot(child_entry.aabb.Centroid(), direction);
+                    size_t i = stack_ptr++;
+                    assert(stack_ptr <= MAX_STACK_SIZE);
+                    while (i > first && stack[i - 1].distance < child_entry.distance) {
+                        stack[i] = stack[i - 1];
+                        --i;
+                    }
+                    stack[i] = child_entry;
+                }
+
+                // Find the next interior node any ray may still reach, testing the leafs on the way
+                bool b_found = false;
+                while (stack_ptr > 0 && !b_found) {
+                    const StackEntry entry = stack[--stack_ptr];
+                    const uint32_t ray_mask = packet.Cull(entry.aabb);
+                    if (ray_mask == 0) {
+                        continue;
+                    }
+                    if (entry.child & Node::LEAF_FLAG) {
+                        fn(entry.child & ~Node::LEAF_FLAG, ray_mask);
+                        continue;
+                    }
+                    node_index = entry.child;
+                    b_found = true;
+                }
+                if (!b_found) {
+                    return;
+                }
+            }
+        }
+
+        DOOB_NODISCARD size_t GetNodeCount() const { return m_nodes.size(); }
+        DOOB_NODISCARD const std::vector<Node>& GetNodes() const { return m_nodes; }
+
+    private:
+        template <typename TBinaryNodes, typename TLeafIdFn>
+        void CollapseRecursive(
+            const TBinaryNodes& binary_nodes, uint32_t binary_index, uint32_t wide_index, TLeafIdFn& leaf_id) {
+            uint32_t children[WIDTH];
+            int count = 0;
+            children[count++] = binary_nodes[binary_index].Left();
+            children[count++] = binary_nodes[binary_index].Right();
+
+            // Keep opening the interior child with the largest surface area until the node is full
+            while (count < WIDTH) {
+                int best = -1;
+                float best_area = -1.0f;
+                for (int i = 0; i < count; ++i) {
+                    const auto& child = binary_nodes[children[i]];
+                    if (!child.IsLeaf() && child.aabb.SurfaceArea() > best_area) {
+                        best_area = child.aabb.SurfaceArea();
+                        best = i;
+                    }
+                }
+                if (best < 0) {
+                    break;
+                }
+                const uint32_t opened = children[best];
+                children[best] = binary_nodes[opened].Left();
+                children[count++] = binary_nodes[opened].Right();
+            }
+
+            uint32_t wide_children[WIDTH];
+            for (int i = 0; i < WIDTH; ++i) {
+                if (i >= count) {
+                    m_nodes[wide_index].SetEmpty(i);
+                    continue;
+                }
+                const auto& child = binary_nodes[children[i]];
+                if (child.IsLeaf()) {
+                    m_nodes[wide_index].SetChild(i, child.aabb, Node::LEAF_FLAG | leaf_id(children[i]));
+                } else {
+                    wide_children[i] = static_cast<uint32_t>(m_nodes.size());
+                    m_nodes.emplace_back();
+                    m_nodes.back().SetFrame(child.aabb);
+                    m_nodes[wide_index].SetChild(i, child.aabb, wide_children[i]);
+                }
+            }
+            for (int i = 0; i < count; ++i) {
+                if (!binary_nodes[children[i]].IsLeaf()) {
+                    CollapseRecursive(binary_nodes, children[i], wide_children[i], leaf_id);
+                }
+            }
+        }
+
+        // Returns a bitmask of the children whose box overlaps [t_min, t_max], and their entry distances
+        DOOB_NODISCARD static DOOB_FORCEINLINE uint32_t IntersectChildren(
+            const Node& node, const PrecomputedRay& ray, float t_min, float t_max, float* out_t_entry) {
+            WideBvhBounds<WIDTH> scratch;
+            const WideBvhBounds<WIDTH>& bounds = node.Decode(scratch);
+
+            // Entering through min or max only depends on the ray direction, so pick the planes once
+            const float* near_x = ray.sign[0] ? bounds.max_x : bounds.min_x;
+            const float* far_x = ray.sign[0] ? bounds.min_x : bounds.max_x;
+            const float* near_y = ray.sign[1] ? bounds.max_y : bounds.min_y;
+            const float* far_y = ray.sign[1] ? bounds.min_y : bounds.max_y;
+            const float* near_z = ray.sign[2] ? bounds.max_z : bounds.min_z;
+            const float* far_z = ray.sign[2] ? bounds.min_z : bounds.max_z;
+
+#if defined(DOOB_SIMD_AVX2)
+            if constexpr (WIDTH == 8) {
+                const __m256 ox = _mm256_set1_ps(ray.origin.x);
+                const __m256 oy = _mm256_set1_ps(ray.origin.y);
+                const __m256 oz = _mm256_set1_ps(ray.origin.z);
+                const __m256 ix = _mm256_set1_ps(ray.inv_direction.x);
+                const __m256 iy = _mm256_set1_ps(ray.inv_direction.y);
+                const __m256 iz = _mm256_set1_ps(ray.inv_direction.z);
+
+                const __m256 tx_in = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(near_x), ox), ix);
+                const __m256 ty_in = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(near_y), oy), iy);
+                const __m256 tz_in = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(near_z), oz), iz);
+                const __m256 tx_out = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(far_x), ox), ix);
+                const __m256 ty_out = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(far_y), oy), iy);
+                const __m256 tz_out = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(far_z), oz), iz);
+
+                const __m256 t_in = _mm256_max_ps(
+                    _mm256_max_ps(tx_in, ty_in), _mm256_max_ps(tz_in, _mm256_set1_ps(t_min)));
+                const __m256 t_out = _mm256_min_ps(
+                    _mm256_min_ps(tx_out, ty_out), _mm256_min_ps(tz_out, _mm256_set1_ps(t_max)));
+
+                _mm256_store_ps(out_t_entry, t_in);
+                return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(t_in, t_out, _CMP_LE_OQ)));
+            }
+#endif
+#if defined(DOOB_SIMD_SSE)
+            if constexpr (WIDTH == 4) {
+                const __m128 ox = _mm_set1_ps(ray.origin.x);
+                const __m128 oy = _mm_set1_ps(ray.origin.y);
+                const __m128 oz = _mm_set1_ps(ray.origin.z);
+                const __m128 ix = _mm_set1_ps(ray.inv_direction.x);
+                const __m128 iy = _mm_set1_ps(ray.inv_direction.y);
+                const __m128 iz = _mm_set1_ps(ray.inv_direction.z);
+
+                const __m128 tx_in = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_x), ox), ix);
+                const __m128 ty_in = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_y), oy), iy);
+                const __m128 tz_in = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_z), oz), iz);
+                const __m128 tx_out = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_x), ox), ix);
+                const __m128 ty_out = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_y), oy), iy);
+                const __m128 tz_out = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_z), oz), iz);
+
+                const __m128 t_in = _mm_max_ps(_mm_max_ps(tx_in, ty_in), _mm_max_ps(tz_in, _mm_set1_ps(t_min)));
+                const __m128 t_out = _mm_min_ps(_mm_min_ps(tx_out, ty_out), _mm_min_ps(tz_out, _mm_set1_ps(t_max)));
+
+                _mm_store_ps(out_t_entry, t_in);
+                return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(t_in, t_out)));
+            }
+#endif
+            uint32_t mask = 0;
+            for (int i = 0; i < WIDTH; ++i) {
+                const float t_in = glm::max(glm::max((near_x[i] - ray.origin.x) * ray.inv_direction.x,
+                                                (near_y[i] - ray.origin.y) * ray.inv_direction.y),
+                    glm::max((near_z[i] - ray.origin.z) * ray.inv_direction.z, t_min));
+                const float t_out = glm::min(glm::min((far_x[i] - ray.origin.x) * ray.inv_direction.x,
+                                                 (far_y[i] - ray.origin.y) * ray.inv_direction.y),
+                    glm::min((far_z[i] - ray.origin.z) * ray.inv_direction.z, t_max));
+                out_t_entry[i] = t_in;
+                mask |= (t_in <= t_out ? 1U : 0U) << i;
+            }
+            return mask;
+        }
+
+        std::vector<Node> m_nodes;
+    };
+} // namespace shape
+} // namespace devs_out_of_bounds
\ No newline at end of file
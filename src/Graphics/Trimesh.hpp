@@ -1,50 +1,93 @@
 #pragma once
+#include <bit>
 #include <src/Graphics/Mesh.hpp>
 #include <vector>
 
+#if defined(DOOB_SIMD_SSE)
+#include <immintrin.h>
+#endif
+
+// Triangles a leaf test intersects in a single SIMD pass, 0 keeps the scalar leaf test
+#if defined(DOOB_SIMD_AVX2)
+#define DOOB_TRIANGLE_GROUP_WIDTH 8
+#elif defined(DOOB_SIMD_SSE)
+#define DOOB_TRIANGLE_GROUP_WIDTH 4
+#else
+#define DOOB_TRIANGLE_GROUP_WIDTH 0
+#endif
+
 namespace devs_out_of_bounds {
 namespace shape {
-    class Trimesh : NoCopy {
-    public:
-        Trimesh(const MeshInstance* mesh_instance, const std::vector<uint32_t>& primitives) {
-            m_primitive_ptr = new uint32_t[primitives.size()];
-            m_primitive_count = static_cast<uint32_t>(primitives.size());
-            for (uint32_t i = 0; i < m_primitive_count; ++i) {
-                m_primitive_ptr[i] = primitives[i];
-            }
-            m_position_ptr = mesh_instance->m_positions.data();
-            m_index_ptr = mesh_instance->m_index_ptr;
-        }
-        ~Trimesh() { delete[] m_primitive_ptr; }
-
-        Trimesh(Trimesh&& other) noexcept {
-            m_primitive_ptr = other.m_primitive_ptr;
-            m_primitive_count = other.m_primitive_count;
-            m_position_ptr = other.m_position_ptr;
-            m_index_ptr = other.m_index_ptr;
-            other.m_primitive_ptr = nullptr;
-            other.m_primitive_count = 0;
-            other.m_position_ptr = nullptr;
-            other.m_index_ptr = nullptr;
+    // Triangle with the edges used by Moller-Trumbore precomputed, so a leaf test needs no index or vertex lookups.
+    // primitive is the index of the triangle in its mesh, which MeshInstance::SampleFragment expects.
+    struct PrecomputedTriangle {
+        glm::vec3 v0;
+        uint32_t primitive;
+        glm::vec3 edge1;
+        glm::vec3 edge2;
+
+        DOOB_NODISCARD static PrecomputedTriangle FromMesh(const MeshInstance* mesh_instance, uint32_t primitive) {
+            const uint32_t* indices = mesh_instance->m_index_ptr + primitive * 3;
+            const glm::vec3 a = mesh_instance->m_positions[indices[0]];
+            const glm::vec3 b = mesh_instance->m_positions[indices[1]];
+            const glm::vec3 c = mesh_instance->m_positions[indices[2]];
+            return {
+                .v0 = a,
+                .primitive = primitive,
+                .edge1 = b - a,
+                .edge2 = c - a,
+            };
         }
-        Trimesh& operator=(Trimesh&& other) noexcept {
-            if (this != &other) {
-                if (m_primitive_ptr) {
-                    delete[] m_primitive_ptr;
-                }
-                m_primitive_ptr = other.m_primitive_ptr;
-                m_primitive_count = other.m_primitive_count;
-                m_position_ptr = other.m_position_ptr;
-                m_index_ptr = other.m_index_ptr;
-                other.m_primitive_ptr = nullptr;
-                other.m_primitive_count = 0;
-                other.m_position_ptr = nullptr;
-                other.m_index_ptr = nullptr;
-            }
-            return *this;
+    };
+    static_assert(sizeof(PrecomputedTriangle) == 40, "PrecomputedTriangle should stay tightly packed!");
+
+#if DOOB_TRIANGLE_GROUP_WIDTH > 0
+    // SoA copy of DOOB_TRIANGLE_GROUP_WIDTH consecutive triangles, so a ray is tested against all of them at once.
+    // Lanes without a triangle are zeroed, degenerate triangles never pass the determinant test.
+    struct alignas(32) TriangleGroup {
+        static constexpr int WIDTH = DOOB_TRIANGLE_GROUP_WIDTH;
+
+        float v0_x[WIDTH];
+        float v0_y[WIDTH];
+        float v0_z[WIDTH];
+        float edge1_x[WIDTH];
+        float edge1_y[WIDTH];
+        float edge1_z[WIDTH];
+        float edge2_x[WIDTH];
+        float edge2_y[WIDTH];
+        float edge2_z[WIDTH];
+
+        void SetLane(int lane, const PrecomputedTriangle& triangle) {
+            v0_x[lane] = triangle.v0.x;
+            v0_y[lane] = triangle.v0.y;
+            v0_z[lane] = triangle.v0.z;
+            edge1_x[lane] = triangle.edge1.x;
+            edge1_y[lane] = triangle.edge1.y;
+            edge1_z[lane] = triangle.edge1.z;
+            edge2_x[lane] = triangle.edge2.x;
+            edge2_y[lane] = triangle.edge2.y;
+            edge2_z[lane] = triangle.edge2.z;
         }
+    };
+#endif
+
+    // View over a contiguous range of triangles, e.g. one BVH leaf. The triangles are owned by the caller.
+    class Trimesh {
+    public:
+        Trimesh(const PrecomputedTriangle* triangles, uint32_t triangle_count)
+            : m_triangles(triangles), m_triangle_count(triangle_count) {}
+#if DOOB_TRIANGLE_GROUP_WIDTH > 0
+        // groups holds the same triangles SoA, triangles has to start on a group boundary
+        Trimesh(const PrecomputedTriangle* triangles, uint32_t triangle_count, const TriangleGroup* groups)
+            : m_triangles(triangles), m_triangle_count(triangle_count), m_groups(groups) {}
+#endif
 
         DOOB_NODISCARD bool Intersect(const Ray& ray, Intersection* out_intersection) const {
+#if DOOB_TRIANGLE_GROUP_WIDTH > 0
+            if (m_groups) {
+                return IntersectGroups(ray, out_intersection);
+            }
+#endif
             bool b_hit = false;
 
             bool closest_b_backfacing = false;
@@ -54,54 +97,21 @@ namespace shape {
             size_t closest_primitive = 0;
             uint32_t num_intersections = 0;
 
-            for (uint32_t i = 0; i < m_primitive_count; ++i) {
-                uint32_t p = m_primitive_ptr[i];
-
-                const glm::vec3 a = m_position_ptr[m_index_ptr[p * 3 + 0]];
-                const glm::vec3 b = m_position_ptr[m_index_ptr[p * 3 + 1]];
-                const glm::vec3 c = m_position_ptr[m_index_ptr[p * 3 + 2]];
-
-                const glm::vec3 edge1 = b - a;
-                const glm::vec3 edge2 = c - a;
-
-                const glm::vec3 pvec = glm::cross(ray.direction, edge2);
-
-                float det = glm::dot(edge1, pvec);
-
-                if (std::abs(det) < std::numeric_limits<float>::epsilon()) {
-                    continue;
-                }
-
-                const float inv_det = 1.0f / det;
-
-                const glm::vec3 tvec = ray.origin - a;
-                const float u = glm::dot(tvec, pvec) * inv_det;
-
-                if (u < 0.0f || u > 1.0f) {
-                    continue;
-                }
-
-                const glm::vec3 qvec = glm::cross(tvec, edge1);
-                const float v = glm::dot(ray.direction, qvec) * inv_det;
-
-                if (v < 0.0f || u + v > 1.0f) {
-                    continue;
-                }
-
-                const float t = glm::dot(edge2, qvec) * inv_det;
-
-                if (t < ray.t_min || t > ray.t_max) {
+            for (uint32_t i = 0; i < m_triangle_count; ++i) {
+                const PrecomputedTriangle& triangle = m_triangles[i];
+                float t, u, v, det;
+                if (!IntersectTriangle(triangle, ray, t, u, v, det)) {
                     continue;
                 }
                 ++num_intersections;
                 if (t < closest_t) {
                     closest_t = t;
                     closest_b_backfacing = det < 0.0f;
-                    closest_edge1 = edge1;
-                    closest_edge2 = edge2;
+                    closest_edge1 = triangle.edge1;
+                    closest_edge2 = triangle.edge2;
                     closest_u = u;
                     closest_v = v;
-                    closest_primitive = p;
+                    closest_primitive = triangle.primitive;
                 }
 
                 b_hit = true;
@@ -124,14 +134,260 @@ namespace shape {
             return b_hit;
         }
 
+        // Stops at the first triangle hit within [t_min, t_max]
+        DOOB_NODISCARD bool Occluded(const Ray& ray) const {
+#if DOOB_TRIANGLE_GROUP_WIDTH > 0
+            if (m_groups) {
+                const uint32_t group_count = (m_triangle_count + TriangleGroup::WIDTH - 1) / TriangleGroup::WIDTH;
+                for (uint32_t g = 0; g < group_count; ++g) {
+                    if (IntersectGroup(m_groups[g], ray).hit_mask) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+#endif
+            for (uint32_t i = 0; i < m_triangle_count; ++i) {
+                float t, u, v, det;
+                if (IntersectTriangle(m_triangles[i], ray, t, u, v, det)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+
+        DOOB_NODISCARD uint32_t GetPrimitiveCount() const { return m_triangle_count; }
+        DOOB_NODISCARD const PrecomputedTriangle* GetTriangles() const { return m_triangles; }
 
-        DOOB_NODISCARD uint32_t GetPrimitiveCount() const { return m_primitive_count; }
     private:
-        const glm::vec3* m_position_ptr = nullptr;
-        const uint32_t* m_index_ptr = nullptr;
+#if DOOB_TRIANGLE_GROUP_WIDTH > 0
+        struct GroupHit {
+            uint32_t hit_mask = 0; // lanes hit within [t_min, t_max]
+            int nearest_lane = 0;
+            float t = INFINITY;
+            float u = 0.0f;
+            float v = 0.0f;
+            float det = 0.0f;
+        };
+
+        // Only the barycentrics and normal of the nearest hit over all groups are computed
+        DOOB_NODISCARD bool IntersectGroups(const Ray& ray, Intersection* out_intersection) const {
+            const uint32_t group_count = (m_triangle_count + TriangleGroup::WIDTH - 1) / TriangleGroup::WIDTH;
+            GroupHit closest = {};
+            uint32_t closest_index = 0;
+            uint32_t num_intersections = 0;
+            for (uint32_t g = 0; g < group_count; ++g) {
+                const GroupHit hit = IntersectGroup(m_groups[g], ray);
+                if (!hit.hit_mask) {
+                    continue;
+                }
+                num_intersections += static_cast<uint32_t>(std::popcount(hit.hit_mask));
+                if (hit.t < closest.t) {
+                    closest = hit;
+                    closest_index = g * TriangleGroup::WIDTH + static_cast<uint32_t>(hit.nearest_lane);
+                }
+            }
+            if (num_intersections == 0) {
+                return false;
+            }
+
+            if (out_intersection) {
+                const PrecomputedTriangle& triangle = m_triangles[closest_index];
+                const bool b_backfacing = closest.det < 0.0f;
+                out_intersection->num_intersections = num_intersections;
+                out_intersection->t = closest.t;
+                out_intersection->position = ray.origin + ray.direction * closest.t;
+
+                out_intersection->barycentric = { closest.u, closest.v };
+                out_intersection->primitive = triangle.primitive;
+
+                out_intersection->flat_normal = glm::normalize(glm::cross(triangle.edge1, triangle.edge2));
+                out_intersection->b_front_facing = b_backfacing ? 0 : 1;
+                if (b_backfacing) {
+                    out_intersection->flat_normal = -out_intersection->flat_normal;
+                }
+            }
+            return true;
+        }
+
+        // Moller-Trumbore against every lane of a group, the nearest hit is picked with a horizontal min so only
+        // its barycentrics leave the registers
+        DOOB_NODISCARD static DOOB_FORCEINLINE GroupHit IntersectGroup(const TriangleGroup& group, const Ray& ray) {
+            GroupHit out = {};
+            alignas(32) float u_lanes[TriangleGroup::WIDTH];
+            alignas(32) float v_lanes[TriangleGroup::WIDTH];
+            alignas(32) float det_lanes[TriangleGroup::WIDTH];
+#if DOOB_TRIANGLE_GROUP_WIDTH == 8
+            const __m256 dx = _mm256_set1_ps(ray.direction.x);
+            const __m256 dy = _mm256_set1_ps(ray.direction.y);
+            const __m256 dz = _mm256_set1_ps(ray.direction.z);
+            const __m256 e1x = _mm256_load_ps(group.edge1_x);
+            const __m256 e1y = _mm256_load_ps(group.edge1_y);
+            const __m256 e1z = _mm256_load_ps(group.edge1_z);
+            const __m256 e2x = _mm256_load_ps(group.edge2_x);
+            const __m256 e2y = _mm256_load_ps(group.edge2_y);
+            const __m256 e2z = _mm256_load_ps(group.edge2_z);
+
+            const __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+            const __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+            const __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+            const __m256 det = Dot(e1x, e1y, e1z, px, py, pz);
+            const __m256 abs_det = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), det);
+            __m256 valid =
+                _mm256_cmp_ps(abs_det, _mm256_set1_ps(std::numeric_limits<float>::epsilon()), _CMP_GE_OQ);
+            const __m256 inv_det = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+            const __m256 tx = _mm256_sub_ps(_mm256_set1_ps(ray.origin.x), _mm256_load_ps(group.v0_x));
+            const __m256 ty = _mm256_sub_ps(_mm256_set1_ps(ray.origin.y), _mm256_load_ps(group.v0_y));
+            const __m256 tz = _mm256_sub_ps(_mm256_set1_ps(ray.origin.z), _mm256_load_ps(group.v0_z));
+            const __m256 u = _mm256_mul_ps(Dot(tx, ty, tz, px, py, pz), inv_det);
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, _mm256_setzero_ps(), _CMP_GE_OQ));
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+
+            const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+            const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+            const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+            const __m256 v = _mm256_mul_ps(Dot(dx, dy, dz, qx, qy, qz), inv_det);
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_GE_OQ));
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+
+            const __m256 t = _mm256_mul_ps(Dot(e2x, e2y, e2z, qx, qy, qz), inv_det);
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(ray.t_min), _CMP_GE_OQ));
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(ray.t_max), _CMP_LE_OQ));
+            out.hit_mask = static_cast<uint32_t>(_mm256_movemask_ps(valid));
+            if (!out.hit_mask) {
+                return out;
+            }
+
+            // Horizontal min over the hit lanes, misses are moved to infinity first
+            const __m256 t_hit = _mm256_blendv_ps(_mm256_set1_ps(INFINITY), t, valid);
+            __m256 t_nearest = _mm256_min_ps(t_hit, _mm256_permute2f128_ps(t_hit, t_hit, 0x01));
+            t_nearest = _mm256_min_ps(t_nearest, _mm256_shuffle_ps(t_nearest, t_nearest, _MM_SHUFFLE(1, 0, 3, 2)));
+            t_nearest = _mm256_min_ps(t_nearest, _mm256_shuffle_ps(t_nearest, t_nearest, _MM_SHUFFLE(2, 3, 0, 1)));
+            const uint32_t nearest_mask =
+                static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(t_hit, t_nearest, _CMP_EQ_OQ))) &
+                out.hit_mask;
+            out.t = _mm256_cvtss_f32(t_nearest);
+            _mm256_store_ps(u_lanes, u);
+            _mm256_store_ps(v_lanes, v);
+            _mm256_store_ps(det_lanes, det);
+#else
+            const __m128 dx = _mm_set1_ps(ray.direction.x);
+            const __m128 dy = _mm_set1_ps(ray.direction.y);
+            const __m128 dz = _mm_set1_ps(ray.direction.z);
+            const __m128 e1x = _mm_load_ps(group.edge1_x);
+            const __m128 e1y = _mm_load_ps(group.edge1_y);
+            const __m128 e1z = _mm_load_ps(group.edge1_z);
+            const __m128 e2x = _mm_load_ps(group.edge2_x);
+            const __m128 e2y = _mm_load_ps(group.edge2_y);
+            const __m128 e2z = _mm_load_ps(group.edge2_z);
+
+            const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+            const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+            const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+            const __m128 det = Dot(e1x, e1y, e1z, px, py, pz);
+            const __m128 abs_det = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+            __m128 valid = _mm_cmpge_ps(abs_det, _mm_set1_ps(std::numeric_limits<float>::epsilon()));
+            const __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+            const __m128 tx = _mm_sub_ps(_mm_set1_ps(ray.origin.x), _mm_load_ps(group.v0_x));
+            const __m128 ty = _mm_sub_ps(_mm_set1_ps(ray.origin.y), _mm_load_ps(group.v0_y));
+            const __m128 tz = _mm_sub_ps(_mm_set1_ps(ray.origin.z), _mm_load_ps(group.v0_z));
+            const __m128 u = _mm_mul_ps(Dot(tx, ty, tz, px, py, pz), inv_det);
+            valid = _mm_and_ps(valid, _mm_cmpge_ps(u, _mm_setzero_ps()));
+            valid = _mm_and_ps(valid, _mm_cmple_ps(u, _mm_set1_ps(1.0f)));
+
+            const __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+            const __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+            const __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+            const __m128 v = _mm_mul_ps(Dot(dx, dy, dz, qx, qy, qz), inv_det);
+            valid = _mm_and_ps(valid, _mm_cmpge_ps(v, _mm_setzero_ps()));
+            valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+
+            const __m128 t = _mm_mul_ps(Dot(e2x, e2y, e2z, qx, qy, qz), inv_det);
+            valid = _mm_and_ps(valid, _mm_cmpge_ps(t, _mm_set1_ps(ray.t_min)));
+            valid = _mm_and_ps(valid, _mm_cmple_ps(t, _mm_set1_ps(ray.t_max)));
+            out.hit_mask = static_cast<uint32_t>(_mm_movemask_ps(valid));
+            if (!out.hit_mask) {
+                return out;
+            }
+
+            // Horizontal min over the hit lanes, misses are moved to infinity first (SSE2 has no blend)
+            const __m128 t_hit = _mm_or_ps(_mm_and_ps(valid, t), _mm_andnot_ps(valid, _mm_set1_ps(INFINITY)));
+            __m128 t_nearest = _mm_min_ps(t_hit, _mm_shuffle_ps(t_hit, t_hit, _MM_SHUFFLE(1, 0, 3, 2)));
+            t_nearest = _mm_min_ps(t_nearest, _mm_shuffle_ps(t_nearest, t_nearest, _MM_SHUFFLE(2, 3, 0, 1)));
+            const uint32_t nearest_mask =
+                static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpeq_ps(t_hit, t_nearest))) & out.hit_mask;
+            out.t = _mm_cvtss_f32(t_nearest);
+            _mm_store_ps(u_lanes, u);
+            _mm_store_ps(v_lanes, v);
+            _mm_store_ps(det_lanes, det);
+#endif
+            out.nearest_lane = std::countr_zero(nearest_mask);
+            out.u = u_lanes[out.nearest_lane];
+            out.v = v_lanes[out.nearest_lane];
+            out.det = det_lanes[out.nearest_lane];
+            return out;
+        }
+
+#if DOOB_TRIANGLE_GROUP_WIDTH == 8
+        DOOB_NODISCARD static DOOB_FORCEINLINE __m256 Dot(
+            __m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz) {
+            return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, bx), _mm256_mul_ps(ay, by)), _mm256_mul_ps(az, bz));
+        }
+#else
+        DOOB_NODISCARD static DOOB_FORCEINLINE __m128 Dot(
+            __m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz) {
+            return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+        }
+#endif
+#endif
+
+        // Moller-Trumbore, outputs the distance, barycentrics and determinant (negative for back faces) of a hit
+        DOOB_NODISCARD static DOOB_FORCEINLINE bool IntersectTriangle(const PrecomputedTriangle& triangle,
+            const Ray& ray, float& out_t, float& out_u, float& out_v, float& out_det) {
+            const glm::vec3 pvec = glm::cross(ray.direction, triangle.edge2);
+
+            const float det = glm::dot(triangle.edge1, pvec);
+
+            if (std::abs(det) < std::numeric_limits<float>::epsilon()) {
+                return false;
+            }
+
+            const float inv_det = 1.0f / det;
+
+            const glm::vec3 tvec = ray.origin - triangle.v0;
+            const float u = glm::dot(tvec, pvec) * inv_det;
+
+            if (u < 0.0f || u > 1.0f) {
+                return false;
+            }
+
+            const glm::vec3 qvec = glm::cross(tvec, triangle.edge1);
+            const float v = glm::dot(ray.direction, qvec) * inv_det;
+
+            if (v < 0.0f || u + v > 1.0f) {
+                return false;
+            }
+
+            const float t = glm::dot(triangle.edge2, qvec) * inv_det;
+
+            if (t < ray.t_min || t > ray.t_max) {
+                return false;
+            }
+            out_t = t;
+            out_u = u;
+            out_v = v;
+            out_det = det;
+            return true;
+        }
 
-        uint32_t* m_primitive_ptr = nullptr;
-        uint32_t m_primitive_count = 0;
+        const PrecomputedTriangle* m_triangles = nullptr;
+        uint32_t m_triangle_count = 0;
+#if DOOB_TRIANGLE_GROUP_WIDTH > 0
+        const TriangleGroup* m_groups = nullptr;
+#endif
     };
 } // namespace shape
 } // namespace devs_out_of_bounds
\ No newline at end of file
@@ -0,0 +1,56 @@
+#include "BvhRefiner.hpp"
+
+#include <SDL3/SDL.h>
+#include <chrono>
+#include <print>
+
+namespace devs_out_of_bounds {
+BvhRefiner::BvhRefiner(std::vector<BvhRefinement> refinements)
+    : m_refinements(std::move(refinements)), m_remaining(static_cast<uint32_t>(m_refinements.size())) {
+    if (!m_refinements.empty()) {
+        m_thread = std::thread([this]() { ThreadMain(); });
+    }
+}
+
+BvhRefiner::~BvhRefiner() {
+    m_should_exit.store(true, std::memory_order_relaxed);
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+uint32_t BvhRefiner::ApplyFinished() {
+    std::vector<Finished> finished;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::swap(finished, m_finished);
+    }
+    for (Finished& entry : finished) {
+        entry.target->Swap(*entry.bvh);
+    }
+    // The preview trees are released here, after the swap, never while a frame may still be reading them
+    return static_cast<uint32_t>(finished.size());
+}
+
+void BvhRefiner::ThreadMain() {
+    // Render workers must never wait on this thread, it only soaks up idle cycles
+    SDL_SetCurrentThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+    const auto refine_start = std::chrono::high_resolution_clock::now();
+    for (const BvhRefinement& refinement : m_refinements) {
+        if (m_should_exit.load(std::memory_order_relaxed)) {
+            return;
+        }
+        // Built without a pool, a single thread keeps the render workers free
+        auto bvh = std::make_unique<shape::BVH>(refinement.bvh->GetMeshInstance(), nullptr, refinement.options);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_finished.push_back({ .target = refinement.bvh, .bvh = std::move(bvh) });
+        }
+        m_remaining.fetch_sub(1, std::memory_order_release);
+    }
+    const std::chrono::duration<double, std::milli> duration =
+        std::chrono::high_resolution_clock::now() - refine_start;
+    std::println("BVH refine: {} meshes in {:.2f} ms", m_refinements.size(), duration.count());
+}
+} // namespace devs_out_of_bounds
@@ -0,0 +1,40 @@
+#pragma once
+#include <src/Scene/SceneLoader.hpp>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace devs_out_of_bounds {
+// Rebuilds the preview BVHs of progressive meshes with their final options on a single low priority thread, so
+// rendering can start on the preview trees right away. Finished trees are only swapped in by ApplyFinished.
+class BvhRefiner : NoCopy, NoMove {
+public:
+    BvhRefiner(std::vector<BvhRefinement> refinements);
+    // Waits for the build in progress (if any) to finish, the remaining ones are dropped
+    ~BvhRefiner();
+
+    // Swaps every tree finished so far into its BVH and returns how many there were. Must not run while rays are
+    // being traced.
+    uint32_t ApplyFinished();
+
+    DOOB_NODISCARD bool IsDone() const { return m_remaining.load(std::memory_order_acquire) == 0; }
+
+private:
+    void ThreadMain();
+
+    struct Finished {
+        shape::BVH* target = nullptr;
+        std::unique_ptr<shape::BVH> bvh = {};
+    };
+
+    std::vector<BvhRefinement> m_refinements;
+    std::vector<Finished> m_finished;
+    std::mutex m_mutex; // guards m_finished
+    std::atomic_uint32_t m_remaining = 0;
+    std::atomic_bool m_should_exit = false;
+    std::thread m_thread;
+};
+} // namespace devs_out_of_bounds
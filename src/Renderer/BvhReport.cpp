@@ -0,0 +1,110 @@
+#include "BvhReport.hpp"
+#include <nlohmann/json.hpp>
+#include <print>
+
+namespace devs_out_of_bounds {
+static double Average(uint64_t total, uint64_t count) {
+    return count > 0 ? static_cast<double>(total) / static_cast<double>(count) : 0.0;
+}
+static double ToMiB(size_t bytes) { return static_cast<double>(bytes) / (1024.0 * 1024.0); }
+
+static std::string FormatHistogram(const uint32_t* buckets, size_t count, size_t last_open_bucket) {
+    std::string out;
+    for (size_t i = 0; i < count; ++i) {
+        if (buckets[i] == 0) {
+            continue;
+        }
+        out += std::format(i == last_open_bucket ? " {}+:{}" : " {}:{}", i, buckets[i]);
+    }
+    return out;
+}
+
+static void PrintStatistics(const shape::BvhStatistics& stats) {
+    std::println("    {} nodes, {} leafs ({} lazy), {} primitive refs, {:.2f} per leaf", stats.node_count,
+        stats.leaf_count, stats.lazy_subtree_count, stats.primitive_references, stats.AverageLeafSize());
+    std::println("    leaf depth min {} avg {:.1f} max {}, {:.2f} MiB nodes, {:.2f} MiB primitives", stats.min_leaf_depth,
+        stats.average_leaf_depth, stats.max_leaf_depth, ToMiB(stats.node_bytes), ToMiB(stats.primitive_bytes));
+    std::println("    leaf sizes:{}", FormatHistogram(stats.leaf_size_histogram.data(), stats.leaf_size_histogram.size(),
+                                          shape::BvhStatistics::MAX_LEAF_SIZE_BUCKET));
+    std::println("    leaf depths:{}",
+        FormatHistogram(stats.leaf_depth_histogram.data(), stats.leaf_depth_histogram.size(), SIZE_MAX));
+}
+
+void BvhReport::Print() const {
+    std::println("BVH report: {} mesh BVHs, top level {} nodes and {} unbounded actors", meshes.size(),
+        top_level_node_count, top_level_unbounded_count);
+    for (const MeshEntry& mesh : meshes) {
+        std::println("  {} ({} instances): SAH {:.2f}, sibling overlap {:.3f}", mesh.name, mesh.instance_count,
+            mesh.statistics.sah_cost, mesh.statistics.sibling_overlap);
+        PrintStatistics(mesh.statistics);
+    }
+    if (meshes.size() > 1) {
+        std::println("  all meshes:");
+        PrintStatistics(mesh_totals);
+    }
+    if (b_counters_compiled_out) {
+        std::println("  traversal work not sampled, the counters are compiled out (configure with "
+                     "JETWAVE_BVH_STATISTICS=ON)");
+        return;
+    }
+    if (sampled_paths == 0) {
+        return;
+    }
+    std::println("  sampled {} paths:", sampled_paths);
+    for (size_t i = 0; i < RAY_TYPE_COUNT; ++i) {
+        const TraversalCounters& sample = samples[i];
+        std::println("    {:>9} rays: {:>8}, {:.1f} nodes visited and {:.1f} primitives tested per ray",
+            RAY_TYPE_NAMES[i], sample.rays, Average(sample.nodes_visited, sample.rays),
+            Average(sample.primitives_tested, sample.rays));
+    }
+}
+
+static nlohmann::json StatisticsToJson(const shape::BvhStatistics& stats) {
+    return {
+        { "nodes", stats.node_count },
+        { "leafs", stats.leaf_count },
+        { "lazySubtrees", stats.lazy_subtree_count },
+        { "primitiveReferences", stats.primitive_references },
+        { "averageLeafSize", stats.AverageLeafSize() },
+        { "leafSizeHistogram", stats.leaf_size_histogram },
+        { "leafDepthHistogram", stats.leaf_depth_histogram },
+        { "minLeafDepth", stats.min_leaf_depth },
+        { "maxLeafDepth", stats.max_leaf_depth },
+        { "averageLeafDepth", stats.average_leaf_depth },
+        { "sahCost", stats.sah_cost },
+        { "siblingOverlap", stats.sibling_overlap },
+        { "nodeBytes", stats.node_bytes },
+        { "primitiveBytes", stats.primitive_bytes },
+    };
+}
+
+std::string BvhReport::ToJson() const {
+    nlohmann::json j_meshes = nlohmann::json::array();
+    for (const MeshEntry& mesh : meshes) {
+        nlohmann::json j_mesh = StatisticsToJson(mesh.statistics);
+        j_mesh["name"] = mesh.name;
+        j_mesh["instances"] = mesh.instance_count;
+        j_meshes.push_back(std::move(j_mesh));
+    }
+
+    nlohmann::json j_samples = nlohmann::json::object();
+    for (size_t i = 0; i < RAY_TYPE_COUNT; ++i) {
+        const TraversalCounters& sample = samples[i];
+        j_samples[RAY_TYPE_NAMES[i]] = {
+            { "rays", sample.rays },
+            { "nodesVisitedPerRay", Average(sample.nodes_visited, sample.rays) },
+            { "primitivesTestedPerRay", Average(sample.primitives_tested, sample.rays) },
+        };
+    }
+
+    const nlohmann::json j = {
+        { "meshes", std::move(j_meshes) },
+        { "meshTotals", StatisticsToJson(mesh_totals) },
+        { "topLevel", { { "nodes", top_level_node_count }, { "unboundedActors", top_level_unbounded_count } } },
+        { "sampledPaths", sampled_paths },
+        { "countersCompiledOut", b_counters_compiled_out },
+        { "rays", std::move(j_samples) },
+    };
+    return j.dump(2);
+}
+} // namespace devs_out_of_bounds
@@ -0,0 +1,44 @@
+#pragma once
+#include <src/Graphics/Shapes/BvhStatistics.hpp>
+
+#include <array>
+#include <string>
+#include <vector>
+
+namespace devs_out_of_bounds {
+// Diagnostics of the acceleration structures of a scene, tells a badly built tree apart from expensive shading.
+// Built by PathTracer::BuildBvhReport.
+struct BvhReport {
+    enum class RayType : uint8_t {
+        Primary,
+        Secondary, // bounces after the first hit
+        Shadow,    // light visibility, including the steps through transmissive surfaces
+    };
+    static constexpr size_t RAY_TYPE_COUNT = 3;
+    static constexpr std::array<const char*, RAY_TYPE_COUNT> RAY_TYPE_NAMES = { "primary", "secondary", "shadow" };
+
+    struct MeshEntry {
+        std::string name;
+        uint32_t instance_count = 0;
+        shape::BvhStatistics statistics = {};
+    };
+
+    std::vector<MeshEntry> meshes;
+    // Counts and memory of all mesh BVHs, costs are per mesh only
+    shape::BvhStatistics mesh_totals = {};
+
+    size_t top_level_node_count = 0;
+    size_t top_level_unbounded_count = 0;
+
+    // Work of the sampled paths per ray type, all zero when no paths were sampled
+    uint32_t sampled_paths = 0;
+    // Paths were asked for, but the traversal counters are compiled out (see DOOB_BVH_STATISTICS)
+    bool b_counters_compiled_out = false;
+    std::array<TraversalCounters, RAY_TYPE_COUNT> samples = {};
+
+    DOOB_NODISCARD TraversalCounters& Sample(RayType type) { return samples[static_cast<size_t>(type)]; }
+
+    void Print() const;
+    DOOB_NODISCARD std::string ToJson() const;
+};
+} // namespace devs_out_of_bounds
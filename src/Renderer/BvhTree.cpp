@@ -1,12 +1,106 @@
 #include "BvhTree.hpp"
+#include <algorithm>
+#include <limits>
 
 namespace devs_out_of_bounds {
-BvhTree::BvhTree(const std::vector<Actor>& actors) : m_actors(actors) {}
+BvhTree::BvhTree(const std::vector<DrawableActor>& actors) : m_actors(actors) { Build(); }
 BvhTree::~BvhTree() {}
 
 void BvhTree::Build() {
+    m_trees.clear();
+    m_unbounded.clear();
+
+    std::vector<AABB> bounds(m_actors.size());
+    std::vector<int32_t> bounded;
+    bounded.reserve(m_actors.size());
     for (int32_t i = 0; i < static_cast<int32_t>(m_actors.size()); ++i) {
-        AABB aabb = m_actors[i].GetShape()->GetAABB();
+        bounds[i] = m_actors[i].shape->GetAABB();
+        if (bounds[i].IsBounded()) {
+            bounded.push_back(i);
+        } else {
+            m_unbounded.push_back(i);
+        }
+    }
+    if (bounded.empty()) {
+        return;
+    }
+
+    m_trees.reserve(bounded.size() * 2 - 1);
+    m_trees.emplace_back(); // root
+    BuildRecursive(0, bounds, bounded.data(), bounded.size());
+    m_build_sah_cost = ComputeSahCost();
+}
+
+bool BvhTree::Refit() {
+    // Children are always appended after their parent, so a reverse sweep visits them first
+    for (size_t i = m_trees.size(); i-- > 0;) {
+        Tree& tree = m_trees[i];
+        if (tree.object_index >= 0) {
+            tree.aabb = m_actors[tree.object_index].shape->GetAABB();
+        } else {
+            tree.aabb = m_trees[tree.left_child].aabb.Union(m_trees[tree.right_child].aabb);
+        }
     }
+    // Siblings that drifted apart overlap more and more, the median splits of a fresh build separate them again
+    if (ComputeSahCost() <= m_build_sah_cost * REFIT_MAX_COST_RATIO) {
+        return false;
+    }
+    Build();
+    return true;
+}
+
+float BvhTree::ComputeSahCost() const {
+    if (m_trees.empty()) {
+        return 0.0f;
+    }
+    // Every node costs one box test and every leaf one actor, weighted by the chance a ray reaching the root
+    // reaches them
+    float cost = 0.0f;
+    for (const Tree& tree : m_trees) {
+        cost += tree.aabb.SurfaceArea() * (tree.object_index >= 0 ? 2.0f : 1.0f);
+    }
+    return cost / glm::max(m_trees[0].aabb.SurfaceArea(), std::numeric_limits<float>::min());
+}
+
+void BvhTree::BuildRecursive(int32_t tree_index, const std::vector<AABB>& bounds, int32_t* objects, size_t count) {
+    assert(count > 0);
+
+    AABB aabb = AABB::Empty();
+    AABB centroid_bounds = AABB::Empty();
+    for (size_t i = 0; i < count; ++i) {
+        aabb.Grow(bounds[objects[i]]);
+        centroid_bounds.Grow(bounds[objects[i]].Centroid());
+    }
+    m_trees[tree_index].aabb = aabb;
+
+    if (count == 1) {
+        m_trees[tree_index].object_index = objects[0];
+        return;
+    }
+
+    // Median split along the widest centroid axis keeps the tree balanced, so its depth stays at log2(count)
+    const glm::vec3 extent = centroid_bounds.Extent();
+    int axis = 0;
+    if (extent.y > extent[axis]) {
+        axis = 1;
+    }
+    if (extent.z > extent[axis]) {
+        axis = 2;
+    }
+
+    const size_t mid = count / 2;
+    std::nth_element(objects, objects + mid, objects + count, [&bounds, axis](int32_t a, int32_t b) {
+        return bounds[a].Centroid()[axis] < bounds[b].Centroid()[axis];
+    });
+
+    const int32_t left = static_cast<int32_t>(m_trees.size());
+    m_trees.emplace_back();
+    const int32_t right = static_cast<int32_t>(m_trees.size());
+    m_trees.emplace_back();
+    m_trees[tree_index].left_child = left;
+    m_trees[tree_index].right_child = right;
+
+    BuildRecursive(left, bounds, objects, mid);
+    BuildRecursive(right, bounds, objects + mid, count - mid);
 }
 } // namespace devs_out_of_bounds
\ No newline at end of file
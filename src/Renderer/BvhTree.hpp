@@ -1,37 +1,118 @@
 #pragma once
-#include <src/Graphics/Camera.hpp>
+#include <src/Graphics/Shapes/BvhStatistics.hpp>
 #include <src/Scene/Scene.hpp>
+#include <vector>
 
 namespace devs_out_of_bounds {
+// Top level acceleration structure over the drawable actors of a scene. Every leaf references exactly one actor,
+// actors with unbounded shapes (e.g. planes) cannot be placed in the hierarchy and are always returned as candidates.
 class BvhTree : NoCopy, NoMove {
 public:
+    static constexpr size_t MAX_DEPTH = 64;
+    // Refit rebuilds the tree once moving actors made its SAH cost this much worse than right after the build
+    static constexpr float REFIT_MAX_COST_RATIO = 1.5f;
+
     struct Tree {
-        AABB aabb;
-        int32_t object_index;
+        AABB aabb = {};
+        int32_t object_index = -1;
         int32_t right_child = -1;
         int32_t left_child = -1;
     };
 
-    BvhTree(const std::vector<Actor>& actors);
+    BvhTree(const std::vector<DrawableActor>& actors);
     ~BvhTree();
 
+    // Invokes fn(actor) for every actor whose bounds overlap the ray. fn may shorten ray.t_max to cull the
+    // remaining candidates, and returns true to stop the query early.
     template <typename TCallable>
-    void QueryCandidates( TCallable&& fn) const {
-        QueryCandidatesInternal(fn, m_root);
+    void QueryCandidates(Ray& ray, TCallable&& fn) const {
+        for (int32_t object_index : m_unbounded) {
+            if (fn(m_actors[object_index])) {
+                return;
+            }
+        }
+        if (!m_trees.empty()) {
+            QueryCandidatesInternal(ray, fn);
+        }
+    }
+
+    // Packet version of QueryCandidates, fn(actor) is invoked once for every actor overlapped by any active ray
+    // of the packet and is expected to shorten the t_max of the rays it hits.
+    template <typename TCallable>
+    void QueryCandidatesPacket(RayPacket& packet, TCallable&& fn) const {
+        for (int32_t object_index : m_unbounded) {
+            fn(m_actors[object_index]);
+        }
+        if (m_trees.empty()) {
+            return;
+        }
+        int32_t stack[MAX_DEPTH + 1];
+        size_t stack_ptr = 0;
+        stack[stack_ptr++] = 0;
+
+        while (stack_ptr > 0) {
+            const Tree& tree = m_trees[stack[--stack_ptr]];
+            DOOB_COUNT_NODE_VISIT();
+            if (packet.Cull(tree.aabb) == 0) {
+                continue;
+            }
+            if (tree.object_index >= 0) {
+                fn(m_actors[tree.object_index]);
+                continue;
+            }
+            assert(stack_ptr + 2 <= MAX_DEPTH + 1);
+            stack[stack_ptr++] = tree.right_child;
+            stack[stack_ptr++] = tree.left_child;
+        }
     }
 
+    // Updates the node bounds after actors moved, keeping the topology. The shapes themselves have to be refit first.
+    // Rebuilds the tree instead when the refit tree has degraded too far, returns true when it did.
+    bool Refit();
+
+    // Expected number of nodes and actors a random ray that hits the root has to test
+    DOOB_NODISCARD float ComputeSahCost() const;
+
+    // Bounds of all bounded actors, unbounded actors are not included
+    DOOB_NODISCARD AABB GetBounds() const { return m_trees.empty() ? AABB{} : m_trees[0].aabb; }
+    DOOB_NODISCARD size_t GetNodeCount() const { return m_trees.size(); }
+    DOOB_NODISCARD size_t GetUnboundedCount() const { return m_unbounded.size(); }
+
 private:
     template <typename TCallable>
-    void QueryCandidatesInternal(TCallable&& fn, const Tree& tree) const {
-       
+    void QueryCandidatesInternal(Ray& ray, TCallable& fn) const {
+        int32_t stack[MAX_DEPTH + 1];
+        size_t stack_ptr = 0;
+        stack[stack_ptr++] = 0;
+
+        while (stack_ptr > 0) {
+            const Tree& tree = m_trees[stack[--stack_ptr]];
+            DOOB_COUNT_NODE_VISIT();
+            // ray.t_max may have shrunk since this node was pushed
+            if (!tree.aabb.RayIntersects(ray)) {
+                continue;
+            }
+            if (tree.object_index >= 0) {
+                if (fn(m_actors[tree.object_index])) {
+                    return;
+                }
+                continue;
+            }
+            assert(stack_ptr + 2 <= MAX_DEPTH + 1);
+            stack[stack_ptr++] = tree.right_child;
+            stack[stack_ptr++] = tree.left_child;
+        }
     }
 
     void Build();
+    void BuildRecursive(int32_t tree_index, const std::vector<AABB>& bounds, int32_t* objects, size_t count);
 
 private:
-    Tree m_root;
     std::vector<Tree> m_trees;
+    std::vector<int32_t> m_unbounded;
+    // Cost right after the last build, refit trees are compared against it
+    float m_build_sah_cost = 0.0f;
 
-    std::vector<Actor> m_actors;
+    std::vector<DrawableActor> m_actors;
 };
 } // namespace devs_out_of_bounds
\ No newline at end of file
@@ -1,5 +1,8 @@
 #include "PathTracer.hpp"
 #include "Tonemapping.hpp"
+#include <bit>
+#include <fstream>
+#include <print>
 #include <random>
 #include <src/Graphics/Lights/AreaLight.hpp>
 #include <src/Graphics/Lights/DirectionalLight.hpp>
@@ -7,8 +10,8 @@
 #include <src/Graphics/Materials/BasicMaterial.hpp>
 #include <src/Graphics/Materials/GridCutoutMaterial.hpp>
 #include <src/Graphics/Materials/GridMaterial.hpp>
-#include <src/Graphics/Shapes/Plane.hpp>
-#include <src/Graphics/Shapes/Sphere.hpp>
+#include <src/Graphics/Morton.hpp>
+#include <src/Graphics/RadixSort.hpp>
 #include <src/Graphics/Shapes/Triangle.hpp>
 
 #include <SDL3/SDL.h>
@@ -20,7 +23,7 @@ static material::GridMaterial g_grid_mat;
 static material::GridCutoutMaterial g_cookie_mat;
 static std::vector<light::PointLight> g_point_lights;
 
-PathTracer::PathTracer() {
+PathTracer::PathTracer(TaskPool* pool) : m_task_pool(pool) {
     m_scene = new Scene();
 
     LoadScene();
@@ -43,13 +46,32 @@ void PathTracer::OnResize(int new_width, int new_height) {
     ResetAccumulator();
 }
 
-void PathTracer::OnUpdate(float frame_time) {
+void PathTracer::OnUpdate(float frame_time, const bool* key_state) {
     static float accum = 0.0f;
 
+    // No frame is being traced here, so refined mesh BVHs can be swapped in. The mesh bounds stay the same, the top
+    // level tree and accumulated samples remain valid.
+    // IsDone is read before applying: the worker pushes a tree before it counts it as done, so once it reads done
+    // every tree is already queued and this ApplyFinished takes all of them.
+    if (m_bvh_refiner) {
+        const bool b_done = m_bvh_refiner->IsDone();
+        m_bvh_refiner->ApplyFinished();
+        if (b_done) {
+            m_bvh_refiner.reset();
+        }
+    }
+
+    // Moving vertices under a tree that is still being refined in the background would race with it
+    if (!m_parameters.assets.turntables.empty() && !m_bvh_refiner) {
+        m_turntable_time += frame_time;
+        AnimateTurntables();
+        ResetAccumulator();
+    }
+
     { // INPUT
         bool b_moved_camera = false;
         Camera& camera = m_parameters.assets.camera;
-        const bool* state = SDL_GetKeyboardState(nullptr);
+        const bool* state = key_state;
 
         glm::vec3 camera_move = {};
 
@@ -123,6 +145,16 @@ void PathTracer::OnUpdate(float frame_time) {
             camera.SetLogExposure(camera.GetLogExposure() + 4.0f * frame_time);
             this->ResetAccumulator();
         }
+
+        // Only once per key press, the report traces a few thousand paths
+        static bool b_report_key_down = false;
+        if (state[SDL_SCANCODE_F3] && !b_report_key_down) {
+            const BvhReport report = BuildBvhReport(BVH_REPORT_SAMPLE_PATHS);
+            report.Print();
+            std::ofstream("bvh-report.json") << report.ToJson();
+            std::println("BVH report written to bvh-report.json");
+        }
+        b_report_key_down = state[SDL_SCANCODE_F3];
     }
 
     if (!m_parameters.b_accumulate) {
@@ -141,6 +173,154 @@ void PathTracer::OnUpdate(float frame_time) {
 
 
 Pixel PathTracer::Evaluate(int x, int y, uint32_t& seed) const {
+    // Extra samples of a converging view only add to the accumulator, the last one resolves the pixel
+    for (uint32_t sample = 1; sample < m_frame_samples; ++sample) {
+        const Ray ray = GeneratePrimaryRay(x, y, seed);
+        AccumulateSample(x, y, TracePath(ray, seed));
+    }
+    const Ray ray = GeneratePrimaryRay(x, y, seed);
+    return ResolvePixel(x, y, TracePath(ray, seed));
+}
+
+void PathTracer::EvaluatePacket(
+    int x, int y, int width, int height, uint32_t& seed, Pixel* out_pixels, int stride) const {
+    assert(width > 0 && height > 0 && width * height <= static_cast<int>(RayPacket::SIZE));
+    const uint32_t count = static_cast<uint32_t>(width * height);
+
+    // Extra samples of a converging view only add to the accumulator, the last one resolves the pixels
+    for (uint32_t sample = 1; sample <= m_frame_samples; ++sample) {
+        Ray rays[RayPacket::SIZE];
+        for (uint32_t i = 0; i < count; ++i) {
+            rays[i] = GeneratePrimaryRay(x + static_cast<int>(i) % width, y + static_cast<int>(i) / width, seed);
+        }
+        RayPacket packet;
+        packet.Init(rays, RayPacket::MaskOf(count));
+
+        SceneHit primary_hits[RayPacket::SIZE];
+        IntersectScenePacket(packet, primary_hits);
+
+        // Bounces scatter in all directions, so the rest of each path is traced ray by ray
+        for (uint32_t i = 0; i < count; ++i) {
+            const int dx = static_cast<int>(i) % width;
+            const int dy = static_cast<int>(i) / width;
+            const glm::vec3 radiance = TracePath(rays[i], seed, &primary_hits[i]);
+            if (sample < m_frame_samples) {
+                AccumulateSample(x + dx, y + dy, radiance);
+            } else {
+                out_pixels[dy * stride + dx] = ResolvePixel(x + dx, y + dy, radiance);
+            }
+        }
+    }
+}
+
+void PathTracer::EvaluateRegion(
+    int x, int y, int width, int height, uint32_t& seed, Pixel* out_pixels, int stride) const {
+    const glm::vec3 max_radiance = ComputeMaxRadiance();
+
+    // Extra samples of a converging view only add to the accumulator, the last one resolves the pixels
+    for (uint32_t sample = 1; sample < m_frame_samples; ++sample) {
+        const std::vector<PathState>& paths = TraceRegion(x, y, width, height, seed, max_radiance);
+        for (uint32_t i = 0; i < paths.size(); ++i) {
+            AccumulateSample(x + static_cast<int>(i) % width, y + static_cast<int>(i) / width, paths[i].radiance);
+        }
+    }
+
+    const std::vector<PathState>& paths = TraceRegion(x, y, width, height, seed, max_radiance);
+    for (uint32_t i = 0; i < paths.size(); ++i) {
+        const int dx = static_cast<int>(i) % width;
+        const int dy = static_cast<int>(i) / width;
+        out_pixels[dy * stride + dx] = ResolvePixel(x + dx, y + dy, paths[i].radiance);
+    }
+}
+
+const std::vector<PathTracer::PathState>& PathTracer::TraceRegion(
+    int x, int y, int width, int height, uint32_t& seed, const glm::vec3& max_radiance) const {
+    const uint32_t count = static_cast<uint32_t>(width * height);
+
+    // Reused between calls to avoid heap allocations, every worker thread has its own
+    thread_local static std::vector<PathState> paths;
+    thread_local static std::vector<SceneHit> primary_hits;
+    thread_local static std::vector<uint32_t> active;
+    thread_local static std::vector<uint32_t> next_active;
+    paths.resize(count);
+    primary_hits.assign(count, {});
+    active.clear();
+
+    for (uint32_t i = 0; i < count; ++i) {
+        PathState& path = paths[i];
+        path = {};
+        // Paths advance interleaved, so each one needs its own random sequence
+        path.seed = UniformDistribution::RandomStateAdvance(seed);
+        path.ray = GeneratePrimaryRay(x + static_cast<int>(i) % width, y + static_cast<int>(i) / width, path.seed);
+    }
+
+    // Primary rays are coherent in pixel order already, the blocks are visited in Morton order so consecutive
+    // packets also stay close to each other
+    if (m_parameters.b_packet_primary_rays) {
+        constexpr int PACKET_DIM = 4;
+        const int blocks_x = (width + PACKET_DIM - 1) / PACKET_DIM;
+        const int blocks_y = (height + PACKET_DIM - 1) / PACKET_DIM;
+        const uint32_t side = std::bit_ceil(static_cast<uint32_t>(std::max(blocks_x, blocks_y)));
+        for (uint32_t code = 0; code < side * side; ++code) {
+            const glm::uvec2 block = MortonDecode2(code);
+            if (block.x >= static_cast<uint32_t>(blocks_x) || block.y >= static_cast<uint32_t>(blocks_y)) {
+                continue;
+            }
+            const int block_x = static_cast<int>(block.x) * PACKET_DIM;
+            const int block_y = static_cast<int>(block.y) * PACKET_DIM;
+            const int block_w = std::min(PACKET_DIM, width - block_x);
+            const int block_h = std::min(PACKET_DIM, height - block_y);
+            Ray rays[RayPacket::SIZE];
+            uint32_t path_index[RayPacket::SIZE];
+            uint32_t ray_count = 0;
+            for (int dy = 0; dy < block_h; ++dy) {
+                for (int dx = 0; dx < block_w; ++dx) {
+                    path_index[ray_count] = static_cast<uint32_t>((block_y + dy) * width + block_x + dx);
+                    rays[ray_count] = paths[path_index[ray_count]].ray;
+                    ++ray_count;
+                }
+            }
+            RayPacket packet;
+            packet.Init(rays, RayPacket::MaskOf(ray_count));
+            SceneHit hits[RayPacket::SIZE];
+            IntersectScenePacket(packet, hits);
+            for (uint32_t i = 0; i < ray_count; ++i) {
+                primary_hits[path_index[i]] = hits[i];
+            }
+        }
+    } else {
+        for (uint32_t i = 0; i < count; ++i) {
+            SceneHit& hit = primary_hits[i];
+            hit.b_hit = IntersectScene(paths[i].ray, &hit.intersection, &hit.actor);
+        }
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        if (ShadeBounce(paths[i], 0, primary_hits[i], max_radiance)) {
+            active.push_back(i);
+        }
+    }
+
+    // Bounced rays scatter, reordering them makes consecutive traversals and shading touch the same nodes,
+    // triangles and textures
+    for (int bounce = 1; !active.empty(); ++bounce) {
+        if (m_parameters.b_sort_secondary_rays) {
+            SortPaths(paths, active);
+        }
+        next_active.clear();
+        for (uint32_t index : active) {
+            PathState& path = paths[index];
+            SceneHit hit;
+            hit.b_hit = IntersectScene(path.ray, &hit.intersection, &hit.actor);
+            if (ShadeBounce(path, bounce, hit, max_radiance)) {
+                next_active.push_back(index);
+            }
+        }
+        std::swap(active, next_active);
+    }
+    return paths;
+}
+
+Ray PathTracer::GeneratePrimaryRay(int x, int y, uint32_t& seed) const {
     const float jitter_x = RandomFloatAdv<UniformDistribution>(seed) - 0.5f;
     const float jitter_y = RandomFloatAdv<UniformDistribution>(seed) - 0.5f;
     const float px = static_cast<float>(x) + 0.5f + jitter_x;
@@ -152,15 +332,15 @@ Pixel PathTracer::Evaluate(int x, int y, uint32_t& seed) const {
     ndc.x *= m_ar;
     ndc.y = -ndc.y;
 
-    Ray ray = m_parameters.assets.camera.GetRay(ndc);
-
-    glm::vec3 final_color = TracePath(ray, seed);
+    return m_parameters.assets.camera.GetRay(ndc);
+}
 
+Pixel PathTracer::ResolvePixel(int x, int y, const glm::vec3& radiance) const {
     glm::dvec3& summed = m_accumulator[static_cast<size_t>(y) * m_width + x];
     if (m_parameters.b_accumulate) {
-        summed += static_cast<glm::dvec3>(final_color);
+        summed += static_cast<glm::dvec3>(radiance);
     } else {
-        summed = static_cast<glm::dvec3>(final_color);
+        summed = static_cast<glm::dvec3>(radiance);
     }
 
     glm::vec3 color_avg = static_cast<glm::vec3>(summed / static_cast<double>(m_accumulation_count));
@@ -186,6 +366,21 @@ Pixel PathTracer::Evaluate(int x, int y, uint32_t& seed) const {
         gamma_corrected.b + b_dither_offset, 1.0f);
 }
 
+void PathTracer::AccumulateSample(int x, int y, const glm::vec3& radiance) const {
+    m_accumulator[static_cast<size_t>(y) * m_width + x] += static_cast<glm::dvec3>(radiance);
+}
+
+uint32_t PathTracer::SetFrameSamples(uint32_t samples) {
+    // A fresh accumulator means the view just changed, and is likely still changing, so it stays at one sample
+    if (!m_parameters.b_accumulate || m_accumulation_count <= 1) {
+        m_frame_samples = 1;
+        return m_frame_samples;
+    }
+    m_frame_samples = glm::max(samples, 1U);
+    m_accumulation_count += m_frame_samples - 1;
+    return m_frame_samples;
+}
+
 void PathTracer::ResetAccumulator() {
     m_accumulation_count = 0;
     size_t s = m_accumulator.size();
@@ -193,70 +388,111 @@ void PathTracer::ResetAccumulator() {
     m_accumulator.resize(s);
 }
 
-glm::vec3 PathTracer::TracePath(Ray ray, uint32_t& seed) const {
-    glm::vec3 radiance(0.0f);
-    glm::vec3 throughput(1.0f);
-
-    glm::vec3 max_radiance;
-    if (m_parameters.b_radiance_clamping) {
-        float exposure = m_parameters.assets.camera.ComputeExposureFactor();
-        float dynamic_range_limit = 20.0f;
-        max_radiance = glm::vec3(dynamic_range_limit / std::max(exposure, 1e-4f));
-    } else {
-        max_radiance = glm::vec3(INFINITY);
-    }
+glm::vec3 PathTracer::TracePath(Ray ray, uint32_t& seed, const SceneHit* primary_hit) const {
+    const glm::vec3 max_radiance = ComputeMaxRadiance();
+    PathState path = { .ray = ray, .seed = seed };
 
-    for (int bounce = 0; bounce <= m_parameters.max_light_bounces; ++bounce) {
-        Intersection hit;
-        DrawableActor actor;
-
-        if (!IntersectScene(ray, &hit, &actor)) {
-            radiance += throughput * SampleSky(ray.direction);
+    for (int bounce = 0;; ++bounce) {
+        SceneHit hit;
+        if (bounce == 0 && primary_hit) {
+            hit = *primary_hit;
+        } else {
+            hit.b_hit = IntersectScene(path.ray, &hit.intersection, &hit.actor);
+        }
+        if (!ShadeBounce(path, bounce, hit, max_radiance)) {
             break;
         }
-        glm::vec3 V = -ray.direction;
+    }
 
-        Fragment frag = actor.shape->SampleFragment(hit);
-        glm::vec3 Lr = {};
-        glm::vec3 Le = {};
-        // avoid excessive heap allocations
-        thread_local static BSDF bsdf;
-        bsdf.Reset();
-        actor.material->Evaluate(frag, &bsdf, &Le);
-        if (bsdf.HasBxDF()) {
-            Lr = glm::min(ComputeDirectLighting(hit, V, seed, &bsdf), max_radiance);
-        }
-        radiance += glm::min(throughput * (Lr + Le), max_radiance);
+    seed = path.seed;
+    return path.radiance;
+}
 
-        // If we reached max bounces, stop here.
-        if (bounce == m_parameters.max_light_bounces)
-            break;
+bool PathTracer::ShadeBounce(PathState& path, int bounce, const SceneHit& hit, const glm::vec3& max_radiance) const {
+    if (!hit.b_hit) {
+        path.radiance += path.throughput * SampleSky(path.ray.direction);
+        return false;
+    }
+    glm::vec3 V = -path.ray.direction;
+
+    Fragment frag = hit.actor.shape->SampleFragment(hit.intersection);
+    glm::vec3 Lr = {};
+    glm::vec3 Le = {};
+    // avoid excessive heap allocations
+    thread_local static BSDF bsdf;
+    bsdf.Reset();
+    hit.actor.material->Evaluate(frag, &bsdf, &Le);
+    if (bsdf.HasBxDF()) {
+        Lr = glm::min(ComputeDirectLighting(hit.intersection, V, path.seed, &bsdf), max_radiance);
+    }
+    path.radiance += glm::min(path.throughput * (Lr + Le), max_radiance);
 
-        float pdf = 0.0f;
-        glm::vec3 wi;
-        glm::vec3 f = bsdf.Sample_Evaluate(V, wi, seed, pdf);
+    // If we reached max bounces, stop here.
+    if (bounce >= m_parameters.max_light_bounces)
+        return false;
 
-        if (pdf < FLT_EPSILON || glm::isnan(pdf) || glm::all(glm::lessThan(f, glm::vec3(FLT_EPSILON))) ||
-            glm::any(glm::isnan(f))) {
-            break;
-        }
-        throughput *= f / pdf;
+    float pdf = 0.0f;
+    glm::vec3 wi;
+    glm::vec3 f = bsdf.Sample_Evaluate(V, wi, path.seed, pdf);
 
-        // Update Ray
-        ray.origin = hit.position + (glm::sign(glm::dot(wi, hit.flat_normal)) * hit.flat_normal * 1e-6f);
-        ray.direction = wi;
+    if (pdf < FLT_EPSILON || glm::isnan(pdf) || glm::all(glm::lessThan(f, glm::vec3(FLT_EPSILON))) ||
+        glm::any(glm::isnan(f))) {
+        return false;
+    }
+    path.throughput *= f / pdf;
+
+    // Update Ray
+    const Intersection& intersection = hit.intersection;
+    path.ray.origin =
+        intersection.position + (glm::sign(glm::dot(wi, intersection.flat_normal)) * intersection.flat_normal * 1e-6f);
+    path.ray.direction = wi;
+
+    // russian roulette termination
+    if (bounce > 3) {
+        float p = std::max(path.throughput.x, std::max(path.throughput.y, path.throughput.z));
+        if (RandomFloatAdv<UniformDistribution>(path.seed) > p)
+            return false;
+        path.throughput /= p; // MUST divide by survival probability to keep energy correct!
+    }
+    return true;
+}
 
-        // russian roulette termination
-        if (bounce > 3) {
-            float p = std::max(throughput.x, std::max(throughput.y, throughput.z));
-            if (RandomFloatAdv<UniformDistribution>(seed) > p)
-                break;
-            throughput /= p; // MUST divide by survival probability to keep energy correct!
-        }
+glm::vec3 PathTracer::ComputeMaxRadiance() const {
+    if (!m_parameters.b_radiance_clamping) {
+        return glm::vec3(INFINITY);
     }
+    float exposure = m_parameters.assets.camera.ComputeExposureFactor();
+    float dynamic_range_limit = 20.0f;
+    return glm::vec3(dynamic_range_limit / std::max(exposure, 1e-4f));
+}
 
-    return radiance;
+void PathTracer::SortPaths(const std::vector<PathState>& paths, std::vector<uint32_t>& indices) const {
+    if (indices.empty()) {
+        return;
+    }
+    // Only the relative order of the origins matters, so the bounds of the top level tree are good enough
+    const AABB bounds = m_bvh_tree->GetBounds();
+    const glm::vec3 inv_extent = 1.0f / glm::max(bounds.Extent(), glm::vec3(1e-6f));
+
+    // 3 octant bits above a 24 bit Morton code, the path indices are sorted along as payload
+    constexpr uint32_t MORTON_BITS_PER_AXIS = 8;
+    constexpr uint32_t KEY_BITS = 3 + 3 * MORTON_BITS_PER_AXIS;
+    thread_local static std::vector<uint32_t> keys;
+    keys.resize(indices.size());
+    for (size_t i = 0; i < indices.size(); ++i) {
+        const Ray& ray = paths[indices[i]].ray;
+        const uint32_t octant = (ray.direction.x < 0.0f ? 1U : 0U) | (ray.direction.y < 0.0f ? 2U : 0U) |
+                                (ray.direction.z < 0.0f ? 4U : 0U);
+        keys[i] = (octant << (3 * MORTON_BITS_PER_AXIS)) |
+                  MortonEncodePoint(ray.origin, bounds.min, inv_extent, MORTON_BITS_PER_AXIS);
+    }
+
+    // Reused between calls to avoid heap allocations, every worker thread has its own
+    thread_local static std::vector<uint32_t> scratch_keys;
+    thread_local static std::vector<uint32_t> scratch_indices;
+    RadixSortByKey(keys, indices, KEY_BITS, scratch_keys, scratch_indices);
 }
+
 glm::vec3 PathTracer::ComputeDirectLighting(
     const Intersection& hit, const glm::vec3& V, uint32_t& seed, BSDF* bsdf) const {
     glm::vec3 Ld(0.0f);
@@ -282,19 +518,23 @@ bool PathTracer::IntersectScene(Ray ray, Intersection* out_intersection, Drawabl
     DrawableActor closest_actor;
     bool b_hit_something = false;
 
-    for (const auto& actor : m_drawable_actors) {
+    DOOB_COUNT_RAYS(1);
+    m_bvh_tree->QueryCandidates(ray, [&](const DrawableActor& actor) {
         Intersection curr_intersection;
         if (!actor.shape->Intersect(ray, &curr_intersection)) {
-            continue;
+            return false;
         }
         if (curr_intersection.t >= closest_hit.t) {
-            continue;
+            return false;
         }
 
         closest_hit = curr_intersection;
         closest_actor = actor;
         b_hit_something = true;
-    }
+        // Anything further away than this hit can be culled from the remaining candidates
+        ray.t_max = curr_intersection.t;
+        return false;
+    });
 
     if (b_hit_something) {
         if (out_intersection)
@@ -306,26 +546,57 @@ bool PathTracer::IntersectScene(Ray ray, Intersection* out_intersection, Drawabl
     return false;
 }
 
+void PathTracer::IntersectScenePacket(RayPacket& packet, SceneHit* out_hits) const {
+    // Every shape only reports rays it hits closer than their current t_max, so the last report per ray wins
+    Intersection intersections[RayPacket::SIZE];
+    DOOB_COUNT_RAYS(std::popcount(packet.active_mask));
+    m_bvh_tree->QueryCandidatesPacket(packet, [&](const DrawableActor& actor) {
+        const uint32_t hit_mask = actor.shape->IntersectPacket(packet, intersections);
+        ForEachRay(hit_mask, [&](uint32_t i) {
+            out_hits[i] = {
+                .intersection = intersections[i],
+                .actor = actor,
+                .b_hit = true,
+            };
+        });
+    });
+}
+
 glm::vec3 PathTracer::CalcShadowTransmission(Ray ray) const {
     glm::vec3 throughput(1.0f); // Start with full light
     const int max_transparent_hits = 32;
 
+    // Any hit on an opaque material blocks the light, so a single any hit query settles most shadow rays. Actors
+    // whose material may transmit are asked for their nearest hit instead, its side and the material decide
+    // whether it blocks (e.g. the front of a single sided surface). Only a hit that lets light through needs the
+    // ordered closest hit walk below, which also covers every candidate the query did not get to.
+    bool b_occluded = false;
+    bool b_may_transmit = false;
+    DOOB_COUNT_RAYS(1);
+    m_bvh_tree->QueryCandidates(ray, [&](const DrawableActor& actor) {
+        if (!actor.material->MayTransmit()) {
+            b_occluded = actor.shape->Occluded(ray);
+            return b_occluded;
+        }
+        Intersection hit;
+        if (!actor.shape->Intersect(ray, &hit)) {
+            return false;
+        }
+        b_occluded = actor.material->IsOpaqueFace(hit.b_front_facing != 0);
+        b_may_transmit = !b_occluded;
+        return true;
+    });
+    if (b_occluded) {
+        return glm::vec3(0.0f);
+    }
+    if (!b_may_transmit) {
+        return throughput;
+    }
 
     for (int step = 0; step < max_transparent_hits; ++step) {
         Intersection closest_hit = { .t = INFINITY };
         DrawableActor closest_actor = {};
-        bool b_hit_something = false;
-
-        for (const auto& actor : m_drawable_actors) {
-            Intersection curr_hit;
-            if (actor.shape->Intersect(ray, &curr_hit)) {
-                if (curr_hit.t < closest_hit.t) {
-                    closest_hit = curr_hit;
-                    closest_actor = actor;
-                    b_hit_something = true;
-                }
-            }
-        }
+        bool b_hit_something = IntersectScene(ray, &closest_hit, &closest_actor);
 
         if (!b_hit_something || closest_hit.t > ray.t_max) {
             return throughput;
@@ -367,10 +638,87 @@ glm::vec3 PathTracer::SampleSky(const glm::vec3& direction) const {
     return m_parameters.assets.sky.lux * m_parameters.assets.sky.skybox_tint * sky_color;
 }
 
-void PathTracer::RebuildAccelerationStructures() {}
-void PathTracer::Cleanup() { m_parameters.assets.Clear(); }
+BvhReport PathTracer::BuildBvhReport(uint32_t sample_paths) const {
+    BvhReport report;
+    for (const LoadedBvh& loaded : m_parameters.assets.bvhs) {
+        report.meshes.push_back({
+            .name = loaded.name,
+            .instance_count = loaded.instance_count,
+            .statistics = loaded.bvh->GetStatistics(),
+        });
+        report.mesh_totals.Merge(loaded.bvh->GetStatistics());
+    }
+    report.top_level_node_count = m_bvh_tree->GetNodeCount();
+    report.top_level_unbounded_count = m_bvh_tree->GetUnboundedCount();
+#if !DOOB_BVH_STATISTICS
+    // Every path would measure zero work
+    report.b_counters_compiled_out = sample_paths > 0;
+    sample_paths = 0;
+#endif
+
+    // Paths are traced like TracePath, the counters of this thread advance by the work of each query in between.
+    // Only this thread counts, and only for the duration of the report.
+    const TraversalCountingScope counting;
+    const glm::vec3 max_radiance = ComputeMaxRadiance();
+    uint32_t seed = 0x2545F491U;
+    for (uint32_t i = 0; i < sample_paths; ++i) {
+        const glm::vec2 ndc = {
+            (RandomFloatAdv<UniformDistribution>(seed) * 2.0f - 1.0f) * m_ar,
+            RandomFloatAdv<UniformDistribution>(seed) * 2.0f - 1.0f,
+        };
+        PathState path = { .ray = m_parameters.assets.camera.GetRay(ndc), .seed = seed };
+        for (int bounce = 0;; ++bounce) {
+            const TraversalCounters before_hit = g_traversal_counters;
+            SceneHit hit;
+            hit.b_hit = IntersectScene(path.ray, &hit.intersection, &hit.actor);
+            report.Sample(bounce == 0 ? BvhReport::RayType::Primary : BvhReport::RayType::Secondary) +=
+                g_traversal_counters - before_hit;
+
+            const TraversalCounters before_shading = g_traversal_counters;
+            const bool b_continue = ShadeBounce(path, bounce, hit, max_radiance);
+            report.Sample(BvhReport::RayType::Shadow) += g_traversal_counters - before_shading;
+            if (!b_continue) {
+                break;
+            }
+        }
+        seed = path.seed;
+    }
+    report.sampled_paths = sample_paths;
+    return report;
+}
+
+void PathTracer::AnimateTurntables() {
+    for (const Turntable& turntable : m_parameters.assets.turntables) {
+        const glm::mat4 spin = glm::translate(glm::mat4(1.0f), turntable.pivot) *
+                               glm::rotate(glm::mat4(1.0f), turntable.radians_per_second * m_turntable_time,
+                                   glm::vec3(0.0f, 1.0f, 0.0f)) *
+                               glm::translate(glm::mat4(1.0f), -turntable.pivot);
+        if (turntable.instance) {
+            // The shared mesh BVH stays as it is
+            turntable.instance->SetTransform(spin * turntable.transform);
+        } else {
+            turntable.mesh_instance->SetTransform(spin * turntable.transform);
+            turntable.bvh->Update(m_task_pool);
+        }
+    }
+    RefitAccelerationStructures();
+}
 
-void PathTracer::LoadScene() { SceneLoader::Load("assets/scenes/chess-gltf.json", *m_scene, m_parameters.assets); }
+void PathTracer::RebuildAccelerationStructures() { m_bvh_tree = std::make_unique<BvhTree>(m_drawable_actors); }
+void PathTracer::RefitAccelerationStructures() {
+    if (m_bvh_tree) {
+        m_bvh_tree->Refit();
+    }
+}
+void PathTracer::Cleanup() {
+    // The refiner still references the shapes
+    m_bvh_refiner.reset();
+    m_parameters.assets.Clear();
+}
+
+void PathTracer::LoadScene() {
+    SceneLoader::Load("assets/scenes/chess-gltf.json", *m_scene, m_parameters.assets, m_task_pool);
+}
 void PathTracer::BakeScene() {
     m_drawable_actors.clear();
     m_light_actors.clear();
@@ -382,6 +730,15 @@ void PathTracer::BakeScene() {
             m_light_actors.push_back(LightActor{ .light = actor.GetLight() });
         }
     });
+    RebuildAccelerationStructures();
+    // Only the tree shapes, tracing sample paths would delay the first frame and measure progressive trees before
+    // they are refined. F3 reports the traversal work of the current trees.
+    BuildBvhReport(0).Print();
+
+    if (!m_parameters.assets.bvh_refinements.empty()) {
+        m_bvh_refiner = std::make_unique<BvhRefiner>(std::move(m_parameters.assets.bvh_refinements));
+        m_parameters.assets.bvh_refinements.clear();
+    }
 }
 
 } // namespace devs_out_of_bounds
\ No newline at end of file
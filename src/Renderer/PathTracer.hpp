@@ -1,6 +1,9 @@
 #pragma once
 #include <src/Graphics/Camera.hpp>
 #include <src/Graphics/SamplerStates/SkyboxSampler.hpp>
+#include <src/Renderer/BvhRefiner.hpp>
+#include <src/Renderer/BvhReport.hpp>
+#include <src/Renderer/BvhTree.hpp>
 #include <src/Scene/Scene.hpp>
 #include <src/Scene/SceneLoader.hpp>
 
@@ -11,27 +14,58 @@ struct PathTracerParameters {
     bool b_gt7_tonemapper = false;
     bool b_accumulate = true;
     bool b_radiance_clamping = true;
+    // Trace the primary rays of 4x4 pixel blocks as packets, secondary bounces are always traced per ray
+    bool b_packet_primary_rays = true;
+    // Trace the paths of a region bounce by bounce, sorting the rays of every bounce by direction and origin
+    bool b_sort_secondary_rays = true;
 
     SceneAssets assets;
 };
 
 class PathTracer : NoCopy, NoMove {
 public:
-    PathTracer();
+    // Paths traced for the BVH report printed after loading and on F3
+    static constexpr uint32_t BVH_REPORT_SAMPLE_PATHS = 4096;
+
+    // Scene loading runs on the pool, which is usually the one that traces the frames
+    PathTracer(TaskPool* pool = nullptr);
     ~PathTracer();
 
     void OnResize(int new_width, int new_height);
-    void OnUpdate(float frame_time);
+    // Runs between frames, key_state is indexed by SDL scancode and sampled by the caller
+    void OnUpdate(float frame_time, const bool* key_state);
 
     DOOB_NODISCARD Pixel Evaluate(int x, int y, uint32_t& seed) const;
+    // Evaluates a block of at most RayPacket::SIZE pixels, whose primary rays are traced as one packet.
+    // out_pixels points at the pixel (x, y) of a framebuffer with rows of stride pixels.
+    void EvaluatePacket(int x, int y, int width, int height, uint32_t& seed, Pixel* out_pixels, int stride) const;
+    // Evaluates a region as a wavefront, all paths advance one bounce at a time so their rays can be reordered
+    // for coherence before they are traced. Same framebuffer layout as EvaluatePacket.
+    void EvaluateRegion(int x, int y, int width, int height, uint32_t& seed, Pixel* out_pixels, int stride) const;
 
     void ResetAccumulator();
+    // Call after OnUpdate, before the frame is traced. Every pixel takes this many samples before it is resolved,
+    // which saves the per frame resolve and present work on converging views. Views that changed this frame and
+    // views that do not accumulate keep one sample, returns the count that is used.
+    uint32_t SetFrameSamples(uint32_t samples);
+
+    // Call after moving actors or deforming their meshes, once their shapes have been refit. Cheaper than
+    // rebuilding, the top level tree is only rebuilt once actors moved far enough to degrade it (see BvhTree::Refit).
+    void RefitAccelerationStructures();
     uint32_t GetSamplesAccumulated() const { return m_accumulation_count; }
 
+    // Measures the mesh and top level trees, then traces sample_paths paths from the camera on the calling thread to
+    // sample the traversal work per ray type. The traversal counters only count on the calling thread while it samples,
+    // paths are skipped when they are compiled out (see DOOB_BVH_STATISTICS). Must not run while a frame is being
+    // traced.
+    DOOB_NODISCARD BvhReport BuildBvhReport(uint32_t sample_paths) const;
+
 public:
     PathTracerParameters m_parameters = {};
 
 private:
+    // Moves the turntable actors of the scene to their angle at m_turntable_time and refits what they touched
+    void AnimateTurntables();
     void RebuildAccelerationStructures();
     void LoadScene();
     void BakeScene();
@@ -39,8 +73,38 @@ private:
 
     // --- Core Path Tracing Logic ---
 
-    // Solves the rendering equation iteratively
-    DOOB_NODISCARD glm::vec3 TracePath(Ray ray, uint32_t& seed) const;
+    struct SceneHit {
+        Intersection intersection = {};
+        DrawableActor actor = {};
+        bool b_hit = false;
+    };
+
+    struct PathState {
+        Ray ray = {};
+        glm::vec3 throughput = glm::vec3(1.0f);
+        glm::vec3 radiance = glm::vec3(0.0f);
+        uint32_t seed = 0;
+    };
+
+    DOOB_NODISCARD Ray GeneratePrimaryRay(int x, int y, uint32_t& seed) const;
+    // Accumulates the radiance of a new sample and returns the tonemapped pixel
+    DOOB_NODISCARD Pixel ResolvePixel(int x, int y, const glm::vec3& radiance) const;
+    // Accumulates the radiance of a sample that is resolved by a later one of the same frame
+    void AccumulateSample(int x, int y, const glm::vec3& radiance) const;
+
+    // Solves the rendering equation iteratively. primary_hit is the result of the first intersection query when it
+    // was already traced (e.g. as part of a packet), nullptr to trace it here.
+    DOOB_NODISCARD glm::vec3 TracePath(Ray ray, uint32_t& seed, const SceneHit* primary_hit = nullptr) const;
+    // Adds the radiance scattered at hit and samples the next ray of the path. Returns false once the path ended.
+    DOOB_NODISCARD bool ShadeBounce(
+        PathState& path, int bounce, const SceneHit& hit, const glm::vec3& max_radiance) const;
+    // Orders the given paths by the octant of their ray direction, then by the Morton code of the ray origin
+    void SortPaths(const std::vector<PathState>& paths, std::vector<uint32_t>& indices) const;
+    // Traces one sample for every pixel of a region as a wavefront, see EvaluateRegion. The paths are in row order
+    // and stay valid until the calling thread traces the next region.
+    DOOB_NODISCARD const std::vector<PathState>& TraceRegion(
+        int x, int y, int width, int height, uint32_t& seed, const glm::vec3& max_radiance) const;
+    DOOB_NODISCARD glm::vec3 ComputeMaxRadiance() const;
 
     DOOB_NODISCARD glm::vec3 ComputeDirectLighting(
         const Intersection& hit_info, const glm::vec3& view_dir, uint32_t& seed, BSDF* bsdf) const;
@@ -48,6 +112,7 @@ private:
 
     // Helper to interact with the Scene
     DOOB_NODISCARD bool IntersectScene(Ray ray, Intersection* out_intersection, DrawableActor* out_actor) const;
+    void IntersectScenePacket(RayPacket& packet, SceneHit* out_hits) const;
 
     DOOB_NODISCARD glm::vec3 SampleSky(const glm::vec3& direction) const;
 
@@ -63,12 +128,19 @@ private:
     std::vector<DrawableActor> m_drawable_actors = {};
     std::vector<LightActor> m_light_actors = {};
 
+    std::unique_ptr<BvhTree> m_bvh_tree = {};
+    // Replaces the preview BVHs of progressive meshes between frames, null once all of them were refined
+    std::unique_ptr<BvhRefiner> m_bvh_refiner = {};
+
     Scene* m_scene = nullptr;
+    TaskPool* m_task_pool = nullptr;
 
     // Accumulator
     mutable std::vector<glm::dvec3> m_accumulator = {};
     mutable std::vector<double> m_time_accumulator = {};
     mutable uint32_t m_accumulation_count = 1;
+    // Samples per pixel in the frame being traced, see SetFrameSamples
+    uint32_t m_frame_samples = 1;
 
     // Camera
     glm::vec2 m_inv_width_height = { 1.0f, 1.0f };
@@ -77,5 +149,8 @@ private:
 
     float m_camera_pitch = 0.0f;
     float m_camera_yaw = 0.0f;
+
+    // Seconds the turntables have been spinning for
+    float m_turntable_time = 0.0f;
 };
 } // namespace devs_out_of_bounds
\ No newline at end of file
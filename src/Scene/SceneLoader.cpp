@@ -1,6 +1,9 @@
 #include "SceneLoader.hpp"
+#include <chrono>
+#include <format>
 #include <fstream>
 #include <iostream>
+#include <print>
 
 #include <glm/gtc/packing.hpp>
 #include <nlohmann/json.hpp>
@@ -9,10 +12,9 @@
 #include <src/Asset/GLTFModelLoader.hpp>
 #include <src/Asset/IModelLoader.hpp>
 
-#include <src/Graphics/Shapes/Box.hpp>
+#include <src/Graphics/Shapes/AnalyticSet.hpp>
 #include <src/Graphics/Shapes/Bvh.hpp>
-#include <src/Graphics/Shapes/Plane.hpp>
-#include <src/Graphics/Shapes/Sphere.hpp>
+#include <src/Graphics/Shapes/Instance.hpp>
 #include <src/Graphics/Shapes/Triangle.hpp>
 
 #include <src/Graphics/Lights/AreaLight.hpp>
@@ -63,6 +65,47 @@ namespace devs_out_of_bounds {
 
 static glm::vec3 ConvertColor(const glm::vec3& color) { return glm::pow(color, glm::vec3(2.2f)); }
 
+// "bvh": { "split": "object" | "spatial" | "linear", "duplicationBudget": 0.3, "spatialSplitAlpha": 1e-5,
+//          "nodeFormat": "full" | "quantized16" | "quantized8", "progressive": false, "lazySubtreeSize": 0 }
+static shape::BvhBuildOptions LoadBvhOptions(const json& parameters, shape::BvhBuildOptions options) {
+    std::string split = parameters.value("split", "");
+    if (split == "object") {
+        options.split_mode = shape::BvhSplitMode::Object;
+    } else if (split == "spatial") {
+        options.split_mode = shape::BvhSplitMode::Spatial;
+    } else if (split == "linear") {
+        options.split_mode = shape::BvhSplitMode::Linear;
+    }
+    options.duplication_budget = parameters.value("duplicationBudget", options.duplication_budget);
+    options.spatial_split_alpha = parameters.value("spatialSplitAlpha", options.spatial_split_alpha);
+    std::string node_format = parameters.value("nodeFormat", "");
+    if (node_format == "full") {
+        options.node_format = shape::BvhNodeFormat::Full;
+    } else if (node_format == "quantized16") {
+        options.node_format = shape::BvhNodeFormat::Quantized16;
+    } else if (node_format == "quantized8") {
+        options.node_format = shape::BvhNodeFormat::Quantized8;
+    }
+    options.lazy_subtree_size = parameters.value("lazySubtreeSize", options.lazy_subtree_size);
+    options.b_progressive = parameters.value("progressive", options.b_progressive);
+    return options;
+}
+
+// "workers": { "count": 7, "affinity": "none" | "physical" | "logical", "reserveUiCore": true }
+static ThreadSettings LoadThreadSettings(const json& parameters) {
+    ThreadSettings settings = {};
+    if (parameters.contains("count")) {
+        settings.worker_count = parameters["count"].get<unsigned int>();
+    }
+    if (parameters.contains("affinity")) {
+        settings.affinity = ParseThreadAffinity(parameters["affinity"].get<std::string>());
+    }
+    if (parameters.contains("reserveUiCore")) {
+        settings.b_reserve_ui_core = parameters["reserveUiCore"].get<bool>();
+    }
+    return settings;
+}
+
 static void LoadMaterialBasic(material::BasicMaterial& m, const json& parameters) {
     m.m_albedo = ConvertColor(parameters.value("albedo", glm::vec3(1, 1, 1)));
     m.m_roughness = parameters.value("roughness", 1.0f);
@@ -108,7 +151,7 @@ static void LoadMaterialMetallic(material::MetallicMaterial& m, const json& para
     m.m_roughness = parameters.value("roughness", 0.5f);
 }
 
-bool SceneLoader::Load(const std::string& filepath, Scene& scene, SceneAssets& assets) {
+bool SceneLoader::Load(const std::string& filepath, Scene& scene, SceneAssets& assets, TaskPool* pool) {
     std::ifstream file(filepath);
     if (!file.is_open()) {
         MessageBoxA(
@@ -125,6 +168,10 @@ bool SceneLoader::Load(const std::string& filepath, Scene& scene, SceneAssets& a
 
     assets.Clear();
 
+    if (j.contains("workers")) {
+        assets.thread_settings = LoadThreadSettings(j["workers"]);
+    }
+
     if (j.contains("camera")) {
         const auto& j_camera = j["camera"];
 
@@ -212,61 +259,85 @@ bool SceneLoader::Load(const std::string& filepath, Scene& scene, SceneAssets& a
     }
 
     if (j.contains("actors")) {
+        // Analytic primitives sharing a material are batched into one shape, so they are intersected in SIMD groups
+        // under their own hierarchy instead of one top level leaf each. Planes get a separate batch, a batch holding
+        // one is unbounded and would be tested by every ray.
+        struct AnalyticBatch {
+            IMaterial* material = nullptr;
+            bool b_unbounded = false;
+            shape::AnalyticSet* set = nullptr;
+        };
+        std::vector<AnalyticBatch> analytic_batches;
+        const auto get_batch = [&](IMaterial* material, bool b_unbounded) -> shape::AnalyticSet& {
+            for (const AnalyticBatch& batch : analytic_batches) {
+                if (batch.material == material && batch.b_unbounded == b_unbounded) {
+                    return *batch.set;
+                }
+            }
+            auto set = std::make_unique<shape::AnalyticSet>();
+            analytic_batches.push_back({ .material = material, .b_unbounded = b_unbounded, .set = set.get() });
+            assets.shapes.push_back(std::move(set));
+            return *analytic_batches.back().set;
+        };
+
         for (const auto& j_actor : j["actors"]) {
             std::string shape_type = j_actor.value("shape", "none");
-            IShape* shape_ptr = nullptr;
+
+            // Find material by name
+            std::string mat_name = j_actor.value("material", "");
+            IMaterial* mat_ptr = nullptr;
+            if (assets.material_lookup.count(mat_name)) {
+                mat_ptr = assets.material_lookup[mat_name];
+            }
+            if (!mat_ptr) {
+                continue;
+            }
 
             // --- Instantiate Shape ---
             if (shape_type == "sphere") {
                 glm::vec3 center = j_actor.value("center", glm::vec3(0.0f));
                 float radius = j_actor.value("radius", 1.0f);
 
-                auto sphere = std::make_unique<shape::Sphere>(center, radius);
-                shape_ptr = sphere.get();
-                assets.shapes.push_back(std::move(sphere));
+                get_batch(mat_ptr, false).AddSphere(center, radius);
             } else if (shape_type == "plane") {
                 glm::vec3 normal = j_actor.value("normal", glm::vec3(0, 1, 0));
                 glm::vec3 position = j_actor.value("position", glm::vec3(0, 0, 0));
 
-                auto plane = std::make_unique<shape::Plane>(normal, position);
-                shape_ptr = plane.get();
-                assets.shapes.push_back(std::move(plane));
+                get_batch(mat_ptr, true).AddPlane(normal, position);
             } else if (shape_type == "box") {
                 glm::vec3 extent = j_actor.value("extent", glm::vec3(1, 1, 1));
                 glm::vec3 position = j_actor.value("position", glm::vec3(0, 0, 0));
 
-                auto box = std::make_unique<shape::Box>(position, extent);
-                shape_ptr = box.get();
-                assets.shapes.push_back(std::move(box));
+                get_batch(mat_ptr, false).AddBox(position, extent);
             } else if (shape_type == "triangle") {
                 glm::vec3 a = j_actor.value("a", glm::vec3(0, 0, 0));
                 glm::vec3 b = j_actor.value("b", glm::vec3(0, 0, 0));
                 glm::vec3 c = j_actor.value("c", glm::vec3(0, 0, 0));
 
                 auto tri = std::make_unique<shape::Triangle>(a, b, c);
-                shape_ptr = tri.get();
+                // --- Instantiate Actor ---
+                ActorId id = scene.NewDrawableActor(tri.get(), mat_ptr);
                 assets.shapes.push_back(std::move(tri));
             }
+        }
 
-            // --- Instantiate Actor ---
-            if (shape_ptr) {
-                std::string mat_name = j_actor.value("material", "");
-                IMaterial* mat_ptr = nullptr;
-
-                // Find material by name
-                if (assets.material_lookup.count(mat_name)) {
-                    mat_ptr = assets.material_lookup[mat_name];
-                }
-
-                if (mat_ptr) {
-                    ActorId id = scene.NewDrawableActor(shape_ptr, mat_ptr);
-                }
-            }
+        for (const AnalyticBatch& batch : analytic_batches) {
+            batch.set->Build();
+            ActorId id = scene.NewDrawableActor(batch.set, batch.material);
         }
     }
 
 
     if (j.contains("gltf")) {
+        // Scene wide BVH settings, each gltf entry may override them for its own meshes
+        shape::BvhBuildOptions scene_bvh_options = {};
+        if (j.contains("bvh")) {
+            scene_bvh_options = LoadBvhOptions(j["bvh"], scene_bvh_options);
+        }
+
+        // Meshes are built on the given pool, worker threads are only spun up here when there is none
+        std::unique_ptr<TaskPool> local_pool = pool ? nullptr : std::make_unique<TaskPool>();
+        TaskPool* build_pool = pool ? pool : local_pool.get();
         for (const auto& j_gltf : j["gltf"]) {
             std::string path = j_gltf.value("file", "");
             glm::mat4 transform(1.f);
@@ -277,7 +348,12 @@ bool SceneLoader::Load(const std::string& filepath, Scene& scene, SceneAssets& a
                 glm::vec3 scale = j_off.value("scale", glm::vec3(1, 1, 1));
                 transform = glm::translate(glm::scale(glm::mat4(1), scale), position);
             }
-            LoadGltf(path, scene, assets, transform);
+            shape::BvhBuildOptions bvh_options = scene_bvh_options;
+            if (j_gltf.contains("bvh")) {
+                bvh_options = LoadBvhOptions(j_gltf["bvh"], bvh_options);
+            }
+            // "turntable": degrees per second the file spins around the vertical axis through its offset
+            LoadGltf(path, scene, assets, transform, build_pool, bvh_options, j_gltf.value("turntable", 0.0f));
         }
     }
 
@@ -323,8 +399,9 @@ bool SceneLoader::Load(const std::string& filepath, Scene& scene, SceneAssets& a
     return true;
 }
 
-bool SceneLoader::LoadGltf(
-    const std::string& gltf_file, Scene& scene, SceneAssets& assets, const glm::mat4& base_Transform) {
+bool SceneLoader::LoadGltf(const std::string& gltf_file, Scene& scene, SceneAssets& assets,
+    const glm::mat4& base_Transform, TaskPool* pool, const shape::BvhBuildOptions& bvh_options,
+    float turntable_degrees_per_second) {
     model_loader::GLTFModelLoader loader;
     model_loader::ModelData data = loader.Load(gltf_file);
 
@@ -335,6 +412,14 @@ bool SceneLoader::LoadGltf(
     std::vector<ITextureView*> gltf_texture_indices = {};
     std::vector<IMaterial*> gltf_material_indices = {};
 
+    // Images are decoded on the pool while the meshes are read, they are only needed once materials are created.
+    // ReadImageData keeps no state in the loader, so the decodes can run concurrently.
+    std::vector<model_loader::ImageData> decoded_images(data.images.size());
+    TaskGroup decode_group(pool);
+    for (size_t k = 0; k < data.images.size(); ++k) {
+        decode_group.Run([&, k]() { decoded_images[k] = loader.ReadImageData(data, data.images[k]); });
+    }
+
     for (auto& mesh_group : data.meshGroups) {
         std::vector<Mesh*> mesh_shapes = {};
         for (auto& mesh : mesh_group.meshes) {
@@ -355,8 +440,8 @@ bool SceneLoader::LoadGltf(
         gltf_meshes.push_back(mesh_shapes);
     }
 
-    for (auto& image : data.images) {
-        model_loader::ImageData result = loader.ReadImageData(data, image);
+    decode_group.Wait();
+    for (model_loader::ImageData& result : decoded_images) {
         class GltfTexture : public IData {
         public:
             GltfTexture(model_loader::ImageData&& data) : m_data(data) {}
@@ -421,6 +506,28 @@ bool SceneLoader::LoadGltf(
         gltf_material_indices.push_back(assets.materials.back().get());
     }
 
+    // Instances are only gathered while walking the node hierarchy, their BVHs are built in parallel afterwards.
+    // Every mesh gets a single BVH: meshes placed once are baked into world space, meshes placed several times
+    // share one object space BVH that each instance transforms rays into.
+    struct BuildJob {
+        Mesh* mesh;
+        glm::mat4 transform;
+        int mesh_group;
+        uint32_t mesh_index;
+        uint32_t instance_count = 0;
+
+        std::unique_ptr<shape::BVH> bvh = {};
+        double build_ms = 0.0;
+    };
+    struct PendingInstance {
+        size_t job;
+        IMaterial* material;
+        glm::mat4 transform;
+    };
+    std::vector<BuildJob> build_jobs = {};
+    std::unordered_map<const Mesh*, size_t> mesh_jobs = {};
+    std::vector<PendingInstance> pending_instances = {};
+
     for (auto& s : data.scenes) {
         std::deque<int> remaining_children;
         remaining_children.append_range(s.nodeIndices);
@@ -453,12 +560,22 @@ bool SceneLoader::LoadGltf(
                             Mesh* mesh = gltf_meshes[i][z.meshIndex];
                             IMaterial* material = gltf_material_indices[*z.materialIndex];
 
-                            MeshInstance* mesh_instance = new MeshInstance(mesh, transform);
-                            gltf_mesh_instances.push_back(mesh_instance);
-
-                            assets.shapes.push_back(std::make_unique<shape::BVH>(mesh_instance));
-
-                            ActorId id = scene.NewDrawableActor(assets.shapes.back().get(), material);
+                            auto [it, b_inserted] = mesh_jobs.try_emplace(mesh, build_jobs.size());
+                            if (b_inserted) {
+                                build_jobs.push_back({
+                                    .mesh = mesh,
+                                    .transform = transform,
+                                    .mesh_group = i,
+                                    .mesh_index = z.meshIndex,
+                                });
+                            }
+                            ++build_jobs[it->second].instance_count;
+
+                            pending_instances.push_back({
+                                .job = it->second,
+                                .material = material,
+                                .transform = transform,
+                            });
                         }
                         break;
                     }
@@ -467,6 +584,82 @@ bool SceneLoader::LoadGltf(
             }
         }
     }
+
+    gltf_mesh_instances.resize(build_jobs.size());
+
+    // Progressive meshes render with a linear build first, the final tree is built once rendering runs
+    shape::BvhBuildOptions load_options = bvh_options;
+    if (bvh_options.b_progressive) {
+        load_options.split_mode = shape::BvhSplitMode::Linear;
+    }
+
+    const auto build_start = std::chrono::high_resolution_clock::now();
+    {
+        TaskGroup group(pool);
+        for (size_t k = 0; k < build_jobs.size(); ++k) {
+            group.Run([&, k]() {
+                BuildJob& job = build_jobs[k];
+                const auto start = std::chrono::high_resolution_clock::now();
+
+                const glm::mat4 transform = job.instance_count == 1 ? job.transform : glm::mat4(1.0f);
+                gltf_mesh_instances[k] = new MeshInstance(job.mesh, transform);
+                job.bvh = std::make_unique<shape::BVH>(gltf_mesh_instances[k], pool, load_options);
+
+                const std::chrono::duration<double, std::milli> duration =
+                    std::chrono::high_resolution_clock::now() - start;
+                job.build_ms = duration.count();
+            });
+        }
+        group.Wait();
+    }
+    const std::chrono::duration<double, std::milli> total_duration =
+        std::chrono::high_resolution_clock::now() - build_start;
+
+    for (const BuildJob& job : build_jobs) {
+        std::println("BVH build: mesh {}/{} ({} triangles, {} instances) in {:.2f} ms", job.mesh_group,
+            job.mesh_index, job.mesh->GetIndices().size() / 3, job.instance_count, job.build_ms);
+    }
+
+    // Actors are created in node order regardless of which build finished first
+    std::vector<IShape*> job_shapes(build_jobs.size(), nullptr);
+    for (const PendingInstance& pending : pending_instances) {
+        BuildJob& job = build_jobs[pending.job];
+        if (!job_shapes[pending.job]) {
+            if (bvh_options.b_progressive && bvh_options.split_mode != shape::BvhSplitMode::Linear) {
+                assets.bvh_refinements.push_back({ .bvh = job.bvh.get(), .options = bvh_options });
+            }
+            assets.bvhs.push_back({
+                .name = std::format("{} mesh {}/{}", gltf_file, job.mesh_group, job.mesh_index),
+                .bvh = job.bvh.get(),
+                .instance_count = job.instance_count,
+            });
+            assets.shapes.push_back(std::move(job.bvh));
+            job_shapes[pending.job] = assets.shapes.back().get();
+        }
+
+        IShape* shape = job_shapes[pending.job];
+        shape::Instance* instance = nullptr;
+        if (job.instance_count > 1) {
+            auto owned_instance = std::make_unique<shape::Instance>(job_shapes[pending.job], pending.transform);
+            instance = owned_instance.get();
+            shape = instance;
+            assets.shapes.push_back(std::move(owned_instance));
+        }
+        ActorId id = scene.NewDrawableActor(shape, pending.material);
+
+        if (turntable_degrees_per_second != 0.0f) {
+            assets.turntables.push_back({
+                .instance = instance,
+                .mesh_instance = instance ? nullptr : gltf_mesh_instances[pending.job],
+                .bvh = instance ? nullptr : static_cast<shape::BVH*>(job_shapes[pending.job]),
+                .transform = pending.transform,
+                .pivot = glm::vec3(base_Transform[3]),
+                .radians_per_second = glm::radians(turntable_degrees_per_second),
+            });
+        }
+    }
+    std::println("BVH build: {} meshes for {} instances from {} in {:.2f} ms", build_jobs.size(),
+        pending_instances.size(), gltf_file, total_duration.count());
     return true;
 }
 
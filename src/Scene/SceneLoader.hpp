@@ -14,6 +14,11 @@
 #include <src/Graphics/ISamplerState.hpp>
 #include <src/Graphics/IShape.hpp>
 #include <src/Graphics/ITextureView.hpp>
+#include <src/Graphics/Shapes/BVH.hpp>
+#include <src/Graphics/Shapes/Instance.hpp>
+
+#include <src/Threading/TaskPool.hpp>
+#include <src/Threading/ThreadPlacement.hpp>
 
 namespace devs_out_of_bounds {
 struct Sky {
@@ -24,6 +29,29 @@ struct Sky {
 struct IData {
     virtual ~IData() = default;
 };
+// A mesh BVH that was loaded with a fast preview build, and the options of the tree that should replace it
+struct BvhRefinement {
+    shape::BVH* bvh = nullptr;
+    shape::BvhBuildOptions options = {};
+};
+
+// A mesh BVH built by the loader, listed for diagnostics such as the BVH report
+struct LoadedBvh {
+    std::string name;
+    const shape::BVH* bvh = nullptr;
+    uint32_t instance_count = 0;
+};
+
+// An actor the renderer spins around the vertical axis through pivot. Meshes placed several times move their
+// instance, meshes baked into world space rewrite their vertices and refit their BVH.
+struct Turntable {
+    shape::Instance* instance = nullptr;
+    MeshInstance* mesh_instance = nullptr;
+    shape::BVH* bvh = nullptr;
+    glm::mat4 transform = glm::mat4(1.0f); // placement at angle 0
+    glm::vec3 pivot = {};
+    float radians_per_second = 0.0f;
+};
 
 // Container to own the heap memory of loaded objects
 struct SceneAssets {
@@ -42,6 +70,13 @@ struct SceneAssets {
     std::unordered_map<std::string, IMaterial*> material_lookup;
     std::unordered_map<std::string, ITextureView*> texture_lookup;
 
+    // Filled by the loader for progressive BVHs, the renderer rebuilds these in the background
+    std::vector<BvhRefinement> bvh_refinements;
+    std::vector<LoadedBvh> bvhs;
+    std::vector<Turntable> turntables;
+    // Render thread layout requested by the scene, command line settings take precedence
+    ThreadSettings thread_settings;
+
     Sky sky;
     Camera camera;
     float fov_degrees = 90.0f;
@@ -55,13 +90,22 @@ struct SceneAssets {
         lights.clear();
         material_lookup.clear();
         texture_lookup.clear();
+        bvh_refinements.clear();
+        bvhs.clear();
+        turntables.clear();
+        thread_settings = {};
     }
 };
 
 class SceneLoader {
 public:
-    static bool Load(const std::string& filepath, Scene& scene, SceneAssets& assets);
-    static bool LoadGltf(const std::string& gltf_file, Scene& scene, SceneAssets& assets, const glm::mat4& base_Transform);
+    // Mesh BVHs and textures are built on the pool when one is given, otherwise on a temporary pool
+    static bool Load(const std::string& filepath, Scene& scene, SceneAssets& assets, TaskPool* pool = nullptr);
+    // Mesh BVHs and textures are built on the pool when one is given, otherwise on the calling thread. A non zero
+    // turntable speed (degrees per second) spins all actors of the file around the origin of base_Transform.
+    static bool LoadGltf(const std::string& gltf_file, Scene& scene, SceneAssets& assets,
+        const glm::mat4& base_Transform, TaskPool* pool = nullptr, const shape::BvhBuildOptions& bvh_options = {},
+        float turntable_degrees_per_second = 0.0f);
 
 private:
     static ITextureView* LoadTexture(const std::string& texturepath, SceneAssets& assets);
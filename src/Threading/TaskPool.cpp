@@ -0,0 +1,130 @@
+#include "TaskPool.hpp"
+
+namespace devs_out_of_bounds {
+// Identifies the workers of a pool, threads outside of any pool keep the defaults
+static thread_local const TaskPool* t_worker_pool = nullptr;
+static thread_local unsigned int t_worker_index = 0;
+
+TaskPool::TaskPool(unsigned int num_threads, WorkerStart on_worker_start) {
+    StartWorkers(num_threads, std::move(on_worker_start));
+}
+
+TaskPool::~TaskPool() { StopWorkers(); }
+
+void TaskPool::Resize(unsigned int num_threads, WorkerStart on_worker_start) {
+    assert(m_queued_count.load() == 0 && "Resized a pool with queued tasks!");
+    StopWorkers();
+    StartWorkers(num_threads, std::move(on_worker_start));
+}
+
+void TaskPool::StartWorkers(unsigned int num_threads, WorkerStart&& on_worker_start) {
+    m_on_worker_start = std::move(on_worker_start);
+    m_should_exit = false;
+    m_queues.clear();
+    m_queues.reserve(num_threads + 1);
+    for (unsigned int i = 0; i < num_threads + 1; ++i) {
+        m_queues.push_back(std::make_unique<WorkQueue>());
+    }
+    m_threads.reserve(num_threads);
+    for (unsigned int i = 0; i < num_threads; ++i) {
+        m_threads.emplace_back([this, i]() { WorkerMain(i); });
+    }
+}
+
+void TaskPool::StopWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        m_should_exit = true;
+    }
+    m_cv.notify_all();
+    for (auto& t : m_threads) {
+        if (t.joinable())
+            t.join();
+    }
+    m_threads.clear();
+}
+
+void TaskPool::Submit(Task&& task) {
+    WorkQueue& queue = *m_queues[LocalQueueIndex()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+        m_queued_count.fetch_add(1);
+    }
+    // A worker going to sleep registers before it checks the queued count for the last time, so either it sees this
+    // task or this sees it sleeping
+    if (m_sleeping_count.load() > 0) {
+        { std::lock_guard<std::mutex> lock(m_sleep_mutex); }
+        m_cv.notify_one();
+    }
+}
+
+bool TaskPool::TryRunOne() {
+    const unsigned int queue_index = LocalQueueIndex();
+    Task task;
+    if (!PopLocal(queue_index, task) && !Steal(queue_index, task)) {
+        return false;
+    }
+    task();
+    return true;
+}
+
+unsigned int TaskPool::LocalQueueIndex() const {
+    return t_worker_pool == this ? t_worker_index : static_cast<unsigned int>(m_threads.size());
+}
+
+bool TaskPool::PopLocal(unsigned int queue_index, Task& out_task) {
+    WorkQueue& queue = *m_queues[queue_index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    // Newest first, nested forks are finished before older siblings are started
+    out_task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    m_queued_count.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool TaskPool::Steal(unsigned int thief_index, Task& out_task) {
+    const size_t queue_count = m_queues.size();
+    // Victims are visited starting after the thief, so thieves spread over the deques instead of all contending for
+    // the first one
+    for (size_t i = 1; i < queue_count; ++i) {
+        WorkQueue& queue = *m_queues[(thief_index + i) % queue_count];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        // Oldest first, this is usually the largest piece of the victims work
+        out_task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        m_queued_count.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void TaskPool::WorkerMain(unsigned int worker_index) {
+    t_worker_pool = this;
+    t_worker_index = worker_index;
+    if (m_on_worker_start) {
+        m_on_worker_start(worker_index);
+    }
+    while (true) {
+        Task task;
+        if (PopLocal(worker_index, task) || Steal(worker_index, task)) {
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_sleep_mutex);
+        m_sleeping_count.fetch_add(1);
+        m_cv.wait(lock, [this] { return m_queued_count.load() > 0 || m_should_exit; });
+        m_sleeping_count.fetch_sub(1);
+        if (m_should_exit && m_queued_count.load() == 0) {
+            return;
+        }
+    }
+}
+} // namespace devs_out_of_bounds
@@ -0,0 +1,133 @@
+#pragma once
+#include <src/Core.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace devs_out_of_bounds {
+// Fixed size pool of worker threads running fire-and-forget tasks. Every worker owns a deque: tasks it submits are
+// pushed to and popped from the back of its own deque, idle workers steal the oldest (and usually largest) task from
+// the front of another. Threads that wait on a TaskGroup help execute queued tasks, so tasks can fork and join nested
+// groups without starving the pool.
+class TaskPool : NoCopy, NoMove {
+public:
+    using Task = std::function<void()>;
+    // Runs first on every new worker thread, e.g. to pin it to a core
+    using WorkerStart = std::function<void(unsigned int worker_index)>;
+
+    // The thread that waits on a TaskGroup also runs tasks, so by default one core is left to it
+    TaskPool(unsigned int num_threads = DefaultThreadCount(), WorkerStart on_worker_start = {});
+    ~TaskPool();
+
+    // Joins all workers and starts num_threads new ones. Nothing may be queued or running on the pool, and no
+    // other thread may submit while it resizes.
+    void Resize(unsigned int num_threads, WorkerStart on_worker_start = {});
+
+    // Pushes to the deque of the calling worker, threads outside of the pool share one more deque
+    void Submit(Task&& task);
+
+    // Runs a single queued task on the calling thread, returns false if there was nothing to run
+    bool TryRunOne();
+
+    DOOB_NODISCARD unsigned int GetThreadCount() const { return static_cast<unsigned int>(m_threads.size()); }
+
+    DOOB_NODISCARD static unsigned int DefaultThreadCount() {
+        unsigned int core_count = std::thread::hardware_concurrency();
+        return core_count > 1 ? core_count - 1 : 0;
+    }
+
+private:
+    struct alignas(64) WorkQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void StartWorkers(unsigned int num_threads, WorkerStart&& on_worker_start);
+    void StopWorkers();
+    void WorkerMain(unsigned int worker_index);
+    // Index of the deque of the calling thread, the shared one for threads outside of this pool
+    DOOB_NODISCARD unsigned int LocalQueueIndex() const;
+    bool PopLocal(unsigned int queue_index, Task& out_task);
+    bool Steal(unsigned int thief_index, Task& out_task);
+
+    std::vector<std::thread> m_threads;
+    WorkerStart m_on_worker_start;
+    // One deque per worker, the last one is shared by all other threads
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+
+    // Tasks in all deques, idle workers only sleep once this reaches zero
+    alignas(64) std::atomic_int m_queued_count = { 0 };
+    std::atomic_int m_sleeping_count = { 0 };
+    std::mutex m_sleep_mutex;
+    std::condition_variable m_cv;
+    bool m_should_exit = false;
+};
+
+// Fork/join helper, tasks run on the pool (or inline when there is no pool) and Wait() blocks until all of them
+// have finished, executing queued work in the meantime.
+class TaskGroup : NoCopy, NoMove {
+public:
+    TaskGroup(TaskPool* pool) : m_pool(pool) {}
+    ~TaskGroup() { Wait(); }
+
+    template <typename TCallable>
+    void Run(TCallable&& fn) {
+        if (!m_pool) {
+            fn();
+            return;
+        }
+        m_pending.fetch_add(1, std::memory_order_relaxed);
+        m_pool->Submit([this, fn = std::forward<TCallable>(fn)]() mutable {
+            fn();
+            m_pending.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    // Calls fn(begin, end) on disjoint sub ranges of [begin, end) that cover it. Ranges are split in halves until
+    // they are at most grain long, the upper half is left for other workers to steal while the lower one is worked
+    // on, so large ranges spread over the pool and each worker keeps finishing neighbouring work. fn must outlive
+    // Wait().
+    template <typename TCallable>
+    void RunRange(uint32_t begin, uint32_t end, uint32_t grain, const TCallable& fn) {
+        grain = grain > 0 ? grain : 1;
+        if (!m_pool) {
+            for (uint32_t i = begin; i < end; i += grain) {
+                fn(i, i + grain < end ? i + grain : end);
+            }
+            return;
+        }
+        if (begin >= end) {
+            return;
+        }
+        Run([this, begin, end, grain, &fn]() { SplitRange(begin, end, grain, fn); });
+    }
+
+    void Wait() {
+        while (m_pending.load(std::memory_order_acquire) > 0) {
+            if (!m_pool->TryRunOne()) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+private:
+    template <typename TCallable>
+    void SplitRange(uint32_t begin, uint32_t end, uint32_t grain, const TCallable& fn) {
+        while (end - begin > grain) {
+            const uint32_t mid = begin + (end - begin) / 2;
+            Run([this, mid, end, grain, &fn]() { SplitRange(mid, end, grain, fn); });
+            end = mid;
+        }
+        fn(begin, end);
+    }
+
+    TaskPool* m_pool = nullptr;
+    std::atomic_int m_pending = { 0 };
+};
+} // namespace devs_out_of_bounds
@@ -0,0 +1,176 @@
+#include "ThreadPlacement.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <utility>
+
+#if defined(DOOB_PLATFORM_LINUX)
+#include <sched.h>
+#elif defined(DOOB_PLATFORM_FAMILY_WINDOWS)
+#define WIN32_LEAN_AND_MEAN 1
+#define NOMINMAX 1
+#include <Windows.h>
+#endif
+
+namespace devs_out_of_bounds {
+std::optional<ThreadAffinity> ParseThreadAffinity(std::string_view name) {
+    if (name == "none") {
+        return ThreadAffinity::None;
+    }
+    if (name == "physical") {
+        return ThreadAffinity::PhysicalCores;
+    }
+    if (name == "logical") {
+        return ThreadAffinity::LogicalCores;
+    }
+    return std::nullopt;
+}
+
+const char* ThreadAffinityName(ThreadAffinity affinity) {
+    switch (affinity) {
+    case ThreadAffinity::None:
+        return "none";
+    case ThreadAffinity::PhysicalCores:
+        return "physical";
+    case ThreadAffinity::LogicalCores:
+        return "logical";
+    }
+    return "none";
+}
+
+#if defined(DOOB_PLATFORM_LINUX)
+// -1 when the file is missing, e.g. in containers that hide the topology
+static int ReadTopologyValue(uint32_t cpu, const char* name) {
+    std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/" + name);
+    int value = -1;
+    if (!(file >> value)) {
+        return -1;
+    }
+    return value;
+}
+#endif
+
+CpuTopology CpuTopology::Query() {
+    CpuTopology topology;
+#if defined(DOOB_PLATFORM_LINUX)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        // Hardware threads of a core share its package and core id
+        std::map<std::pair<int, int>, std::vector<uint32_t>> cores;
+        for (uint32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (!CPU_ISSET(cpu, &allowed)) {
+                continue;
+            }
+            const int package_id = ReadTopologyValue(cpu, "physical_package_id");
+            const int core_id = ReadTopologyValue(cpu, "core_id");
+            if (core_id < 0) {
+                // Unknown topology, treat every logical CPU as a core of its own
+                cores[{ -1, static_cast<int>(cpu) }].push_back(cpu);
+            } else {
+                cores[{ package_id, core_id }].push_back(cpu);
+            }
+        }
+        for (auto& [key, cpus] : cores) {
+            topology.cores.push_back(std::move(cpus));
+        }
+        // Ordered by their first logical CPU, the way the kernel numbers them
+        std::sort(topology.cores.begin(), topology.cores.end());
+    }
+#endif
+    if (topology.cores.empty()) {
+        const uint32_t count = std::max(std::thread::hardware_concurrency(), 1U);
+        for (uint32_t cpu = 0; cpu < count; ++cpu) {
+            topology.cores.push_back({ cpu });
+        }
+    }
+    return topology;
+}
+
+size_t CpuTopology::LogicalCpuCount() const {
+    size_t count = 0;
+    for (const auto& core : cores) {
+        count += core.size();
+    }
+    return count;
+}
+
+ThreadPlan ThreadPlan::Make(const ThreadSettings& settings, const CpuTopology& topology) {
+    ThreadPlan plan;
+    plan.affinity = settings.affinity.value_or(ThreadAffinity::None);
+
+    std::vector<std::vector<uint32_t>> cores = topology.cores;
+    if (settings.b_reserve_ui_core.value_or(false) && cores.size() > 1) {
+        plan.ui_cpus = std::move(cores.back());
+        cores.pop_back();
+    }
+
+    switch (plan.affinity) {
+    case ThreadAffinity::None:
+        // Only kept off the reserved core, the OS is free to move them between the others
+        if (!plan.ui_cpus.empty()) {
+            std::vector<uint32_t> all_cpus;
+            for (const auto& core : cores) {
+                all_cpus.insert(all_cpus.end(), core.begin(), core.end());
+            }
+            plan.slots.push_back(std::move(all_cpus));
+        }
+        break;
+    case ThreadAffinity::PhysicalCores:
+        for (const auto& core : cores) {
+            plan.slots.push_back({ core.front() });
+        }
+        break;
+    case ThreadAffinity::LogicalCores:
+        for (const auto& core : cores) {
+            for (uint32_t cpu : core) {
+                plan.slots.push_back({ cpu });
+            }
+        }
+        break;
+    }
+
+    size_t usable = 0;
+    for (const auto& core : cores) {
+        usable += plan.affinity == ThreadAffinity::PhysicalCores ? 1 : core.size();
+    }
+    // The render thread takes one of the usable cores
+    plan.worker_count = settings.worker_count.value_or(usable > 1 ? static_cast<unsigned int>(usable - 1) : 0);
+    return plan;
+}
+
+void ThreadPlan::PinRenderThread(unsigned int index) const {
+    if (!slots.empty()) {
+        PinCurrentThread(slots[index % slots.size()]);
+    }
+}
+
+bool PinCurrentThread(const std::vector<uint32_t>& logical_cpus) {
+    if (logical_cpus.empty()) {
+        return false;
+    }
+#if defined(DOOB_PLATFORM_LINUX)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (uint32_t cpu : logical_cpus) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#elif defined(DOOB_PLATFORM_FAMILY_WINDOWS)
+    DWORD_PTR mask = 0;
+    for (uint32_t cpu : logical_cpus) {
+        if (cpu < sizeof(DWORD_PTR) * 8) {
+            mask |= DWORD_PTR(1) << cpu;
+        }
+    }
+    return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+    return false;
+#endif
+}
+} // namespace devs_out_of_bounds
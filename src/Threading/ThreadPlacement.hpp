@@ -0,0 +1,62 @@
+#pragma once
+#include <src/Core.hpp>
+
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace devs_out_of_bounds {
+enum class ThreadAffinity : uint8_t {
+    None,          // threads float, the OS schedules them
+    PhysicalCores, // one render thread per physical core, pinned to its first hardware thread
+    LogicalCores,  // one render thread per hardware thread, SMT siblings get consecutive threads
+};
+
+DOOB_NODISCARD std::optional<ThreadAffinity> ParseThreadAffinity(std::string_view name);
+DOOB_NODISCARD const char* ThreadAffinityName(ThreadAffinity affinity);
+
+// How the render threads are laid out over the machine. Fields left empty fall back to the defaults, so settings
+// from several sources (scene file, command line) can be layered with Overlay().
+struct ThreadSettings {
+    // Workers of the task pool, the render thread comes on top. Defaults to one render thread per usable core.
+    std::optional<unsigned int> worker_count = {};
+    std::optional<ThreadAffinity> affinity = {};
+    // Keeps one physical core free of render threads for the UI thread and I/O
+    std::optional<bool> b_reserve_ui_core = {};
+
+    // Fields set in other replace the ones in this
+    void Overlay(const ThreadSettings& other) {
+        worker_count = other.worker_count ? other.worker_count : worker_count;
+        affinity = other.affinity ? other.affinity : affinity;
+        b_reserve_ui_core = other.b_reserve_ui_core ? other.b_reserve_ui_core : b_reserve_ui_core;
+    }
+    DOOB_NODISCARD bool IsEmpty() const { return !worker_count && !affinity && !b_reserve_ui_core; }
+};
+
+// Logical CPUs the process may run on, grouped by the physical core they belong to
+struct CpuTopology {
+    std::vector<std::vector<uint32_t>> cores = {};
+
+    // Reads the topology on Linux, elsewhere every logical CPU is reported as its own core
+    DOOB_NODISCARD static CpuTopology Query();
+    DOOB_NODISCARD size_t LogicalCpuCount() const;
+};
+
+// Where every render thread runs. Slot 0 belongs to the render thread, worker i uses slot i + 1, wrapping around
+// when there are more threads than slots.
+struct ThreadPlan {
+    unsigned int worker_count = 0;
+    ThreadAffinity affinity = ThreadAffinity::None;
+    // Logical CPUs each slot is restricted to, empty when threads are not pinned
+    std::vector<std::vector<uint32_t>> slots = {};
+    // Reserved for the UI thread, empty when no core was reserved
+    std::vector<uint32_t> ui_cpus = {};
+
+    DOOB_NODISCARD static ThreadPlan Make(const ThreadSettings& settings, const CpuTopology& topology);
+    // Pins the calling thread to the slot of render thread index (0 for the render thread itself)
+    void PinRenderThread(unsigned int index) const;
+};
+
+// Restricts the calling thread to the given logical CPUs. Returns false where that is not supported or it failed.
+bool PinCurrentThread(const std::vector<uint32_t>& logical_cpus);
+} // namespace devs_out_of_bounds
@@ -0,0 +1,47 @@
+#pragma once
+#include <src/Core.hpp>
+
+#include <array>
+#include <atomic>
+
+namespace devs_out_of_bounds {
+// Hands the newest complete value from one producer thread to one consumer thread without locks. The producer
+// writes into its back slot and publishes it, the consumer picks up the latest published slot whenever it wants.
+// Neither side ever waits for the other, values the consumer was too slow to see are skipped.
+template <typename T>
+class TripleBuffer : NoCopy, NoMove {
+public:
+    // Producer side, the slot to write the next value into
+    DOOB_NODISCARD T& GetBack() { return m_slots[m_back]; }
+
+    // Producer side, makes the back slot the latest value and takes over the slot it replaced
+    void Publish() {
+        const uint32_t previous = m_latest.exchange(m_back | NEW_BIT, std::memory_order_acq_rel);
+        m_back = previous & INDEX_MASK;
+    }
+
+    // Consumer side, swaps in the latest value if one was published since the last call. Returns false when the
+    // front slot is still the newest.
+    bool AcquireLatest() {
+        if ((m_latest.load(std::memory_order_relaxed) & NEW_BIT) == 0) {
+            return false;
+        }
+        const uint32_t previous = m_latest.exchange(m_front, std::memory_order_acq_rel);
+        m_front = previous & INDEX_MASK;
+        return true;
+    }
+
+    // Consumer side, the value taken by the last successful AcquireLatest
+    DOOB_NODISCARD const T& GetFront() const { return m_slots[m_front]; }
+
+private:
+    static constexpr uint32_t INDEX_MASK = 0x3;
+    static constexpr uint32_t NEW_BIT = 0x4;
+
+    std::array<T, 3> m_slots = {};
+    // Each slot is owned by exactly one of back, front and latest at any time
+    alignas(64) uint32_t m_back = 0;
+    alignas(64) uint32_t m_front = 1;
+    alignas(64) std::atomic_uint32_t m_latest = { 2 };
+};
+} // namespace devs_out_of_bounds
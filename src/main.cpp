@@ -1,18 +1,26 @@
 #include <thread>
 #include <vector>
 
+#include <src/Graphics/Morton.hpp>
 #include <src/Graphics/Random.hpp>
 #include <src/Renderer/PathTracer.hpp>
+#include <src/Threading/TaskPool.hpp>
+#include <src/Threading/ThreadPlacement.hpp>
+#include <src/Threading/TripleBuffer.hpp>
 
 #define SDL_MAIN_USE_CALLBACKS 1 /* use the callbacks instead of main() */
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_main.h>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <chrono>
-#include <condition_variable>
+#include <cstring>
 #include <format>
 #include <functional>
 #include <mutex>
+#include <string_view>
 
 #ifdef DOOB_PLATFORM_FAMILY_WINDOWS
 #define WIN32_LEAN_AND_MEAN 1
@@ -25,38 +33,76 @@ static SDL_Window* g_window = nullptr;
 static SDL_Renderer* g_renderer = nullptr;
 static SDL_Texture* g_screen_texture = nullptr;
 static SDL_FRect g_dest_rect = {};
-static Pixel* g_framebuffer = nullptr;
-static float* g_time_buffer = nullptr;
-static bool g_show_timing = false;
+// False until a frame of the current texture size was uploaded, a new texture holds garbage
+static bool g_b_texture_has_frame = false;
 static devs_out_of_bounds::PathTracer* g_path_tracer = nullptr;
 
-static std::vector<std::thread> g_worker_threads;
-static std::atomic_int g_threads_active_count = { 0 };
-
-// Add explicit padding to prevent False Sharing between these two hot variables
-// (Aligns them to different 64-byte cache lines)
-struct alignas(64) AlignedAtomic {
-    std::atomic_int val;
+// A complete frame, along with the settings it was rendered with so the UI thread never reads the path tracer
+struct RenderedFrame {
+    std::vector<Pixel> pixels = {};
+    int width = 0;
+    int height = 0;
+    float render_time = 0.0f;
+    int tile_size = 0;
+    bool b_auto_tile_size = false;
+    unsigned int worker_count = 0;
+    uint32_t samples = 0;
+    uint32_t frame_samples = 0;
+    int max_light_bounces = 0;
+    bool b_gt7_tonemapper = false;
+    bool b_radiance_clamping = false;
+    float inv_shutter_speed = 0.0f;
+    float aperture = 0.0f;
+    float iso = 0.0f;
+    float exposure = 0.0f;
 };
-static AlignedAtomic g_hot_index; // Replaces g_next_tile_index
-
-static int g_frame_generation = 0;
-static std::condition_variable g_cv_start_work;
-static std::condition_variable g_cv_all_work_finished;
-static std::mutex g_work_mutex;
-static std::mutex g_completion_mutex;
-static int g_total_tiles = 0;
+// The render thread publishes every finished frame, the UI thread presents the newest one whenever it draws
+static devs_out_of_bounds::TripleBuffer<RenderedFrame> g_frames;
+static std::thread g_render_thread;
+static std::atomic_bool g_should_exit = { false };
+
+// Changes requested by the UI thread, the render thread applies them between frames
+static std::mutex g_input_mutex;
+static std::vector<std::function<void()>> g_pending_changes;
+static std::array<bool, SDL_SCANCODE_COUNT> g_key_state = {};
+
+// Only touched by the render thread (and the tiles it dispatches) once it runs
+static Pixel* g_framebuffer = nullptr;
+static std::vector<float> g_time_buffer;
+static bool g_show_timing = false;
 static int g_curr_width = 1;
 static int g_curr_height = 1;
-static int g_num_tiles_x = 1;
-static int g_num_tiles_y = 1;
-static bool g_should_exit = false;
 
-static constexpr int THREAD_DISPATCH_X = 64;
-static constexpr int THREAD_DISPATCH_Y = 64;
+// Workers steal tiles from each other, the render thread renders as well while it waits for a frame
+static devs_out_of_bounds::TaskPool* g_task_pool = nullptr;
+static devs_out_of_bounds::CpuTopology g_cpu_topology;
+// Only changed by the UI thread before the render thread starts, and by the render thread afterwards
+static devs_out_of_bounds::ThreadPlan g_thread_plan;
+
+// Square tiles, 0 picks the size from the resolution and thread count. Cycled with 7.
+static constexpr std::array<int, 5> TILE_SIZE_CHOICES = { 0, 16, 32, 64, 128 };
+static constexpr int MIN_AUTO_TILE_SIZE = 16;
+static constexpr int MAX_AUTO_TILE_SIZE = 128;
+// Tiles differ a lot in cost, with this many per thread stealing can even out the expensive ones
+static constexpr int AUTO_TILES_PER_THREAD = 8;
+static int g_tile_size_choice = 0;
+
+// Tile origins of a frame in the order they are handed out, rebuilt when the resolution or tile size changes
+struct TileSchedule {
+    int width = 0;
+    int height = 0;
+    int tile_size = 0;
+    std::vector<glm::ivec2> tiles = {};
+};
+static TileSchedule g_tile_schedule;
+
+// A converging view takes as many samples per pixel before it is resolved and published as fit in one frame at this
+// rate, so less of its time goes to tonemapping and uploads. A view that changes always takes one per frame.
+static constexpr float DEFAULT_PRESENT_RATE = 30.0f;
+static constexpr uint32_t MAX_FRAME_SAMPLES = 64;
+static float g_target_present_rate = DEFAULT_PRESENT_RATE;
 
-static void RenderRegion(
-    int dispatch_id, uint32_t& seed, int x_start, int y_start, int width, int height, int fb_width);
+static void RenderRegion(uint32_t& seed, int x_start, int y_start, int width, int height, int fb_width);
 
 glm::vec3 GetHeatmapColor(float t) {
     // Ensure t is clamped for the gradient lookup
@@ -92,68 +138,81 @@ glm::vec3 GetHeatmapColor(float t) {
     return glm::mix(c5, c6, (t - 0.83f) / 0.17f);
 }
 
-static void InitThreads() {
+// Starts the workers of the plan, or restarts them when the pool is running already. Must not run during a frame.
+static void ApplyThreadPlan(const devs_out_of_bounds::ThreadPlan& plan) {
+    g_thread_plan = plan;
+    devs_out_of_bounds::TaskPool::WorkerStart pin_worker = {};
+    if (!plan.slots.empty()) {
+        pin_worker = [plan](unsigned int worker_index) { plan.PinRenderThread(worker_index + 1); };
+    }
+    if (!g_task_pool) {
+        g_task_pool = new devs_out_of_bounds::TaskPool(plan.worker_count, std::move(pin_worker));
+    } else {
+        g_task_pool->Resize(plan.worker_count, std::move(pin_worker));
+    }
+}
 
-// 4. Launch Threads
-// Only launch as many threads as you have cores.
-#if defined(NDEBUG)
-    unsigned int core_count = std::thread::hardware_concurrency();
-#else
-    // make it easier to debug!
-    unsigned int core_count = 1;
+static void InitThreads(const devs_out_of_bounds::ThreadSettings& settings) {
+    // By default one worker less than there are cores, the render thread takes the last one while it waits for a
+    // frame
+    devs_out_of_bounds::ThreadSettings resolved = {};
+#if !defined(NDEBUG)
+    // make it easier to debug! Everything runs on the render thread
+    resolved.worker_count = 0;
 #endif
-    for (unsigned int i = 0; i < core_count; ++i) {
-        g_worker_threads.emplace_back([dispatch_id = i]() {
-            int my_local_gen = 0;
-            uint32_t seed = dispatch_id;
-            UniformDistribution::RandomStateAdvance(seed);
-            while (true) {
-                // --- Wait Phase ---
-                {
-                    std::unique_lock<std::mutex> lock(g_work_mutex);
-                    g_cv_start_work.wait(lock, [&] {
-                        // Wake up ONLY if the global generation is newer than mine
-                        return (g_frame_generation > my_local_gen) || g_should_exit;
-                    });
-                }
-                if (g_should_exit)
-                    return;
-                // Update my generation so I don't run this frame twice
-                my_local_gen = g_frame_generation;
-
-                // --- Work Phase ---
-                while (true) {
-                    int my_job_index = g_hot_index.val.fetch_add(1);
-
-                    if (my_job_index >= g_total_tiles) {
-                        break; // No more tiles
-                    }
-
-                    // Render Logic
-                    int tile_x_index = my_job_index % g_num_tiles_x;
-                    int tile_y_index = my_job_index / g_num_tiles_x;
-                    int pixel_x = tile_x_index * THREAD_DISPATCH_X;
-                    int pixel_y = tile_y_index * THREAD_DISPATCH_Y;
-                    int current_draw_w = std::min(THREAD_DISPATCH_X, g_curr_width - pixel_x);
-                    int current_draw_h = std::min(THREAD_DISPATCH_Y, g_curr_height - pixel_y);
-
-                    RenderRegion(dispatch_id, seed, pixel_x, pixel_y, current_draw_w, current_draw_h, g_curr_width);
-                }
+    resolved.Overlay(settings);
+    ApplyThreadPlan(devs_out_of_bounds::ThreadPlan::Make(resolved, g_cpu_topology));
+}
 
-                // --- Completion Phase ---
-                // Decrement active count. fetch_sub returns the value BEFORE decrementing.
-                int remaining_threads = g_threads_active_count.fetch_sub(1) - 1;
+struct CommandLineOptions {
+    devs_out_of_bounds::ThreadSettings thread_settings = {};
+    // 0 takes a single sample per frame
+    float present_rate = DEFAULT_PRESENT_RATE;
+};
 
-                if (remaining_threads == 0) {
-                    // Last thread notifies Main
-                    std::lock_guard<std::mutex> lock(g_completion_mutex);
-                    g_cv_all_work_finished.notify_one();
-                }
+// --workers <count>, --affinity none|physical|logical, --reserve-ui-core, --present-rate <hz>
+static CommandLineOptions ParseCommandLine(int argc, char* argv[]) {
+    CommandLineOptions options = {};
+    devs_out_of_bounds::ThreadSettings& settings = options.thread_settings;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        const bool b_has_value = i + 1 < argc;
+        if (arg == "--workers" && b_has_value) {
+            settings.worker_count = static_cast<unsigned int>(std::max(std::atoi(argv[++i]), 0));
+        } else if (arg == "--affinity" && b_has_value) {
+            settings.affinity = devs_out_of_bounds::ParseThreadAffinity(argv[++i]);
+            if (!settings.affinity) {
+                SDL_Log("Unknown affinity '%s', expected none, physical or logical", argv[i]);
             }
-        });
+        } else if (arg == "--reserve-ui-core") {
+            settings.b_reserve_ui_core = true;
+        } else if (arg == "--present-rate" && b_has_value) {
+            options.present_rate = std::max(static_cast<float>(std::atof(argv[++i])), 0.0f);
+        } else {
+            SDL_Log("Ignoring unknown argument '%s'", argv[i]);
+        }
     }
+    return options;
+}
+
+// Every thread that renders tiles keeps its own random state across frames
+static uint32_t& ThreadSeed() {
+    static std::atomic_uint32_t next_dispatch_id = { 0 };
+    thread_local uint32_t seed = [] {
+        uint32_t s = next_dispatch_id.fetch_add(1, std::memory_order_relaxed);
+        UniformDistribution::RandomStateAdvance(s);
+        return s;
+    }();
+    return seed;
 }
 
+static void QueueChange(std::function<void()>&& change) {
+    std::lock_guard<std::mutex> lock(g_input_mutex);
+    g_pending_changes.push_back(std::move(change));
+}
+
+static void RenderLoop();
+
 /* This function runs once at startup. */
 SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[]) {
 #if !defined(NDEBUG) 
@@ -189,13 +248,33 @@ SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[]) {
     g_screen_texture =
         SDL_CreateTexture(g_renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, initial_w, initial_h);
     g_dest_rect = { 0, 0, static_cast<float>(initial_w), static_cast<float>(initial_h) };
-    g_framebuffer = new Pixel[initial_w * initial_h];
-    g_time_buffer = new float[initial_w * initial_h];
+    g_curr_width = initial_w;
+    g_curr_height = initial_h;
+    g_time_buffer.resize(static_cast<size_t>(initial_w) * initial_h);
     SDL_Log("Succesfully initialised SDL");
 
-    g_path_tracer = new devs_out_of_bounds::PathTracer();
+    const CommandLineOptions options = ParseCommandLine(argc, argv);
+    const devs_out_of_bounds::ThreadSettings& cli_thread_settings = options.thread_settings;
+    g_target_present_rate = options.present_rate;
+    g_cpu_topology = devs_out_of_bounds::CpuTopology::Query();
+    InitThreads(cli_thread_settings);
+    g_path_tracer = new devs_out_of_bounds::PathTracer(g_task_pool);
     g_path_tracer->OnResize(initial_w, initial_h);
-    InitThreads();
+
+    // The pool had to exist to load the scene, restart it if the scene asks for another layout
+    const auto& scene_thread_settings = g_path_tracer->m_parameters.assets.thread_settings;
+    if (!scene_thread_settings.IsEmpty()) {
+        devs_out_of_bounds::ThreadSettings settings = scene_thread_settings;
+        settings.Overlay(cli_thread_settings);
+        InitThreads(settings);
+    }
+    devs_out_of_bounds::PinCurrentThread(g_thread_plan.ui_cpus);
+    SDL_Log("%zu cores (%zu logical), %u workers, affinity %s%s", g_cpu_topology.cores.size(),
+        g_cpu_topology.LogicalCpuCount(), g_thread_plan.worker_count,
+        devs_out_of_bounds::ThreadAffinityName(g_thread_plan.affinity),
+        g_thread_plan.ui_cpus.empty() ? "" : ", one core reserved for the UI");
+
+    g_render_thread = std::thread(RenderLoop);
     return SDL_APP_CONTINUE; /* carry on with the program! */
 }
 
@@ -216,36 +295,60 @@ SDL_AppResult SDL_AppEvent(void* appstate, SDL_Event* event) {
         }
         g_screen_texture = SDL_CreateTexture(g_renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, w, h);
         g_dest_rect = { 0, 0, static_cast<float>(w), static_cast<float>(h) };
-        if (g_framebuffer) {
-            delete[] g_framebuffer;
-        }
-        g_framebuffer = new Pixel[w * h];
-        if (g_time_buffer) {
-            delete[] g_time_buffer;
-        }
-        g_time_buffer = new float[w * h];
+        g_b_texture_has_frame = false;
         SDL_SetRenderLogicalPresentation(g_renderer, w, h, SDL_LOGICAL_PRESENTATION_LETTERBOX);
-        g_path_tracer->OnResize(w, h);
+        // Frames already in flight keep their size, the presentation skips them until one of the new size arrives
+        QueueChange([w, h]() {
+            g_curr_width = w;
+            g_curr_height = h;
+            g_time_buffer.resize(static_cast<size_t>(w) * h);
+            g_path_tracer->OnResize(w, h);
+        });
 
         return SDL_APP_CONTINUE;
     }
     case SDL_EVENT_KEY_DOWN: {
-        if (event->key.key == SDLK_1 && !event->key.repeat) {
-            g_path_tracer->m_parameters.max_light_bounces = (g_path_tracer->m_parameters.max_light_bounces + 1) % 17;
-            g_path_tracer->ResetAccumulator();
+        if (event->key.repeat) {
+            return SDL_APP_CONTINUE;
         }
-        if (event->key.key == SDLK_2 && !event->key.repeat) {
-            g_path_tracer->m_parameters.b_gt7_tonemapper = !g_path_tracer->m_parameters.b_gt7_tonemapper;
+        devs_out_of_bounds::PathTracerParameters& params = g_path_tracer->m_parameters;
+        if (event->key.key == SDLK_1) {
+            QueueChange([&params]() {
+                params.max_light_bounces = (params.max_light_bounces + 1) % 17;
+                g_path_tracer->ResetAccumulator();
+            });
         }
-        if (event->key.key == SDLK_3 && !event->key.repeat) {
-            g_path_tracer->m_parameters.b_radiance_clamping = !g_path_tracer->m_parameters.b_radiance_clamping;
-            g_path_tracer->ResetAccumulator();
+        if (event->key.key == SDLK_2) {
+            QueueChange([&params]() { params.b_gt7_tonemapper = !params.b_gt7_tonemapper; });
         }
-        if (event->key.key == SDLK_4 && !event->key.repeat) {
-            g_show_timing = !g_show_timing;
+        if (event->key.key == SDLK_3) {
+            QueueChange([&params]() {
+                params.b_radiance_clamping = !params.b_radiance_clamping;
+                g_path_tracer->ResetAccumulator();
+            });
         }
-        if (event->key.key == SDLK_0 && !event->key.repeat) {
-            g_path_tracer->m_parameters.b_accumulate = !g_path_tracer->m_parameters.b_accumulate;
+        if (event->key.key == SDLK_4) {
+            QueueChange([]() { g_show_timing = !g_show_timing; });
+        }
+        if (event->key.key == SDLK_5) {
+            QueueChange([&params]() { params.b_packet_primary_rays = !params.b_packet_primary_rays; });
+        }
+        if (event->key.key == SDLK_6) {
+            QueueChange([&params]() { params.b_sort_secondary_rays = !params.b_sort_secondary_rays; });
+        }
+        if (event->key.key == SDLK_7) {
+            QueueChange([]() { g_tile_size_choice = (g_tile_size_choice + 1) % TILE_SIZE_CHOICES.size(); });
+        }
+        if (event->key.key == SDLK_8 || event->key.key == SDLK_9) {
+            const int delta = event->key.key == SDLK_9 ? 1 : -1;
+            QueueChange([delta]() {
+                devs_out_of_bounds::ThreadPlan plan = g_thread_plan;
+                plan.worker_count = static_cast<unsigned int>(std::max(static_cast<int>(plan.worker_count) + delta, 0));
+                ApplyThreadPlan(plan);
+            });
+        }
+        if (event->key.key == SDLK_0) {
+            QueueChange([&params]() { params.b_accumulate = !params.b_accumulate; });
         }
         return SDL_APP_CONTINUE;
     }
@@ -256,6 +359,115 @@ SDL_AppResult SDL_AppEvent(void* appstate, SDL_Event* event) {
 
 static void DrawFramebuffer(int width, int height);
 
+// Runs on its own thread until exit, frames are traced back to back no matter how often the UI thread presents
+static void RenderLoop() {
+    g_thread_plan.PinRenderThread(0);
+    std::vector<std::function<void()>> changes = {};
+    std::array<bool, SDL_SCANCODE_COUNT> key_state = {};
+    auto last_frame = std::chrono::high_resolution_clock::now();
+    uint32_t requested_samples = 1;
+
+    while (!g_should_exit.load(std::memory_order_relaxed)) {
+        {
+            std::lock_guard<std::mutex> lock(g_input_mutex);
+            changes.swap(g_pending_changes);
+            key_state = g_key_state;
+        }
+        for (const auto& change : changes) {
+            change();
+        }
+        changes.clear();
+
+        auto current_frame = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<float> duration = current_frame - last_frame;
+        last_frame = current_frame;
+        g_path_tracer->OnUpdate(duration.count(), key_state.data());
+        const uint32_t frame_samples = g_path_tracer->SetFrameSamples(requested_samples);
+
+        RenderedFrame& frame = g_frames.GetBack();
+        frame.width = g_curr_width;
+        frame.height = g_curr_height;
+        frame.pixels.resize(static_cast<size_t>(frame.width) * frame.height);
+        g_framebuffer = frame.pixels.data();
+
+        const auto render_start = std::chrono::high_resolution_clock::now();
+        DrawFramebuffer(frame.width, frame.height);
+        const std::chrono::duration<float> render_duration = std::chrono::high_resolution_clock::now() - render_start;
+        if (g_should_exit.load(std::memory_order_relaxed)) {
+            break; // tiles were skipped, the frame is incomplete
+        }
+        frame.render_time = render_duration.count();
+
+        // Sized from the cost of a sample in this frame, growing by at most double per frame so a single cheap
+        // frame can not stall the next present for long
+        if (g_target_present_rate > 0.0f && frame.render_time > 0.0f) {
+            const float sample_time = frame.render_time / static_cast<float>(frame_samples);
+            const float fitting_samples = 1.0f / (g_target_present_rate * sample_time);
+            requested_samples = static_cast<uint32_t>(
+                std::clamp(fitting_samples, 1.0f, static_cast<float>(std::min(frame_samples * 2, MAX_FRAME_SAMPLES))));
+        } else {
+            requested_samples = 1;
+        }
+
+        if (g_show_timing) {
+            for (int y = 0; y < g_curr_height; ++y) {
+                for (int x = 0; x < g_curr_width; ++x) {
+                    float avgTimePerPixel = frame.render_time / static_cast<float>(g_curr_height * g_curr_width);
+                    float ratio = g_time_buffer[x + y * g_curr_width] / avgTimePerPixel;
+
+                    // Adjust 'MAX_RATIO' to define what is "too expensive".
+                    // e.g., 4.0 means "Red/White" happens at 4x the average cost.
+                    static constexpr float MAX_RATIO = 100.0f;
+                    float t_normalized = ratio / MAX_RATIO;
+
+                    float t_visual = glm::pow(t_normalized, 1.0f / 2.2f);
+
+                    glm::vec3 col = GetHeatmapColor(t_visual);
+                    g_framebuffer[x + y * g_curr_width] = DOOB_WRITE_PIXEL_F32(col.r, col.g, col.b, 1.0f);
+                }
+            }
+        }
+
+        devs_out_of_bounds::PathTracerParameters& params = g_path_tracer->m_parameters;
+        frame.tile_size = g_tile_schedule.tile_size;
+        frame.b_auto_tile_size = TILE_SIZE_CHOICES[g_tile_size_choice] == 0;
+        frame.worker_count = g_task_pool->GetThreadCount();
+        frame.samples = g_path_tracer->GetSamplesAccumulated();
+        frame.frame_samples = frame_samples;
+        frame.max_light_bounces = params.max_light_bounces;
+        frame.b_gt7_tonemapper = params.b_gt7_tonemapper;
+        frame.b_radiance_clamping = params.b_radiance_clamping;
+        params.assets.camera.GetSensor(frame.aperture, frame.inv_shutter_speed, frame.iso);
+        frame.exposure = expf(params.assets.camera.GetLogExposure());
+        g_frames.Publish();
+    }
+}
+
+// Copies a frame straight into the streaming texture, instead of through the staging copy of SDL_UpdateTexture
+static void UploadFrame(const RenderedFrame& frame) {
+    // Rendered before the last resize, a frame of the new size follows
+    if (frame.width != static_cast<int>(g_dest_rect.w) || frame.height != static_cast<int>(g_dest_rect.h)) {
+        return;
+    }
+    void* texture_pixels = nullptr;
+    int pitch = 0;
+    if (!SDL_LockTexture(g_screen_texture, nullptr, &texture_pixels, &pitch)) {
+        SDL_Log("Failed to lock screen texture: %s", SDL_GetError());
+        return;
+    }
+    const size_t row_bytes = static_cast<size_t>(frame.width) * sizeof(Pixel);
+    if (static_cast<size_t>(pitch) == row_bytes) {
+        std::memcpy(texture_pixels, frame.pixels.data(), row_bytes * frame.height);
+    } else {
+        for (int y = 0; y < frame.height; ++y) {
+            std::memcpy(static_cast<uint8_t*>(texture_pixels) + static_cast<size_t>(y) * pitch,
+                &frame.pixels[static_cast<size_t>(y) * frame.width], row_bytes);
+        }
+    }
+    SDL_UnlockTexture(g_screen_texture);
+    g_b_texture_has_frame = true;
+}
+
 /* This function runs once per frame, and is the heart of the program. */
 SDL_AppResult SDL_AppIterate(void* appstate) {
     static auto last_frame = std::chrono::high_resolution_clock::now();
@@ -264,46 +476,38 @@ SDL_AppResult SDL_AppIterate(void* appstate) {
     float frame_time = duration.count();
     last_frame = current_frame;
 
-    g_path_tracer->OnUpdate(frame_time);
+    {
+        // The render thread samples the keys once per frame it traces
+        int key_count = 0;
+        const bool* state = SDL_GetKeyboardState(&key_count);
+        std::lock_guard<std::mutex> lock(g_input_mutex);
+        std::copy_n(state, std::min<size_t>(key_count, g_key_state.size()), g_key_state.begin());
+    }
 
     SDL_RenderClear(g_renderer);
 
-    DrawFramebuffer(g_dest_rect.w, g_dest_rect.h);
-
-    if (g_show_timing) {
-        for (int y = 0; y < g_curr_height; ++y) {
-            for (int x = 0; x < g_curr_width; ++x) {
-                float avgTimePerPixel = frame_time / static_cast<float>(g_curr_height * g_curr_width);
-                float ratio = g_time_buffer[x + y * g_curr_width] / avgTimePerPixel;
-
-                // Adjust 'MAX_RATIO' to define what is "too expensive".
-                // e.g., 4.0 means "Red/White" happens at 4x the average cost.
-                static constexpr float MAX_RATIO = 100.0f;
-                float t_normalized = ratio / MAX_RATIO;
-
-                float t_visual = glm::pow(t_normalized, 1.0f / 2.2f);
-
-                glm::vec3 col = GetHeatmapColor(t_visual);
-                g_framebuffer[x + y * g_curr_width] = DOOB_WRITE_PIXEL_F32(col.r, col.g, col.b, 1.0f);
-            }
-        }
+    // Never waits on the render thread, without a new frame the last one is presented again
+    if (g_frames.AcquireLatest()) {
+        UploadFrame(g_frames.GetFront());
+    }
+    const RenderedFrame& frame = g_frames.GetFront();
+    if (g_b_texture_has_frame) {
+        SDL_RenderTexture(g_renderer, g_screen_texture, nullptr, &g_dest_rect);
     }
-    SDL_UpdateTexture(g_screen_texture, NULL, g_framebuffer, g_dest_rect.w * sizeof(Pixel));
-    SDL_RenderTexture(g_renderer, g_screen_texture, nullptr, &g_dest_rect);
 
     SDL_SetRenderDrawColor(g_renderer, 255, 255, 255, 255);
-    SDL_RenderDebugTextFormat(g_renderer, 16.f, 16.f, "jetwave | FPS: %i, Frame Time: %.2f ms",
-        static_cast<int>(1.0 / frame_time), 1000.0f * frame_time);
+    SDL_RenderDebugTextFormat(g_renderer, 16.f, 16.f,
+        "jetwave | FPS: %i, Frame Time: %.2f ms, Render Time: %.2f ms | Tiles: %ipx%s | Workers: %u",
+        static_cast<int>(1.0 / frame_time), 1000.0f * frame_time, 1000.0f * frame.render_time, frame.tile_size,
+        frame.b_auto_tile_size ? " (auto)" : "", frame.worker_count);
     SDL_RenderDebugTextFormat(g_renderer, 16.f, 26.f,
-        "Max Light Bounces: %i | Tone Mapper: %s | Samples: %u | Clamping: %s",
-        g_path_tracer->m_parameters.max_light_bounces, g_path_tracer->m_parameters.b_gt7_tonemapper ? "GT7" : "Exp",
-        g_path_tracer->GetSamplesAccumulated(), g_path_tracer->m_parameters.b_radiance_clamping ? "Yes" : "No");
-    float inv_shutter_speed, aperture, iso;
-    g_path_tracer->m_parameters.assets.camera.GetSensor(aperture, inv_shutter_speed, iso);
+        "Max Light Bounces: %i | Tone Mapper: %s | Samples: %u (%u per frame) | Clamping: %s",
+        frame.max_light_bounces, frame.b_gt7_tonemapper ? "GT7" : "Exp", frame.samples, frame.frame_samples,
+        frame.b_radiance_clamping ? "Yes" : "No");
     SDL_RenderDebugTextFormat(g_renderer, 16.f, 36.f,
         "Shutter Speed: 1 / %i | Aperture: %.1ff | ISO: %i | Exposure: %.3f",
-        static_cast<int>(std::round(inv_shutter_speed)), aperture, static_cast<int>(std::round(iso)),
-        expf(g_path_tracer->m_parameters.assets.camera.GetLogExposure()));
+        static_cast<int>(std::round(frame.inv_shutter_speed)), frame.aperture, static_cast<int>(std::round(frame.iso)),
+        frame.exposure);
 
     SDL_RenderPresent(g_renderer);
     return SDL_APP_CONTINUE; /* carry on with the program! */
@@ -311,75 +515,140 @@ SDL_AppResult SDL_AppIterate(void* appstate) {
 
 /* This function runs once at shutdown. */
 void SDL_AppQuit(void* appstate, SDL_AppResult result) {
-    {
-        std::lock_guard<std::mutex> lock(g_work_mutex);
-        g_should_exit = true;
-    }
-    g_cv_start_work.notify_all();
-
-    for (auto& t : g_worker_threads) {
-        if (t.joinable())
-            t.join();
+    g_should_exit = true;
+    if (g_render_thread.joinable()) {
+        g_render_thread.join();
     }
-    g_worker_threads.clear();
 
     delete g_path_tracer;
     g_path_tracer = nullptr;
-    if (g_framebuffer) {
-        delete[] g_framebuffer;
-        g_framebuffer = nullptr;
-    }
-    if (g_time_buffer) {
-        delete[] g_time_buffer;
-        g_time_buffer = nullptr;
-    }
+    delete g_task_pool;
+    g_task_pool = nullptr;
 }
 
-void RenderRegion(int dispatch_id, uint32_t& seed, int x_start, int y_start, int width, int height, int fb_width) {
+void RenderRegion(uint32_t& seed, int x_start, int y_start, int width, int height, int fb_width) {
     int x_end = x_start + width;
     int y_end = y_start + height;
 
-    for (int y = y_start; y < y_end; ++y) {
-        Pixel* row_ptr = &g_framebuffer[y * fb_width];
-        float* time_row_ptr = &g_time_buffer[y * fb_width];
-        for (int x = x_start; x < x_end; ++x) {
+    if (g_path_tracer->m_parameters.b_sort_secondary_rays) {
+        // The whole tile is one wavefront, its cost is spread evenly over the tile
+        auto then = std::chrono::high_resolution_clock::now();
+        g_path_tracer->EvaluateRegion(
+            x_start, y_start, width, height, seed, &g_framebuffer[y_start * fb_width + x_start], fb_width);
+        auto now = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<float> duration = now - then;
+        float pixel_time = duration.count() / static_cast<float>(width * height);
+        for (int y = y_start; y < y_end; ++y) {
+            std::fill_n(&g_time_buffer[y * fb_width + x_start], width, pixel_time);
+        }
+        return;
+    }
+    if (g_path_tracer->m_parameters.b_packet_primary_rays) {
+        // Square blocks keep the primary rays of a packet coherent, the cost is spread evenly over the block
+        constexpr int PACKET_DIM = 4;
+        static_assert(PACKET_DIM * PACKET_DIM == devs_out_of_bounds::RayPacket::SIZE);
+        // Blocks are visited in Morton order, so consecutive packets stay close on screen and in the BVH
+        const int blocks_x = (width + PACKET_DIM - 1) / PACKET_DIM;
+        const int blocks_y = (height + PACKET_DIM - 1) / PACKET_DIM;
+        const uint32_t side = std::bit_ceil(static_cast<uint32_t>(std::max(blocks_x, blocks_y)));
+        for (uint32_t code = 0; code < side * side; ++code) {
+            const glm::uvec2 block = devs_out_of_bounds::MortonDecode2(code);
+            if (block.x >= static_cast<uint32_t>(blocks_x) || block.y >= static_cast<uint32_t>(blocks_y)) {
+                continue;
+            }
+            int x = x_start + static_cast<int>(block.x) * PACKET_DIM;
+            int y = y_start + static_cast<int>(block.y) * PACKET_DIM;
+            int block_w = std::min(PACKET_DIM, x_end - x);
+            int block_h = std::min(PACKET_DIM, y_end - y);
             auto then = std::chrono::high_resolution_clock::now();
-            row_ptr[x] = g_path_tracer->Evaluate(x, y, seed);
+            g_path_tracer->EvaluatePacket(x, y, block_w, block_h, seed, &g_framebuffer[y * fb_width + x], fb_width);
             auto now = std::chrono::high_resolution_clock::now();
             std::chrono::duration<float> duration = now - then;
-            time_row_ptr[x] = duration.count();
+            float pixel_time = duration.count() / static_cast<float>(block_w * block_h);
+            for (int by = y; by < y + block_h; ++by) {
+                std::fill_n(&g_time_buffer[by * fb_width + x], block_w, pixel_time);
+            }
         }
+        return;
     }
-}
-void DrawFramebuffer(int width, int height) {
-    g_curr_width = width;
-    g_curr_height = height;
-
-    int num_tiles_x = (width + THREAD_DISPATCH_X - 1) / THREAD_DISPATCH_X;
-    int num_tiles_y = (height + THREAD_DISPATCH_Y - 1) / THREAD_DISPATCH_Y;
-    g_num_tiles_x = num_tiles_x;
-    g_total_tiles = num_tiles_x * num_tiles_y;
 
-    // Reset Job Counter
-    g_hot_index.val = 0;
-
-    // Set active threads to the total count
-    g_threads_active_count = g_worker_threads.size();
+    // Pixels are visited in Morton order, consecutive paths start from neighbouring pixels and share the BVH nodes,
+    // texels and accumulator lines they touch
+    const uint32_t side = std::bit_ceil(static_cast<uint32_t>(std::max(width, height)));
+    for (uint32_t code = 0; code < side * side; ++code) {
+        const glm::uvec2 pixel = devs_out_of_bounds::MortonDecode2(code);
+        if (pixel.x >= static_cast<uint32_t>(width) || pixel.y >= static_cast<uint32_t>(height)) {
+            continue;
+        }
+        int x = x_start + static_cast<int>(pixel.x);
+        int y = y_start + static_cast<int>(pixel.y);
+        auto then = std::chrono::high_resolution_clock::now();
+        g_framebuffer[y * fb_width + x] = g_path_tracer->Evaluate(x, y, seed);
+        auto now = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<float> duration = now - then;
+        g_time_buffer[y * fb_width + x] = duration.count();
+    }
+}
+// Largest power of two tile that still leaves every thread enough tiles to steal from each other
+static int ChooseTileSize(int width, int height) {
+    const int thread_count = static_cast<int>(g_task_pool->GetThreadCount()) + 1;
+    int tile_size = MAX_AUTO_TILE_SIZE;
+    while (tile_size > MIN_AUTO_TILE_SIZE) {
+        const int tile_count = ((width + tile_size - 1) / tile_size) * ((height + tile_size - 1) / tile_size);
+        if (tile_count >= thread_count * AUTO_TILES_PER_THREAD) {
+            break;
+        }
+        tile_size /= 2;
+    }
+    return tile_size;
+}
 
-    // --- WAKE WORKERS ---
-    {
-        std::lock_guard<std::mutex> lock(g_work_mutex);
-        g_frame_generation++; // Increment Ticket Number
+// Orders the tiles along a Hilbert curve. A range of consecutive tiles is a compact patch of the screen, so each
+// worker (and each stolen half of a range) keeps to one area of the scene.
+static void BuildTileSchedule(int width, int height, int tile_size) {
+    g_tile_schedule.width = width;
+    g_tile_schedule.height = height;
+    g_tile_schedule.tile_size = tile_size;
+    g_tile_schedule.tiles.clear();
+
+    const int num_tiles_x = (width + tile_size - 1) / tile_size;
+    const int num_tiles_y = (height + tile_size - 1) / tile_size;
+    // The curve covers the smallest power of two square around the grid, cells outside of the grid are skipped
+    const uint32_t side = std::bit_ceil(static_cast<uint32_t>(std::max(num_tiles_x, num_tiles_y)));
+    for (uint32_t d = 0; d < side * side; ++d) {
+        const glm::uvec2 cell = devs_out_of_bounds::HilbertDecode2(side, d);
+        if (cell.x < static_cast<uint32_t>(num_tiles_x) && cell.y < static_cast<uint32_t>(num_tiles_y)) {
+            g_tile_schedule.tiles.push_back(
+                { static_cast<int>(cell.x) * tile_size, static_cast<int>(cell.y) * tile_size });
+        }
     }
-    g_cv_start_work.notify_all();
+}
 
-    // --- WAIT FOR COMPLETION ---
-    {
-        std::unique_lock<std::mutex> lock(g_completion_mutex);
-        // Wait until all threads have checked out
-        g_cv_all_work_finished.wait(lock, [] { return g_threads_active_count == 0; });
+void DrawFramebuffer(int width, int height) {
+    const int tile_size = TILE_SIZE_CHOICES[g_tile_size_choice] > 0 ? TILE_SIZE_CHOICES[g_tile_size_choice]
+                                                                     : ChooseTileSize(width, height);
+    if (g_tile_schedule.width != width || g_tile_schedule.height != height || g_tile_schedule.tile_size != tile_size) {
+        BuildTileSchedule(width, height, tile_size);
     }
 
-    // Note: We no longer need to "Reset" a boolean flag here.
-    // The generation counter naturally handles the state.
-}
\ No newline at end of file
+    const auto render_tiles = [tile_size, width, height](uint32_t first_tile, uint32_t end_tile) {
+        uint32_t& seed = ThreadSeed();
+        for (uint32_t tile = first_tile; tile < end_tile; ++tile) {
+            // Shutting down, the rest of the frame is dropped
+            if (g_should_exit.load(std::memory_order_relaxed)) {
+                return;
+            }
+            const glm::ivec2 origin = g_tile_schedule.tiles[tile];
+            int current_draw_w = std::min(tile_size, width - origin.x);
+            int current_draw_h = std::min(tile_size, height - origin.y);
+
+            RenderRegion(seed, origin.x, origin.y, current_draw_w, current_draw_h, width);
+        }
+    };
+
+    // The tile range is split down to single tiles, workers that run dry steal the largest remaining half from
+    // another one instead of contending on a shared counter
+    devs_out_of_bounds::TaskGroup group(g_task_pool);
+    group.RunRange(0, static_cast<uint32_t>(g_tile_schedule.tiles.size()), 1, render_tiles);
+    group.Wait();
+}